@@ -0,0 +1,132 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/time.h>
+#include "trottersuzuki.h"
+#include "common.h"
+
+#define BLOCK_DIM 128
+#define HALO 4
+#define REPETITIONS 10
+
+enum CopyKind {BYTE_LOOP, ROW_COPIES, STREAMED};
+
+static double elapsed(struct timeval start, struct timeval end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+}
+
+// The copy every block went through before it was done a row at a time
+static void byte_loop(void *dst, size_t dstride, const void *src, size_t sstride, size_t width, size_t height) {
+    char *d = reinterpret_cast<char *>(dst);
+    const char *s = reinterpret_cast<const char *>(src);
+    for (size_t i = 0; i < height; ++i) {
+        for (size_t j = 0; j < width; ++j) {
+            d[i * dstride + j] = s[i * sstride + j];
+        }
+    }
+}
+
+/*
+ * Time of the copies of one step of the CPU kernel on a dim x dim tile in
+ * double precision: every block, halos included, is gathered from the two
+ * parts of the tile into a scratch block, and its inner part scattered to
+ * the two parts of the other buffer. The evolution of the blocks is left
+ * out, so that only the copies are timed.
+ */
+static double step_copies(size_t dim, CopyKind kind, const double *real, const double *imag, double *next_real, double *next_imag) {
+    size_t step = BLOCK_DIM - 2 * HALO, blocks = (dim - 2 * HALO + step - 1) / step;
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < REPETITIONS; r++) {
+        #pragma omp parallel
+        {
+            double *block = new_grid<double>(2 * BLOCK_DIM * BLOCK_DIM, 2 * BLOCK_DIM);
+            #pragma omp for schedule(static)
+            for (int b = 0; b < int(blocks * blocks); b++) {
+                size_t x = (b % blocks) * step, y = (b / blocks) * step;
+                size_t width = std::min<size_t>(BLOCK_DIM, dim - x), height = std::min<size_t>(BLOCK_DIM, dim - y);
+                const double *parts[2] = {real, imag};
+                double *next_parts[2] = {next_real, next_imag};
+                for (int p = 0; p < 2; p++) {
+                    double *scratch = &block[p * BLOCK_DIM * BLOCK_DIM];
+                    const double *src = &parts[p][y * dim + x];
+                    double *dest = &next_parts[p][(y + HALO) * dim + x + HALO];
+                    const double *inner = &scratch[HALO * BLOCK_DIM + HALO];
+                    size_t row = BLOCK_DIM * sizeof(double), tile_row = dim * sizeof(double);
+                    if (kind == BYTE_LOOP) {
+                        byte_loop(scratch, row, src, tile_row, width * sizeof(double), height);
+                        byte_loop(dest, tile_row, inner, row, (width - 2 * HALO) * sizeof(double), height - 2 * HALO);
+                    }
+                    else {
+                        memcpy2D(scratch, row, src, tile_row, width * sizeof(double), height);
+                        if (kind == STREAMED) {
+                            stream2D(dest, tile_row, inner, row, (width - 2 * HALO) * sizeof(double), height - 2 * HALO);
+                        }
+                        else {
+                            memcpy2D(dest, tile_row, inner, row, (width - 2 * HALO) * sizeof(double), height - 2 * HALO);
+                        }
+                    }
+                }
+            }
+            free_grid(block);
+        }
+    }
+    gettimeofday(&end, NULL);
+    return elapsed(start, end) / REPETITIONS;
+}
+
+int main(int argc, char** argv) {
+    const size_t dims[] = {1024, 2048, 4096, 8192};
+    const char *kinds[] = {"byte loop", "row copies", "streamed"};
+    std::cout << "TROTTER block copies of one step, " << BLOCK_DIM << "x" << BLOCK_DIM << " blocks, double precision, last-level cache "
+              << last_level_cache() / (1 << 20) << " MB" << std::endl;
+    std::cout << "Traffic: MB read from the tile, written to the other buffer and read for ownership by plain stores" << std::endl;
+    std::cout << std::setw(6) << "dim" << std::setw(10) << "read" << std::setw(10) << "written" << std::setw(10) << "owned";
+    for (int k = 0; k < 3; k++) {
+        std::cout << std::setw(14) << kinds[k];
+    }
+    std::cout << "   (ms per step)" << std::endl;
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        size_t dim = dims[d], size = dim * dim;
+        double *real = new_grid<double>(size, dim), *imag = new_grid<double>(size, dim);
+        double *next_real = new_grid<double>(size, dim), *next_imag = new_grid<double>(size, dim);
+        for (size_t i = 0; i < size; i++) {
+            real[i] = 1e-3 * (i % 1000);
+            imag[i] = -1e-3 * (i % 1000);
+        }
+        double step = BLOCK_DIM - 2 * HALO, overlap = double(BLOCK_DIM) * BLOCK_DIM / (step * step);
+        double written = 2. * (dim - 2 * HALO) * (dim - 2 * HALO) * sizeof(double) / (1 << 20);
+        std::cout << std::setw(6) << dim << std::fixed << std::setprecision(0) << std::setw(10) << written * overlap
+                  << std::setw(10) << written << std::setw(10) << written << std::setprecision(2);
+        for (int k = 0; k < 3; k++) {
+            // Once for the pages and the caches, then timed
+            step_copies(dim, CopyKind(k), real, imag, next_real, next_imag);
+            std::cout << std::setw(14) << step_copies(dim, CopyKind(k), real, imag, next_real, next_imag) * 1e3;
+        }
+        std::cout << std::endl;
+        free_grid(next_imag);
+        free_grid(next_real);
+        free_grid(imag);
+        free_grid(real);
+    }
+    std::cout << "Streamed stores skip the read for ownership: " << std::setprecision(0)
+              << 100. / (2. + double(BLOCK_DIM) * BLOCK_DIM / ((BLOCK_DIM - 2 * HALO) * (BLOCK_DIM - 2 * HALO))) << "% of the traffic of the copies." << std::endl;
+    return 0;
+}
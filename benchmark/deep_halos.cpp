@@ -0,0 +1,112 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+
+#define DIM 1024
+#define ITERATIONS 200
+#define KERNEL_TYPE "cpu"
+
+/*
+ * Strong scaling of the halo exchange: the same lattice evolved with halos
+ * exchanged at every step, or every 2 or 4 steps with halos 2 or 4 times
+ * deeper that the ranks evolve redundantly in between. Run it on the same
+ * lattice with more and more ranks, e.g.
+ *
+ *     for np in 1 4 16 64; do OMP_NUM_THREADS=1 mpirun -np $np ./deep_halos 1024; done
+ *
+ * Small tiles on a high-latency interconnect gain the most.
+ * Arguments: side of the lattice, iterations.
+ */
+static double step_time(int dim, int iterations, int exchange_interval, double *halo_share) {
+    Lattice2D *grid = new Lattice2D(dim, double(dim), dim, double(dim), true, true, 0., "cartesian", exchange_interval);
+    State *state = new SinusoidState(grid, 1, 1);
+    Potential *potential = new HarmonicPotential(grid, 1e-4, 1e-4);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+    Solver *solver = new Solver(grid, state, hamiltonian, 0.01, KERNEL_TYPE);
+
+    // Warm up: builds the kernel and the exponential of the potential
+    solver->evolve(exchange_interval, false);
+
+    struct timeval start, end;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&start, NULL);
+    solver->evolve(iterations, false);
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+
+    double tile_points = double(grid->end_x - grid->start_x) * (grid->end_y - grid->start_y);
+    double inner_points = double(grid->inner_end_x - grid->inner_start_x) * (grid->inner_end_y - grid->inner_start_y);
+    *halo_share = 1. - inner_points / tile_points;
+
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return elapsed / iterations;
+}
+
+int main(int argc, char** argv) {
+    const int intervals[] = {1, 2, 4};
+    int dim = DIM, iterations = ITERATIONS;
+    if (argc > 1) {
+        dim = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank, procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &procs);
+#else
+    int rank = 0, procs = 1;
+#endif
+    if (rank == 0) {
+        cout << "TROTTER deep halos " << dim << "x" << dim << " kernel:" << KERNEL_TYPE << " np:" << procs << endl;
+        cout << std::setw(10) << "interval" << std::setw(10) << "halo %" << std::setw(14) << "ms per step"
+             << std::setw(14) << "M updates/s" << endl;
+    }
+    for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+        double halo_share;
+        double seconds = step_time(dim, iterations, intervals[i], &halo_share);
+        if (rank == 0) {
+            cout << std::setw(10) << intervals[i] << std::setw(10) << std::fixed << std::setprecision(1) << 100. * halo_share
+                 << std::setw(14) << std::setprecision(3) << 1e3 * seconds
+                 << std::setw(14) << std::setprecision(1) << double(dim) * dim / seconds * 1e-6 << endl;
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <sys/time.h>
+#include "trottersuzuki.h"
+#include "kernel.h"
+
+#define BLOCK_DIM 128
+#define REPETITIONS 2000
+
+static double elapsed(struct timeval start, struct timeval end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+}
+
+/*
+ * Throughput of the block update on one scratch block, with the splitting
+ * sequence applied one sweep at a time and as a single wavefront.
+ * Arguments: block side, repetitions, coordinate system, precision (double or float).
+ */
+template<typename real_t>
+static double site_updates(bool fused, bool imag_time, size_t dim, int repetitions, bool cylindrical,
+                           const KineticKernels<real_t> &kinetic) {
+    PotentialKernels<real_t> potential = get_potential_kernels<real_t>("full");
+    block_step<real_t> step = get_block_step<real_t>(imag_time, cylindrical, false, false, true, fused);
+    real_t *real = new real_t[dim * dim];
+    real_t *imag = new real_t[dim * dim];
+    real_t *pot_real = new real_t[dim * dim];
+    real_t *pot_imag = new real_t[dim * dim];
+    for (size_t i = 0; i < dim * dim; ++i) {
+        real[i] = cos(0.01 * i) / dim;
+        imag[i] = sin(0.01 * i) / dim;
+        pot_real[i] = cos(1e-4 * i);
+        pot_imag[i] = imag_time ? 0. : -sin(1e-4 * i);
+    }
+    double aH = imag_time ? cosh(0.01) : cos(0.01), bH = imag_time ? sinh(0.01) : sin(0.01);
+    real_t *radial = new real_t[3 * dim];
+    radial_coefficients(imag_time, 0.005, 1., dim, radial);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < repetitions; ++i) {
+        step(dim, dim, dim, radial, NULL, NULL, NULL, NULL, aH, bH, aH, bH, 1., 0., 0., dim,
+             pot_real, pot_imag, NULL, NULL, real, imag, kinetic, potential);
+    }
+    gettimeofday(&end, NULL);
+    delete [] real;
+    delete [] imag;
+    delete [] pot_real;
+    delete [] pot_imag;
+    delete [] radial;
+    return double(dim * dim) * repetitions / elapsed(start, end);
+}
+
+template<typename real_t>
+static void compare_steps(size_t dim, int repetitions, string coordinate_system, string precision) {
+    KineticKernels<real_t> kinetic = select_kinetic_kernels<real_t>();
+    std::cout << "Block: " << dim << "x" << dim << ", " << coordinate_system << ", " << precision << ", kinetic kernels: " << kinetic.name << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    bool cylindrical = coordinate_system == "cylindrical";
+    double plain = site_updates<real_t>(false, false, dim, repetitions, cylindrical, kinetic);
+    double fused = site_updates<real_t>(true, false, dim, repetitions, cylindrical, kinetic);
+    std::cout << "Real time:      " << plain * 1e-6 << " -> " << fused * 1e-6 << " M site-updates/s (x" << std::setprecision(2) << fused / plain << ")" << std::setprecision(1) << std::endl;
+    plain = site_updates<real_t>(false, true, dim, repetitions, cylindrical, kinetic);
+    fused = site_updates<real_t>(true, true, dim, repetitions, cylindrical, kinetic);
+    std::cout << "Imaginary time: " << plain * 1e-6 << " -> " << fused * 1e-6 << " M site-updates/s (x" << std::setprecision(2) << fused / plain << ")" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t dim = BLOCK_DIM;
+    int repetitions = REPETITIONS;
+    string coordinate_system = "cartesian";
+    string precision = "double";
+    if (argc > 1) {
+        dim = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        repetitions = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        coordinate_system = argv[3];
+    }
+    if (argc > 4) {
+        precision = argv[4];
+    }
+    if (precision == "float") {
+        compare_steps<float>(dim, repetitions, coordinate_system, precision);
+    }
+    else {
+        compare_steps<double>(dim, repetitions, coordinate_system, precision);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+
+#define TILE 64
+#define ITERATIONS 500
+#define KERNEL_TYPE "cpu"
+
+/*
+ * Weak scaling of the halo exchange: every rank evolves a tile of the same
+ * size, small enough that a step is bound by the latency of the messages,
+ * with the halos exchanged in two phases (left and right, then up and down)
+ * with all eight neighbours at once, or with the ranks of a node copying the
+ * halos from each other's tiles in shared memory. Run it with more and more
+ * ranks, e.g.
+ *
+ *     for np in 4 16 64; do OMP_NUM_THREADS=1 mpirun -np $np ./halo_exchange 64; done
+ *
+ * On a single node "shared" sends no message at all; across nodes only the
+ * ranks at the edges of the block of tiles of a node do.
+ *
+ * Arguments: side of the tile of each rank, iterations.
+ */
+static double step_time(int tile, int iterations, const char *halo_exchange, int procs) {
+    int dims[2] = {0, 0};
+#ifdef HAVE_MPI
+    MPI_Dims_create(procs, 2, dims);
+#else
+    dims[0] = dims[1] = 1;
+#endif
+    // The lattice splits in dims[0] tiles along y and dims[1] along x
+    int dim_x = tile * dims[1], dim_y = tile * dims[0];
+    Lattice2D *grid = new Lattice2D(dim_x, double(dim_x), dim_y, double(dim_y), true, true);
+    State *state = new SinusoidState(grid, 1, 1);
+    Potential *potential = new HarmonicPotential(grid, 1e-4, 1e-4);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+    Solver *solver = new Solver(grid, state, hamiltonian, 0.01, KERNEL_TYPE);
+    solver->set_halo_exchange(halo_exchange);
+
+    // Warm up: builds the kernel and the exponential of the potential
+    solver->evolve(10, false);
+
+    struct timeval start, end;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&start, NULL);
+    solver->evolve(iterations, false);
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return elapsed / iterations;
+}
+
+int main(int argc, char** argv) {
+    const char *exchanges[] = {"phases", "corners", "shared"};
+    int tile = TILE, iterations = ITERATIONS;
+    if (argc > 1) {
+        tile = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank, procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &procs);
+#else
+    int rank = 0, procs = 1;
+#endif
+    if (rank == 0) {
+        cout << "TROTTER halo exchange " << tile << "x" << tile << " per rank kernel:" << KERNEL_TYPE << " np:" << procs << endl;
+        cout << std::setw(10) << "exchange" << std::setw(14) << "ms per step" << std::setw(14) << "M updates/s" << endl;
+    }
+    for (size_t i = 0; i < sizeof(exchanges) / sizeof(exchanges[0]); i++) {
+        double seconds = step_time(tile, iterations, exchanges[i], procs);
+        if (rank == 0) {
+            cout << std::setw(10) << exchanges[i] << std::setw(14) << std::fixed << std::setprecision(3) << 1e3 * seconds
+                 << std::setw(14) << std::setprecision(1) << double(tile) * tile * procs / seconds * 1e-6 << endl;
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
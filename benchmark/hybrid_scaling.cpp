@@ -0,0 +1,113 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "trottersuzuki.h"
+
+#define DIM 1024
+#define ITERATIONS 100
+#define KERNEL_TYPE "cpu"
+
+/*
+ * Compares the pure-MPI layout (one rank per core) with the hybrid layout
+ * (a few ranks per node, each one running a thread team over its tile).
+ * Run it with the same number of cores in both configurations, e.g. on a
+ * 16-core node:
+ *
+ *     OMP_NUM_THREADS=1 mpirun -np 16 ./hybrid_scaling
+ *     OMP_NUM_THREADS=8 mpirun -np 2 ./hybrid_scaling
+ *
+ * Arguments: width of the lattice, iterations, height of the lattice (the
+ * width by default). Wide and short lattices, such as 8192 x 256, show how
+ * the threads share the blocks of a tile with few bands.
+ */
+int main(int argc, char** argv) {
+    int dim = DIM, iterations = ITERATIONS;
+    if (argc > 1) {
+        dim = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+    }
+    int dim_y = dim;
+    if (argc > 3) {
+        dim_y = atoi(argv[3]);
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#endif
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    Lattice2D *grid = new Lattice2D(dim, double(dim), dim_y, double(dim_y), true, true);
+    State *state = new SinusoidState(grid, 1, 1);
+    Potential *potential = new HarmonicPotential(grid, 1e-4, 1e-4);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+    Solver *solver = new Solver(grid, state, hamiltonian, 0.01, KERNEL_TYPE);
+
+    // Warm up: builds the kernel and the exponential of the potential
+    solver->evolve(1, false);
+
+    struct timeval start, end;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&start, NULL);
+    solver->evolve(iterations, false);
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+
+    long tile_points = long(grid->end_x - grid->start_x) * (grid->end_y - grid->start_y);
+    long inner_points = long(grid->inner_end_x - grid->inner_start_x) * (grid->inner_end_y - grid->inner_start_y);
+    long halo_points = tile_points - inner_points;
+    double norm2 = solver->get_squared_norm();
+
+    if (grid->mpi_rank == 0) {
+        cout << "TROTTER " << dim << "x" << dim_y << " kernel:" << KERNEL_TYPE
+             << " np:" << grid->mpi_procs << " threads:" << threads << endl;
+        cout << std::setw(24) << "tile (rank 0): " << grid->end_x - grid->start_x << "x" << grid->end_y - grid->start_y << endl;
+        cout << std::setw(24) << "halo points per rank: " << halo_points
+             << " (" << 100. * halo_points / tile_points << "% of the tile)" << endl;
+        cout << std::setw(24) << "halo memory, all ranks: " << 4. * sizeof(double) * halo_points * grid->mpi_procs / (1024. * 1024.) << " MB" << endl;
+        cout << std::setw(24) << "time per step: " << 1e3 * elapsed / iterations << " ms" << endl;
+        cout << std::setw(24) << "site updates: " << double(dim) * dim_y * iterations / elapsed * 1e-6 << " M/s" << endl;
+        cout << std::setw(24) << "squared norm: " << norm2 << endl;
+    }
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+
+#define SITE_UPDATES 5e8
+#define KERNEL_TYPE "cpu"
+
+/*
+ * Memory taken by the CPU kernel and its throughput, evolving the wave
+ * function in two buffers or in place, on square lattices of increasing
+ * side. The memory is the growth of the resident set of the process when the
+ * kernel is built, which the state and the potential are not part of.
+ * Arguments: kernel type (cpu, cpu-float or cpu-mixed).
+ */
+static double resident_bytes() {
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return double(resident) * sysconf(_SC_PAGESIZE);
+}
+
+static double site_updates(int dim, bool in_place, const char *kernel_type, double *kernel_bytes, int *iterations) {
+    Lattice2D *grid = new Lattice2D(dim, double(dim), true, true);
+    State *state = new GaussianState(grid, 1e-3);
+    Potential *potential = new HarmonicPotential(grid, 1e-4, 1e-4);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+    Solver *solver = new Solver(grid, state, hamiltonian, 0.01, kernel_type);
+    solver->set_in_place(in_place);
+    *iterations = std::max(10, int(SITE_UPDATES / (double(dim) * dim)));
+
+    // Warm up: builds the kernel, whose buffers are touched when they are allocated
+    double before = resident_bytes();
+    solver->evolve(1, false);
+    *kernel_bytes = resident_bytes() - before;
+
+    struct timeval start, end;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&start, NULL);
+    solver->evolve(*iterations, false);
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return double(dim) * dim * *iterations / elapsed;
+}
+
+int main(int argc, char** argv) {
+    const int dims[] = {512, 1024, 2048, 4096};
+    const char *kernel_type = KERNEL_TYPE;
+    if (argc > 1) {
+        kernel_type = argv[1];
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#else
+    int rank = 0;
+#endif
+    if (rank == 0) {
+        cout << "TROTTER in-place evolution, kernel:" << kernel_type << endl;
+        cout << std::setw(6) << "dim" << std::setw(12) << "steps" << std::setw(14) << "two buffers" << std::setw(14) << "in place"
+             << "   (MB of the kernel on rank 0, M site updates/s)" << endl;
+    }
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        double rates[2], bytes[2];
+        int iterations = 0;
+        for (int in_place = 0; in_place < 2; in_place++) {
+            rates[in_place] = site_updates(dims[d], in_place, kernel_type, &bytes[in_place], &iterations);
+        }
+        if (rank == 0) {
+            cout << std::setw(6) << dims[d] << std::setw(12) << iterations;
+            for (int i = 0; i < 2; i++) {
+                cout << std::setw(7) << std::fixed << std::setprecision(0) << bytes[i] / (1 << 20)
+                     << std::setw(7) << std::setprecision(1) << rates[i] * 1e-6;
+            }
+            cout << endl;
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
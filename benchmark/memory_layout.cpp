@@ -0,0 +1,125 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+
+#define SITE_UPDATES 5e8
+#define KERNEL_TYPE "cpu"
+
+/*
+ * Throughput of the CPU kernel with the wave function stored in each memory
+ * layout, on square lattices of increasing side. Every lattice runs about
+ * the same number of site updates.
+ * Arguments: kernel type (cpu, cpu-float or cpu-mixed), two components (0 or 1).
+ */
+static double site_updates(int dim, const char *layout, const char *kernel_type, bool two_components, int *iterations) {
+    Lattice2D *grid = new Lattice2D(dim, double(dim), true, true);
+    State *state = new GaussianState(grid, 1e-3);
+    State *state_b = new GaussianState(grid, 1e-3, 1e-3, 1.);
+    Potential *potential = new HarmonicPotential(grid, 1e-4, 1e-4);
+    Hamiltonian *hamiltonian;
+    Solver *solver;
+    if (two_components) {
+        hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 1., 0.5, 1., 0.1);
+        solver = new Solver(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), 0.01, kernel_type);
+    }
+    else {
+        hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+        solver = new Solver(grid, state, hamiltonian, 0.01, kernel_type);
+    }
+    solver->set_memory_layout(layout);
+    *iterations = std::max(10, int(SITE_UPDATES / (double(dim) * dim)));
+
+    // Warm up: builds the kernel and converts the state
+    solver->evolve(1, false);
+
+    struct timeval start, end;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&start, NULL);
+    solver->evolve(*iterations, false);
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state_b;
+    delete state;
+    delete grid;
+    return double(dim) * dim * (two_components ? 2 : 1) * *iterations / elapsed;
+}
+
+int main(int argc, char** argv) {
+    const int dims[] = {128, 256, 512, 1024, 2048};
+    const char *layouts[] = {"split", "interleaved", "tiled"};
+    const char *kernel_type = KERNEL_TYPE;
+    bool two_components = false;
+    if (argc > 1) {
+        kernel_type = argv[1];
+    }
+    if (argc > 2) {
+        two_components = atoi(argv[2]) != 0;
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#else
+    int rank = 0;
+#endif
+    if (rank == 0) {
+        cout << "TROTTER memory layouts, kernel:" << kernel_type << (two_components ? " two components" : "") << endl;
+        cout << std::setw(6) << "dim" << std::setw(12) << "steps";
+        for (int l = 0; l < 3; l++) {
+            cout << std::setw(14) << layouts[l];
+        }
+        cout << "   (M site updates/s)" << endl;
+    }
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        double rates[3];
+        int iterations = 0;
+        for (int l = 0; l < 3; l++) {
+            rates[l] = site_updates(dims[d], layouts[l], kernel_type, two_components, &iterations);
+        }
+        if (rank == 0) {
+            cout << std::setw(6) << dims[d] << std::setw(12) << iterations;
+            for (int l = 0; l < 3; l++) {
+                cout << std::setw(14) << std::fixed << std::setprecision(1) << rates[l] * 1e-6;
+            }
+            cout << endl;
+        }
+    }
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+
+#define DIM 256
+#define ITERATIONS 200
+#define KERNEL_TYPE "cpu"
+
+/*
+ * Cost of the reductions over the tiles: imaginary time steps, each
+ * normalizing the state, and evaluations of all the observables of the state
+ * and of the energy after every real time step. Small tiles on many ranks
+ * make the reductions dominate, e.g.
+ *
+ *     for np in 1 4 16 64; do OMP_NUM_THREADS=1 mpirun -np $np ./observables; done
+ *
+ * Arguments: side of the lattice, iterations.
+ */
+static double wall_time() {
+    struct timeval now;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+int main(int argc, char** argv) {
+    int dim = DIM, iterations = ITERATIONS;
+    if (argc > 1) {
+        dim = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        iterations = atoi(argv[2]);
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#endif
+    Lattice2D *grid = new Lattice2D(dim, double(dim), true, true);
+    State *state = new GaussianState(grid, 1e-3);
+    Potential *potential = new HarmonicPotential(grid, 1e-4, 1e-4);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+    Solver *solver = new Solver(grid, state, hamiltonian, 0.01, KERNEL_TYPE);
+
+    // Warm up: builds the kernels of both kinds of time
+    solver->evolve(1, true);
+    solver->evolve(1, false);
+
+    double start = wall_time();
+    solver->evolve(iterations, true);
+    double imaginary = wall_time() - start;
+
+    start = wall_time();
+    solver->evolve(iterations, false);
+    double real = wall_time() - start;
+
+    double observables = 0., energy = 0.;
+    start = wall_time();
+    for (int i = 0; i < iterations; i++) {
+        solver->evolve(1, false);
+        double step = wall_time();
+        energy += state->get_mean_x() + state->get_mean_pypy() + solver->get_total_energy();
+        observables += wall_time() - step;
+    }
+
+    if (grid->mpi_rank == 0) {
+        cout << "TROTTER observables " << dim << "x" << dim << " kernel:" << KERNEL_TYPE << " np:" << grid->mpi_procs << endl;
+        cout << std::setw(30) << "real time step: " << 1e3 * real / iterations << " ms" << endl;
+        cout << std::setw(30) << "imaginary time step: " << 1e3 * imaginary / iterations << " ms" << endl;
+        cout << std::setw(30) << "observables and energy: " << 1e3 * observables / iterations << " ms" << endl;
+        cout << std::setw(30) << "checksum: " << energy / iterations << endl;
+    }
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
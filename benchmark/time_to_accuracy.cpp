@@ -0,0 +1,127 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <sys/time.h>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+#include "trottersuzuki.h"
+
+#define DIM 256
+#define LENGTH 64.
+#define EVOLUTION_TIME 0.64
+#define REFERENCE_STEPS 2048
+#define MAX_STEPS 1024
+
+/*
+ * Wall time needed by each integrator to reach a given accuracy: an
+ * interacting gas in a harmonic trap is evolved up to EVOLUTION_TIME with
+ * halving time steps, and the largest deviation of the wave function from a
+ * fourth-order evolution with REFERENCE_STEPS steps is printed with the time.
+ * Arguments: kernel type (cpu, cpu-float or cpu-mixed).
+ */
+static double *evolve(const char *integrator, int steps, const char *kernel_type, size_t *size, double *elapsed) {
+    Lattice2D *grid = new Lattice2D(DIM, LENGTH);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    Potential *potential = new HarmonicPotential(grid, 1., 1.);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+    Solver *solver = new Solver(grid, state, hamiltonian, EVOLUTION_TIME / steps, kernel_type);
+    solver->set_integrator(integrator);
+
+    struct timeval start, end;
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&start, NULL);
+    solver->evolve(steps);
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    gettimeofday(&end, NULL);
+    *elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+
+    // The halos of the tile are not exchanged after the last step
+    size_t width = grid->inner_end_x - grid->inner_start_x, height = grid->inner_end_y - grid->inner_start_y;
+    size_t offset = (grid->inner_start_y - grid->start_y) * grid->dim_x + grid->inner_start_x - grid->start_x;
+    *size = width * height;
+    double *values = new double[2 * *size];
+    for (size_t y = 0; y < height; y++) {
+        std::copy(&state->p_real[offset + y * grid->dim_x], &state->p_real[offset + y * grid->dim_x + width], &values[y * width]);
+        std::copy(&state->p_imag[offset + y * grid->dim_x], &state->p_imag[offset + y * grid->dim_x + width], &values[*size + y * width]);
+    }
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return values;
+}
+
+static double max_deviation(const double *values, const double *reference, size_t size) {
+    double deviation = 0.;
+    for (size_t i = 0; i < size; i++) {
+        deviation = std::max(deviation, std::abs(values[i] - reference[i]));
+    }
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, &deviation, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+    return deviation;
+}
+
+int main(int argc, char** argv) {
+    const char *integrators[] = {"strang", "yoshida"};
+    const char *kernel_type = "cpu";
+    if (argc > 1) {
+        kernel_type = argv[1];
+    }
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#else
+    int rank = 0;
+#endif
+    size_t size;
+    double elapsed;
+    double *reference = evolve("yoshida", REFERENCE_STEPS, "cpu", &size, &elapsed);
+    if (rank == 0) {
+        cout << "TROTTER time to accuracy, kernel:" << kernel_type << endl;
+        cout << std::setw(10) << "integrator" << std::setw(8) << "steps" << std::setw(14) << "deviation" << std::setw(12) << "time (s)" << endl;
+    }
+    for (int i = 0; i < 2; i++) {
+        for (int steps = 8; steps <= MAX_STEPS; steps *= 2) {
+            double *values = evolve(integrators[i], steps, kernel_type, &size, &elapsed);
+            double deviation = max_deviation(values, reference, 2 * size);
+            delete [] values;
+            if (rank == 0) {
+                cout << std::setw(10) << integrators[i] << std::setw(8) << steps << std::setw(14) << std::scientific << std::setprecision(3) << deviation
+                     << std::setw(12) << std::fixed << std::setprecision(4) << elapsed << endl;
+            }
+        }
+    }
+    delete [] reference;
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+}
@@ -43,7 +43,8 @@ int main(int argc, char** argv) {
     double delta_t = 5.e-4;
 
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
     //set lattice
     Lattice2D *grid = new Lattice2D(DIM, length, true, true);
@@ -45,7 +45,8 @@ int main(int argc, char** argv) {
     double coupling_a = 4. * M_PI * double(SCATTER_LENGTH_2D);
 
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
 
     //set lattice
@@ -47,7 +47,8 @@ int main(int argc, char** argv) {
     double length = double(EDGE_LENGTH);
 
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
 
     //set lattice
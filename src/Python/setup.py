@@ -120,6 +120,7 @@ else:
                      'trottersuzuki/src/cpukernel.cpp',
                      'trottersuzuki/src/cpucartesian.cpp',
                      'trottersuzuki/src/cpucylindrical.cpp',
+                     'trottersuzuki/src/cpusimd.cpp',
                      'trottersuzuki/src/model.cpp',
                      'trottersuzuki/src/solver.cpp',
                      'trottersuzuki/trottersuzuki_wrap.cxx']
@@ -86,6 +86,9 @@ Get kernel name.
 ";
 
 %feature("docstring") CPUBlock::runs_in_place "
+
+Whether the kernel evolves the arrays of the states, which get_sample then leaves
+as they are.  
 ";
 
 %feature("docstring") CPUBlock::rabi_coupling "
@@ -322,6 +325,19 @@ Example
 %feature("docstring") Hamiltonian2Component::~Hamiltonian2Component "
 ";
 
+// File: classSeparablePotential.xml
+
+
+%feature("docstring") SeparablePotential "
+
+External potential that is the sum of a function of x and a function of y. The CPU kernels keep its evolution operator as one factor per column and one per row of the lattice.
+";
+
+%feature("docstring") SeparablePotential::get_value "
+
+Return the value of the external potential at coordinate (x,y)  
+";
+
 // File: classHarmonicPotential.xml
 
 
@@ -404,6 +420,9 @@ Update the evolution matrix, regarding the external potential, at time t.
 ";
 
 %feature("docstring") ITrotterKernel::runs_in_place "
+
+Whether the kernel evolves the arrays of the states, which get_sample then leaves
+as they are.  
 ";
 
 %feature("docstring") ITrotterKernel::run_kernel "
@@ -476,6 +495,21 @@ Parameters
     Boundary condition along the x axis (false=closed, true=periodic).  
 * `periodic_y_axis` : bool,optional (default: False) 
     Boundary condition along the y axis (false=closed, true=periodic).
+* `angular_velocity` : float,optional (default: 0.)
+    Angular velocity of the rotating reference frame.
+* `coordinate_system` : string,optional (default: 'cartesian')
+    Type of coordinate system ('cartesian' or 'cylindrical').
+* `exchange_interval` : integer,optional (default: 1)
+    Number of time steps between two exchanges of the halos between MPI 
+    processes. The halos are as many times deeper.
+* `procs_x` : integer,optional (default: 0)
+    Number of MPI processes along the x axis; 0 picks the number that
+    puts the fewest dots in the halos for the shape of the lattice.
+* `procs_y` : integer,optional (default: 0)
+    Number of MPI processes along the y axis, picked likewise if 0.
+* `group_nodes` : bool,optional (default: False)
+    Give the processes of each node a block of neighbouring tiles, so that
+    fewer halos cross the network.
 
 Returns
 -------
@@ -496,6 +530,16 @@ Example
   
 ";
 
+%feature("docstring") Lattice::decomposition "
+
+Describe how the lattice is split among the MPI processes: the process grid, the number of dots in the halos and, for every process, the size of its tile. All the processes have to call it.
+
+Returns
+-------
+* `decomposition` : string
+    One line for the grid and one per process.
+";
+
 // File: structoption.xml
 
 
@@ -621,6 +665,16 @@ Example
 Update the potential matrix at time t.  
 ";
 
+%feature("docstring") Potential::is_zero "
+
+Whether the potential is known to vanish everywhere, as the default potential of a Hamiltonian does. The CPU kernels then skip the external potential.
+
+Returns
+-------
+* `zero` : bool
+    True if the potential is the null potential.
+";
+
 %feature("docstring") Potential::~Potential "
 ";
 
@@ -722,6 +776,102 @@ Returns
     Rabi energy of the system.  
 ";
 
+%feature("docstring") Solver::set_phase_accuracy "
+
+Set the accuracy of sin, cos and exp in the nonlinear and potential phase step of the CPU kernel.
+
+Parameters
+----------
+* `accuracy` : string
+    'full' (libm, default), 'high' (error around 1e-12) or 'fast' (error around 1e-8).
+";
+
+%feature("docstring") Solver::set_memory_layout "
+
+Set the memory layout of the wave function inside the CPU kernel. The state is converted when the kernel is built and at the end of each evolution.
+
+Parameters
+----------
+* `layout` : string
+    'split' (real and imaginary parts in two arrays, default), 'interleaved' (pairs of real and imaginary parts) or 'tiled' (pairs in 16x16 tiles).
+";
+
+%feature("docstring") Solver::set_integrator "
+
+Set the splitting scheme of each iteration of the evolution.
+
+Parameters
+----------
+* `integrator` : string
+    'strang' (second order, default) or 'yoshida' (fourth order, composition of three Strang steps). The fourth order applies to the real time evolution of single-component systems with the CPU kernels, and does not support potentials updated from Python; imaginary time evolutions keep the Strang step.
+";
+
+%feature("docstring") Solver::set_potential_refresh "
+
+Set how often the evolution operator of a time-dependent external potential is built again during the evolution.
+
+Parameters
+----------
+* `every` : integer
+    Build the operator every this many iterations (default 1). The potential in between is the last one built.
+* `threshold` : float,optional (default: 0)
+    When positive, only the dots whose potential moved by more than this amount since their operator was last built are updated. Applies to the second-order integrator.
+";
+
+%feature("docstring") Solver::memory_placement "
+
+Describe on which NUMA nodes the wave functions, the evolution operators of the potential and the buffers of the kernel of this process are placed.
+
+Returns
+-------
+* `placement` : string
+    One line per buffer, with the number of pages on each node ('unknown' where the system does not tell).
+";
+
+%feature("docstring") Solver::set_block_size "
+
+Set the size of the blocks of the tile that the CPU kernel evolves in cache.
+
+Parameters
+----------
+* `width` : integer
+    Width of the blocks (default 128), even, larger than twice the halo and at most 512.
+* `height` : integer
+    Height of the blocks (default 128), even and larger than twice the halo; blocks are single rows on one-dimensional lattices.
+";
+
+%feature("docstring") Solver::tune_block_size "
+
+Pick the size of the blocks of the CPU kernel by timing a few steps of the evolution with each candidate size. The state and the evolution time are restored afterwards.
+
+Parameters
+----------
+* `imag_time` : bool,optional
+    Whether to time steps in imaginary time (default False).
+* `profile` : string,optional
+    File keeping the chosen sizes, keyed by the CPU model, the size of the tile and the options of the kernel. Sizes found there are used without timing; empty (the default) always times and keeps nothing.
+";
+
+%feature("docstring") Solver::set_in_place "
+
+Evolve the wave function in place in the CPU kernel, instead of in a second buffer for the next time step. The blocks read their edges from copies of the strips of dots they share with their neighbours, a few percent of the lattice. With two components only the second one is evolved in place.
+
+Parameters
+----------
+* `in_place` : bool
+    Whether to evolve in place (default False).
+";
+
+%feature("docstring") Solver::set_halo_exchange "
+
+Set how the CPU kernel exchanges the halos between MPI processes. 'phases' (the default) exchanges the columns with the left and right neighbours, then full rows with the upper and lower ones, which pass on the corners. 'corners' exchanges the inner rows and columns and the corners with all eight neighbours at once, so that a single round of messages runs while the inner part of the lattice is evolved. 'shared' does the same with the processes on other nodes, while the processes on the same node keep their tiles in a shared memory window and copy the halos straight from each other's tiles, with no message (MPI 3).
+
+Parameters
+----------
+* `exchange` : string
+    'phases', 'corners' or 'shared'.
+";
+
 %feature("docstring") Solver::get_squared_norm "
 
 Get the squared norm of the state (default: total wave-function).
@@ -830,6 +980,28 @@ Example
     >>> solver.evolve(1000)  # perform 1000 iteration in real time evolution
 ";
 
+%feature("docstring") Solver::evolve_until "
+
+Evolve the state of a single-component system in real time up to `t_final`, adapting the time step to the error.
+
+Parameters
+----------
+* `t_final` : float
+    Evolution time at which the evolution stops.
+* `tolerance` : float
+    Largest error of a single step, relative to the norm of the state.
+
+Returns
+-------
+* `evolve_until` : integer
+    Number of steps taken.
+
+Notes
+-----
+
+Each step is checked against two steps of half its length. The step is halved when the estimated error exceeds the tolerance, and doubled when the doubled step is expected to stay within it. The time step of the solver starts from the current one and is left to the last adapted value. The tolerance should stay above the precision of the kernel, around 1e-7 for the single-precision kernels.
+";
+
 %feature("docstring") Solver::update_parameters "
 
 Notify the solver if any parameter changed in the Hamiltonian
@@ -851,7 +1023,8 @@ Parameters
 * `delta_t` : float 
     A single evolution iteration, evolves the state for this time.  
 * `kernel_type` : string,optional (default: 'cpu') 
-    Which kernel to use (either cpu or gpu).  
+    Which kernel to use: cpu, cpu-float (single precision), cpu-mixed (single
+    precision with double precision norms) or gpu.  
 
 Returns
 -------
@@ -900,7 +1073,8 @@ Parameters
 * `delta_t` : float
     A single evolution iteration, evolves the state for this time.  
 * `kernel_type` : string,optional (default: 'cpu') 
-    Which kernel to use (either cpu or gpu).  
+    Which kernel to use: cpu, cpu-float (single precision), cpu-mixed (single
+    precision with double precision norms) or gpu.  
 
 Returns
 -------
@@ -42,11 +42,13 @@ public:
     int global_no_halo_dim_x, global_no_halo_dim_y;
     int start_x, start_y;
     std::string coordinate_system;
+    std::string decomposition();
 };
 
 class Lattice1D: public Lattice {
 public:
-    Lattice1D(int dim, double length, bool periodic_x_axis=false, std::string coordinate_system="cartesian");
+    Lattice1D(int dim, double length, bool periodic_x_axis=false, std::string coordinate_system="cartesian",
+              int exchange_interval=1, bool group_nodes=false);
 };
 
 
@@ -54,7 +56,8 @@ class Lattice2D: public Lattice {
 public:
     Lattice2D(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis=false, bool periodic_y_axis=false,
-              double angular_velocity=0., std::string coordinate_system="cartesian");
+              double angular_velocity=0., std::string coordinate_system="cartesian",
+              int exchange_interval=1, int procs_x=0, int procs_y=0, bool group_nodes=false);
 };
 
 class State{
@@ -215,6 +218,7 @@ public:
         }
     }
     virtual double get_value(int x, int y);
+    virtual bool is_zero();
     bool update(double t);
     bool updated_potential_matrix;
 protected:
@@ -225,7 +229,24 @@ protected:
     bool is_static;
 };
 
-class HarmonicPotential: public Potential {
+class SeparablePotential: public Potential {
+public:
+    SeparablePotential(Lattice *grid, double (*potential_x)(double x), double (*potential_y)(double y));
+    SeparablePotential(Lattice *grid, double (*potential_x)(double x, double t), double (*potential_y)(double y, double t), int t=0);
+    virtual ~SeparablePotential();
+    virtual double get_value(int x, int y);
+    virtual bool is_zero();
+protected:
+    SeparablePotential(Lattice *grid);
+    double (*static_potential_x)(double x);
+    double (*static_potential_y)(double y);
+    double (*evolving_potential_x)(double x, double t);
+    double (*evolving_potential_y)(double y, double t);
+    double term_x(double x);
+    double term_y(double y);
+};
+
+class HarmonicPotential: public SeparablePotential {
 public:
 
     HarmonicPotential(Lattice2D *_grid, double _omegax, double _omegay, double _mass=1., double _mean_x = 0., double _mean_y = 0.);
@@ -293,6 +314,7 @@ public:
            double delta_t, std::string kernel_type="cpu");
     ~Solver();
     void evolve(int iterations, bool imag_time=false);
+    int evolve_until(double t_final, double tolerance);
     void update_parameters();
     double get_total_energy(void);
     double get_squared_norm(size_t which=3);
@@ -305,6 +327,15 @@ public:
     double get_rabi_energy(void);
     void set_exp_potential(double *exp_pot_real, int exp_pot_real_length, double *exp_pot_imag,
                            int exp_pot_imag_length, int which);
+    void set_phase_accuracy(std::string accuracy);
+    void set_memory_layout(std::string layout);
+    void set_integrator(std::string integrator);
+    void set_potential_refresh(int every, double threshold=0.);
+    std::string memory_placement();
+    void set_block_size(int width, int height);
+    void tune_block_size(bool imag_time=false, std::string profile="");
+    void set_in_place(bool in_place);
+    void set_halo_exchange(std::string exchange);
 private:
     bool imag_time;
     double **external_pot_real;
@@ -313,8 +344,35 @@ private:
     double norm2[2];
     bool single_component;
     std::string kernel_type;
+    std::string phase_accuracy;
+    std::string memory_layout;
+    std::string integrator;
+    int block_width;
+    int block_height;
+    bool in_place;
+    std::string halo_exchange;
+    double *substep_pot_real[2];
+    double *substep_pot_imag[2];
+    PotentialTable *potential_tables[2];
+    int potential_refresh_every;
+    double potential_refresh_threshold;
+    int steps_since_refresh[2];
+    double *separable_pot_real[2];
+    double *separable_pot_imag[2];
     void initialize_exp_potential(double time_single_it, int which);
+    void initialize_exp_potential(double time_single_it, int which, double *pot_real, double *pot_imag);
     void init_kernel();
+    std::string tuning_key(bool imag_time);
+    void update_kernel(bool imag_time);
+    void run_kernel_step(bool exchange_halos);
+    PotentialTable *potential_table(int which);
+    bool potential_changed(int which);
+    bool refresh_exp_potential(int which);
+    bool separable_exp_potential(int which);
+    bool zero_exp_potential(int which);
+    bool real_exp_potential();
+    void upload_exp_potential(int which);
+    void integrator_step(int substeps, const double *weights, double h, double **pot_real, double **pot_imag, double &kernel_step);
     double total_energy;
     double kinetic_energy[2];
     double tot_kinetic_energy;
@@ -19,8 +19,26 @@
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <algorithm>
+#include <stdint.h>
 #include "trottersuzuki.h"
 #include "common.h"
+#ifdef WIN32
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__)
+#define STREAM_STORES
+#include <emmintrin.h>
+#endif
 
 void map_lattice_to_coordinate_space(Lattice *grid, int x_in, double *x_out) {
     if (grid->coordinate_system == "cartesian") {
@@ -101,6 +119,70 @@ void calculate_borders(int coord, int dim, int * start, int *end, int *inner_sta
         *inner_end = ( *end == length ? *end : *end - halo );
 }
 
+// Whether splitting length dots in procs tiles as calculate_borders does leaves every tile at least as deep as the halos
+// copied into the next ones
+static bool fits_tiles(int procs, int length, int halo, int periodic) {
+    int inner = (length + procs - 1) / procs, last = length - (procs - 1) * inner;
+    return last >= 1 && (last >= halo || (procs == 1 && !periodic));
+}
+
+// Dots received in the halos over the whole lattice at every exchange, with dims[0] x dims[1] tiles (y by x), leaving out the corners
+static double halo_volume(const int dims[2], const int length[2], const int halo[2], const int periods[2]) {
+    double volume = 0.;
+    for (int axis = 0; axis < 2; axis++) {
+        int boundaries = dims[axis] - 1 + (periods[axis] != 0 && dims[axis] > 1 ? 1 : 0);
+        volume += 2. * boundaries * halo[axis] * length[1 - axis];
+    }
+    return volume;
+}
+
+void process_grid(int procs, const int length[2], const int halo[2], const int periods[2], int dims[2]) {
+    if (dims[0] < 0 || dims[1] < 0 || (dims[0] > 0 && procs % dims[0] != 0) || (dims[1] > 0 && procs % dims[1] != 0) ||
+            (dims[0] > 0 && dims[1] > 0 && dims[0] * dims[1] != procs)) {
+        stringstream message;
+        message << "Cannot arrange " << procs << " processes in a grid of " << dims[1] << "x" << dims[0] << " (0 picks the number).";
+        my_abort(message.str());
+    }
+    // Ties go to more processes along y, as MPI_Dims_create would arrange them
+    int best[2] = {0, 0};
+    double best_volume = 0.;
+    bool best_fits = false;
+    for (int procs_y = procs; procs_y >= 1; procs_y--) {
+        int candidate[2] = {procs_y, procs / procs_y};
+        if (procs % procs_y != 0 || (dims[0] > 0 && candidate[0] != dims[0]) || (dims[1] > 0 && candidate[1] != dims[1])) {
+            continue;
+        }
+        bool fits = fits_tiles(candidate[0], length[0], halo[0], periods[0]) && fits_tiles(candidate[1], length[1], halo[1], periods[1]);
+        double volume = halo_volume(candidate, length, halo, periods);
+        if (best[0] == 0 || (fits && !best_fits) || (fits == best_fits && volume < best_volume)) {
+            best[0] = candidate[0];
+            best[1] = candidate[1];
+            best_volume = volume;
+            best_fits = fits;
+        }
+    }
+    dims[0] = best[0];
+    dims[1] = best[1];
+}
+
+bool node_grid(int nodes, const int dims[2], const int length[2], const int halo[2], const int periods[2], int node_dims[2]) {
+    node_dims[0] = node_dims[1] = 0;
+    double best_volume = 0.;
+    for (int nodes_y = nodes; nodes_y >= 1; nodes_y--) {
+        int candidate[2] = {nodes_y, nodes / nodes_y};
+        if (nodes % nodes_y != 0 || dims[0] % candidate[0] != 0 || dims[1] % candidate[1] != 0) {
+            continue;
+        }
+        double volume = halo_volume(candidate, length, halo, periods);
+        if (node_dims[0] == 0 || volume < best_volume) {
+            node_dims[0] = candidate[0];
+            node_dims[1] = candidate[1];
+            best_volume = volume;
+        }
+    }
+    return node_dims[0] != 0;
+}
+
 void my_abort(string err) {
 #ifdef HAVE_MPI
     int rank = 0;
@@ -183,11 +265,168 @@ void print_matrix(string filename, double * matrix, size_t stride, size_t width,
 void memcpy2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height) {
     char *d = reinterpret_cast<char *>(dst);
     const char *s = reinterpret_cast<const char *>(src);
+    if (dstride == width && sstride == width) {
+        memcpy(d, s, width * height);
+        return;
+    }
     for (size_t i = 0; i < height; ++i) {
-        for (size_t j = 0; j < width; ++j) {
-            d[i * dstride + j] = s[i * sstride + j];
+        memcpy(d + i * dstride, s + i * sstride, width);
+    }
+}
+
+/*
+ * A plain store first reads the cache line it writes into, so copying a
+ * row to a grid that is not in cache moves it through memory twice, and
+ * evicts lines that are still needed. Non-temporal stores write whole lines
+ * straight to memory instead. The parts of a row outside the 16-byte aligned
+ * lines are copied with plain stores, and the fence orders the streamed rows
+ * before whatever the caller does next, such as releasing a lock that
+ * another thread takes to read them.
+ */
+void stream2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height) {
+#ifdef STREAM_STORES
+    for (size_t i = 0; i < height; ++i) {
+        char *d = reinterpret_cast<char *>(dst) + i * dstride;
+        const char *s = reinterpret_cast<const char *>(src) + i * sstride;
+        size_t head = std::min(width, (16 - reinterpret_cast<uintptr_t>(d) % 16) % 16);
+        memcpy(d, s, head);
+        size_t j = head;
+        for (; j + 16 <= width; j += 16) {
+            _mm_stream_si128(reinterpret_cast<__m128i *>(d + j), _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + j)));
+        }
+        memcpy(d + j, s + j, width - j);
+    }
+    _mm_sfence();
+#else
+    memcpy2D(dst, dstride, src, sstride, width, height);
+#endif
+}
+
+size_t last_level_cache() {
+#if defined(_SC_LEVEL3_CACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0) {
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+    if (size > 0) {
+        return size_t(size);
+    }
+#endif
+    return DEFAULT_CACHE_SIZE;
+}
+
+/*
+ * Grids are zeroed in parallel right after the allocation. Linux places a
+ * page on the NUMA node of the thread that first writes it, so the rows are
+ * split among the threads in contiguous ranges, the shares of the blocks they
+ * start from in the CPU kernel (see BlockSchedule), and each thread finds the
+ * rows it evolves in its local memory instead of on the node of the thread
+ * that built the state. Grids of
+ * several megabytes start in memory aligned to huge pages and flagged for
+ * transparent huge pages, so that they take a few TLB entries instead of
+ * thousands.
+ * A huge page is physically contiguous, so grids starting at the same offset
+ * in their huge page would share cache sets at every index, and the kernels
+ * read and write several grids at the same index. Each grid is shifted by a
+ * different multiple of GRID_STAGGER. The address of the allocation is kept
+ * in the cache line before the grid, for free_grid.
+ */
+void *allocate_grid(size_t bytes, size_t rows) {
+    static unsigned int grids = 0;
+    bool huge = bytes >= HUGE_PAGE_SIZE;
+    size_t alignment = huge ? HUGE_PAGE_SIZE : GRID_ALIGNMENT;
+    size_t offset = GRID_ALIGNMENT + (huge ? grids++ % GRID_STAGGERS * GRID_STAGGER : 0);
+    bytes = (bytes + GRID_ALIGNMENT - 1) / GRID_ALIGNMENT * GRID_ALIGNMENT;
+#ifdef WIN32
+    void *memory = _aligned_malloc(offset + bytes, alignment);
+    if (memory == NULL) {
+        my_abort("Cannot allocate a grid");
+    }
+#else
+    void *memory = NULL;
+    if (posix_memalign(&memory, alignment, offset + bytes) != 0) {
+        my_abort("Cannot allocate a grid");
+    }
+#endif
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge) {
+        // Only a hint: the grid keeps ordinary pages if huge pages are disabled
+        madvise(memory, offset + bytes, MADV_HUGEPAGE);
+    }
+#endif
+    char *grid = static_cast<char *>(memory) + offset;
+    reinterpret_cast<void **>(grid)[-1] = memory;
+    rows = std::max(rows, size_t(1));
+    size_t row_bytes = (bytes + rows - 1) / rows;
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < int(rows); row++) {
+        size_t begin = std::min(row * row_bytes, bytes);
+        size_t end = std::min(begin + row_bytes, bytes);
+        memset(grid + begin, 0, end - begin);
+    }
+    return grid;
+}
+
+void free_grid(void *grid) {
+    if (grid == NULL) {
+        return;
+    }
+    void *memory = reinterpret_cast<void **>(grid)[-1];
+#ifdef WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+/*
+ * Pages of the grid on each NUMA node, as "node 0: 512 pages, node 1: 512
+ * pages". Pages that were never touched are counted as not resident. Without
+ * NUMA support (or outside Linux) the placement is "unknown".
+ */
+string numa_placement(const void *grid, size_t bytes) {
+    if (grid == NULL || bytes == 0) {
+        return "none";
+    }
+#if defined(__linux__) && defined(SYS_move_pages)
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(grid) / page_size * page_size;
+    uintptr_t end = reinterpret_cast<uintptr_t>(grid) + bytes;
+    size_t pages = (end - begin + page_size - 1) / page_size;
+    map<int, size_t> pages_per_node;
+    const size_t batch = 1024;
+    void *addresses[batch];
+    int status[batch];
+    for (size_t first = 0; first < pages; first += batch) {
+        size_t count = std::min(batch, pages - first);
+        for (size_t i = 0; i < count; i++) {
+            addresses[i] = reinterpret_cast<void *>(begin + (first + i) * page_size);
+        }
+        // With no target nodes, move_pages only reports the node of every page
+        if (syscall(SYS_move_pages, 0, count, addresses, NULL, status, 0) != 0) {
+            return "unknown";
         }
+        for (size_t i = 0; i < count; i++) {
+            pages_per_node[status[i] < 0 ? -1 : status[i]]++;
+        }
+    }
+    stringstream placement;
+    for (map<int, size_t>::const_iterator it = pages_per_node.begin(); it != pages_per_node.end(); ++it) {
+        if (it != pages_per_node.begin()) {
+            placement << ", ";
+        }
+        if (it->first < 0) {
+            placement << "not resident: ";
+        }
+        else {
+            placement << "node " << it->first << ": ";
+        }
+        placement << it->second << " pages";
     }
+    return placement.str();
+#else
+    return "unknown";
+#endif
 }
 
 void stamp(Lattice *grid, State *state, string fileprefix) {
@@ -26,8 +26,37 @@ void stamp(Lattice *grid, State *state, string fileprefix);
 void stamp_matrix(Lattice *grid, double *matrix, string filename);
 
 void calculate_borders(int coord, int dim, int * start, int *end, int *inner_start, int *inner_end, int length, int halo, int periodic_bound);
+// Arrange procs processes in a grid of dims[0] x dims[1] tiles (y by x) of a lattice of length[0] x length[1] dots, with the least
+// halo volume among the grids whose tiles are deeper than the halos. Nonzero entries of dims are kept, as with MPI_Dims_create.
+void process_grid(int procs, const int length[2], const int halo[2], const int periods[2], int dims[2]);
+// Arrange nodes nodes in a grid of node_dims[0] x node_dims[1] blocks of tiles of the process grid dims, with the least halo volume
+// between the blocks; false if no such grid divides dims
+bool node_grid(int nodes, const int dims[2], const int length[2], const int halo[2], const int periods[2], int node_dims[2]);
 void my_abort(string err);
 void memcpy2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height);
+// memcpy2D with non-temporal stores where the target supports them
+void stream2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height);
+// Bytes of the last-level cache, DEFAULT_CACHE_SIZE if the system does not tell
+size_t last_level_cache();
+
+#define GRID_ALIGNMENT 64u
+#define DEFAULT_CACHE_SIZE (8u << 20)
+#define HUGE_PAGE_SIZE (2u << 20)
+#define GRID_STAGGER (4096u + GRID_ALIGNMENT)
+#define GRID_STAGGERS 16u
+
+void *allocate_grid(size_t bytes, size_t rows);
+void free_grid(void *grid);
+string numa_placement(const void *grid, size_t bytes);
+
+/**
+ * Allocate size values for a grid of rows rows, first touched by the threads that evolve them.
+ * Release it with free_grid.
+ */
+template<typename T>
+T *new_grid(size_t size, size_t rows) {
+    return static_cast<T *>(allocate_grid(size * sizeof(T), rows));
+}
 double bessel_j_zeros(int l, int x);
 
 #endif
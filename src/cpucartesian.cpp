@@ -1,10 +1,16 @@
 #include <string>
 #include <complex>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#include "common.h"
+#include "kernel.h"
 
-void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+template<typename real_t>
+void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
     for (size_t idx = start_offset, peer = idx + stride; idx < width; idx += 2, peer += 2) {
-        double tmp_real = p_real[idx];
-        double tmp_imag = p_imag[idx];
+        real_t tmp_real = p_real[idx];
+        real_t tmp_imag = p_imag[idx];
         p_real[idx] = a * tmp_real - b * p_imag[peer];
         p_imag[idx] = a * tmp_imag + b * p_real[peer];
         p_real[peer] = a * p_real[peer] - b * tmp_imag;
@@ -12,8 +18,8 @@ void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, siz
     }
     for (size_t y = 1; y < height - 1; ++y) {
         for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + stride; idx < y * stride + width; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+            real_t tmp_real = p_real[idx];
+            real_t tmp_imag = p_imag[idx];
             p_real[idx] = a * tmp_real - b * p_imag[peer];
             p_imag[idx] = a * tmp_imag + b * p_real[peer];
             p_real[peer] = a * p_real[peer] - b * tmp_imag;
@@ -22,10 +28,11 @@ void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, siz
     }
 }
 
-void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+template<typename real_t>
+void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
     for (size_t idx = start_offset, peer = idx + stride; idx < width; idx += 2, peer += 2) {
-        double tmp_real = p_real[idx];
-        double tmp_imag = p_imag[idx];
+        real_t tmp_real = p_real[idx];
+        real_t tmp_imag = p_imag[idx];
         p_real[idx] = a * tmp_real + b * p_real[peer];
         p_imag[idx] = a * tmp_imag + b * p_imag[peer];
         p_real[peer] = a * p_real[peer] + b * tmp_real;
@@ -33,8 +40,8 @@ void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t
     }
     for (size_t y = 1; y < height - 1; ++y) {
         for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + stride; idx < y * stride + width; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+            real_t tmp_real = p_real[idx];
+            real_t tmp_imag = p_imag[idx];
             p_real[idx] = a * tmp_real + b * p_real[peer];
             p_imag[idx] = a * tmp_imag + b * p_imag[peer];
             p_real[peer] = a * p_real[peer] + b * tmp_real;
@@ -43,11 +50,12 @@ void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t
     }
 }
 
-void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+template<typename real_t>
+void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
     for (size_t y = 0; y < height; ++y) {
         for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + 1; idx < y * stride + width - 1; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+            real_t tmp_real = p_real[idx];
+            real_t tmp_imag = p_imag[idx];
             p_real[idx] = a * tmp_real - b * p_imag[peer];
             p_imag[idx] = a * tmp_imag + b * p_real[peer];
             p_real[peer] = a * p_real[peer] - b * tmp_imag;
@@ -56,11 +64,12 @@ void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, s
     }
 }
 
-void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+template<typename real_t>
+void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
     for (size_t y = 0; y < height; ++y) {
         for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + 1; idx < y * stride + width - 1; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+            real_t tmp_real = p_real[idx];
+            real_t tmp_imag = p_imag[idx];
             p_real[idx] = a * tmp_real + b * p_real[peer];
             p_imag[idx] = a * tmp_imag + b * p_imag[peer];
             p_real[peer] = a * p_real[peer] + b * tmp_real;
@@ -69,20 +78,167 @@ void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_
     }
 }
 
-//double time potential
-void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
-                            const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
+/*
+ * Phase factors of the nonlinear term.
+ *
+ * The potential kernels spend most of their time in sin, cos and exp. Besides
+ * the libm calls (PHASE_FULL), two polynomial tiers are provided, written
+ * without branches so that the loops of the potential kernels vectorise:
+ * PHASE_HIGH keeps the error below about 1e-12 and PHASE_FAST below about 1e-8.
+ * Both reduce the argument with Cody-Waite constants, which is accurate for
+ * phases up to about 1e6 in absolute value.
+ */
+enum {
+    PHASE_FULL,
+    PHASE_HIGH,
+    PHASE_FAST
+};
+
+// Adding 1.5 * 2^52 rounds to an integer kept in the low mantissa bits. The
+// bits are read back as an integer, so fast-math cannot fold the sum away.
+#define ROUND_MAGIC 6755399441055744.0
+
+static inline int64_t rounded_bits(double x) {
+    double shifted = x + ROUND_MAGIC;
+    int64_t bits, magic;
+    double m = ROUND_MAGIC;
+    memcpy(&bits, &shifted, sizeof(double));
+    memcpy(&magic, &m, sizeof(double));
+    return bits - magic;
+}
+
+template<int accuracy>
+static inline void phase_sincos(double x, double &c, double &s) {
+    if (accuracy == PHASE_FULL) {
+        c = cos(x);
+        s = sin(x);
+        return;
+    }
+    // x = k pi / 2 + r, |r| <= pi / 4
+    double k = nearbyint(x * 0.63661977236758134308);
+    int64_t quadrant = rounded_bits(x * 0.63661977236758134308);
+    double r = x - k * 1.57079625129699707031e0;
+    r = r - k * 7.54978941586159635335e-8;
+    r = r - k * 5.39030252995776476554e-15;
+    double r2 = r * r;
+    double sin_r, cos_r;
+    if (accuracy == PHASE_HIGH) {
+        sin_r = r + r * r2 * (-1.66666666666666307295e-1 + r2 * (8.33333333332211858878e-3 + r2 * (-1.98412698295895385996e-4 +
+                              r2 * (2.75573136213857245213e-6 + r2 * (-2.50507477628578072866e-8 + r2 * 1.58962301576546568060e-10)))));
+        cos_r = 1. - 0.5 * r2 + r2 * r2 * (4.16666666666665929218e-2 + r2 * (-1.38888888888730564116e-3 + r2 * (2.48015872888517045348e-5 +
+                                            r2 * (-2.75573141792967388112e-7 + r2 * (2.08757008419747316778e-9 + r2 * -1.13585365213876817300e-11)))));
+    }
+    else {
+        sin_r = r + r * r2 * (-1. / 6. + r2 * (1. / 120. + r2 * (-1. / 5040. + r2 * (1. / 362880.))));
+        cos_r = 1. - 0.5 * r2 + r2 * r2 * (1. / 24. + r2 * (-1. / 720. + r2 * (1. / 40320. + r2 * (-1. / 3628800.))));
+    }
+    // Rotate (cos r, sin r) by the quadrant
+    bool odd = quadrant & 1;
+    double sin_sign = (quadrant & 2) ? -1. : 1.;
+    double cos_sign = ((quadrant + 1) & 2) ? -1. : 1.;
+    s = sin_sign * (odd ? cos_r : sin_r);
+    c = cos_sign * (odd ? sin_r : cos_r);
+}
+
+template<int accuracy>
+static inline double phase_exp(double x) {
+    if (accuracy == PHASE_FULL) {
+        return exp(x);
+    }
+    x = std::min(std::max(x, -708.), 709.);
+    // x = k ln 2 + r, |r| <= ln 2 / 2
+    double k = nearbyint(x * 1.44269504088896340736);
+    int64_t exponent = rounded_bits(x * 1.44269504088896340736);
+    double r = x - k * 6.93145751953125e-1;
+    r = r - k * 1.42860682030941723212e-6;
+    double p;
+    if (accuracy == PHASE_HIGH) {
+        p = 1. + r * (1. + r * (1. / 2. + r * (1. / 6. + r * (1. / 24. + r * (1. / 120. + r * (1. / 720. + r * (1. / 5040. +
+                 r * (1. / 40320. + r * (1. / 362880. + r * (1. / 3628800. + r * (1. / 39916800.)))))))))));
+    }
+    else {
+        p = 1. + r * (1. + r * (1. / 2. + r * (1. / 6. + r * (1. / 24. + r * (1. / 120. + r * (1. / 720. + r * (1. / 5040.)))))));
+    }
+    // Multiply by 2^k building the exponent bits
+    int64_t scale_bits = (exponent + 1023) << 52;
+    double scale;
+    memcpy(&scale, &scale_bits, sizeof(double));
+    return p * scale;
+}
+
+// Single precision versions for the float kernels: 1.5 * 2^23 rounds to an
+// integer in the 23 mantissa bits. Both polynomial tiers use the cephes sinf,
+// cosf and expf polynomials, already accurate to the precision of float.
+#define ROUND_MAGIC_FLOAT 12582912.0f
+
+static inline int32_t rounded_bits(float x) {
+    float shifted = x + ROUND_MAGIC_FLOAT;
+    int32_t bits, magic;
+    float m = ROUND_MAGIC_FLOAT;
+    memcpy(&bits, &shifted, sizeof(float));
+    memcpy(&magic, &m, sizeof(float));
+    return bits - magic;
+}
+
+template<int accuracy>
+static inline void phase_sincos(float x, float &c, float &s) {
+    if (accuracy == PHASE_FULL) {
+        c = cos(x);
+        s = sin(x);
+        return;
+    }
+    float k = nearbyintf(x * 0.636619772f);
+    int32_t quadrant = rounded_bits(x * 0.636619772f);
+    float r = x - k * 1.5703125f;
+    r = r - k * 4.83751296997070312500e-4f;
+    r = r - k * 7.54978995489188216e-8f;
+    float r2 = r * r;
+    float sin_r = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    float cos_r = 1.f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+    bool odd = quadrant & 1;
+    float sin_sign = (quadrant & 2) ? -1.f : 1.f;
+    float cos_sign = ((quadrant + 1) & 2) ? -1.f : 1.f;
+    s = sin_sign * (odd ? cos_r : sin_r);
+    c = cos_sign * (odd ? sin_r : cos_r);
+}
+
+template<int accuracy>
+static inline float phase_exp(float x) {
+    if (accuracy == PHASE_FULL) {
+        return exp(x);
+    }
+    x = std::min(std::max(x, -87.f), 88.f);
+    float k = nearbyintf(x * 1.44269504f);
+    int32_t exponent = rounded_bits(x * 1.44269504f);
+    float r = x - k * 6.93359375e-1f;
+    r = r + k * 2.12194440e-4f;
+    float p = 1.f + r + r * r * (5.0000001201e-1f + r * (1.6666665459e-1f + r * (4.1665795894e-2f + r * (8.3334519073e-3f +
+                                 r * (1.3981999507e-3f + r * 1.9875691500e-4f)))));
+    int32_t scale_bits = (exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &scale_bits, sizeof(float));
+    return p * scale;
+}
+
+// Without an external potential (external_pot_real NULL) only the nonlinear phase is applied
+template<int accuracy, bool external, typename real_t>
+static void potential_phase_rows(bool two_wavefunctions, size_t stride, size_t width, size_t height, double _coupling_a, double _coupling_b, double _coupling_aa, size_t tile_width,
+                            const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag) {
+    real_t coupling_a = _coupling_a, coupling_b = _coupling_b, coupling_aa = _coupling_aa;
     if(two_wavefunctions) {
         for (size_t y = 0; y < height; ++y) {
             for (size_t idx = y * stride, idx_pot = y * tile_width; idx < y * stride + width; ++idx, ++idx_pot) {
-                double norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
-                //double norm_3 = norm_2 * sqrt(norm_2);
-                double norm_2b = pb_real[idx_pot] * pb_real[idx_pot] + pb_imag[idx_pot] * pb_imag[idx_pot];
-                double c_cos = cos(coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/);
-                double c_sin = sin(coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/);
-                double tmp = p_real[idx];
-                p_real[idx] = external_pot_real[idx_pot] * tmp - external_pot_imag[idx_pot] * p_imag[idx];
-                p_imag[idx] = external_pot_real[idx_pot] * p_imag[idx] + external_pot_imag[idx_pot] * tmp;
+                real_t norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
+                //real_t norm_3 = norm_2 * sqrt(norm_2);
+                real_t norm_2b = pb_real[idx_pot] * pb_real[idx_pot] + pb_imag[idx_pot] * pb_imag[idx_pot];
+                real_t c_cos, c_sin;
+                phase_sincos<accuracy>(coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/, c_cos, c_sin);
+                real_t tmp;
+                if (external) {
+                    tmp = p_real[idx];
+                    p_real[idx] = external_pot_real[idx_pot] * tmp - external_pot_imag[idx_pot] * p_imag[idx];
+                    p_imag[idx] = external_pot_real[idx_pot] * p_imag[idx] + external_pot_imag[idx_pot] * tmp;
+                }
 
                 tmp = p_real[idx];
                 p_real[idx] = c_cos * tmp + c_sin * p_imag[idx];
@@ -93,13 +249,16 @@ void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width,
     else {
         for (size_t y = 0; y < height; ++y) {
             for (size_t idx = y * stride, idx_pot = y * tile_width; idx < y * stride + width; ++idx, ++idx_pot) {
-                double norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
-                double norm_3 = norm_2 * sqrt(norm_2);
-                double c_cos = cos(coupling_a * norm_2 + coupling_aa * norm_3);
-                double c_sin = sin(coupling_a * norm_2 + coupling_aa * norm_3);
-                double tmp = p_real[idx];
-                p_real[idx] = external_pot_real[idx_pot] * tmp - external_pot_imag[idx_pot] * p_imag[idx];
-                p_imag[idx] = external_pot_real[idx_pot] * p_imag[idx] + external_pot_imag[idx_pot] * tmp;
+                real_t norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
+                real_t norm_3 = norm_2 * sqrt(norm_2);
+                real_t c_cos, c_sin;
+                phase_sincos<accuracy>(coupling_a * norm_2 + coupling_aa * norm_3, c_cos, c_sin);
+                real_t tmp;
+                if (external) {
+                    tmp = p_real[idx];
+                    p_real[idx] = external_pot_real[idx_pot] * tmp - external_pot_imag[idx_pot] * p_imag[idx];
+                    p_imag[idx] = external_pot_real[idx_pot] * p_imag[idx] + external_pot_imag[idx_pot] * tmp;
+                }
 
                 tmp = p_real[idx];
                 p_real[idx] = c_cos * tmp + c_sin * p_imag[idx];
@@ -109,42 +268,155 @@ void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width,
     }
 }
 
-//double time potential
-void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
-                                      const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
+// Only the real part of the operator is read in imaginary time, external_pot_imag may be NULL
+template<int accuracy, bool external, typename real_t>
+static void potential_phase_imaginary_rows(bool two_wavefunctions, size_t stride, size_t width, size_t height, double _coupling_a, double _coupling_b, double _coupling_aa, size_t tile_width,
+                                      const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag) {
+    real_t coupling_a = _coupling_a, coupling_b = _coupling_b, coupling_aa = _coupling_aa;
     if(two_wavefunctions) {
         for (size_t y = 0; y < height; ++y) {
             for (size_t idx = y * stride, idx_pot = y * tile_width; idx < y * stride + width; ++idx, ++idx_pot) {
-                double norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
-                //double norm_3 = norm_2 * sqrt(norm_2);
-                double norm_2b = pb_real[idx_pot] * pb_real[idx_pot] + pb_imag[idx_pot] * pb_imag[idx_pot];
-                double tmp = exp(-1. * (coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/));
-                p_real[idx] = tmp * external_pot_real[idx_pot] * p_real[idx];
-                p_imag[idx] = tmp * external_pot_real[idx_pot] * p_imag[idx];
+                real_t norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
+                //real_t norm_3 = norm_2 * sqrt(norm_2);
+                real_t norm_2b = pb_real[idx_pot] * pb_real[idx_pot] + pb_imag[idx_pot] * pb_imag[idx_pot];
+                real_t tmp = phase_exp<accuracy>(-(coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/));
+                if (external) {
+                    tmp *= external_pot_real[idx_pot];
+                }
+                p_real[idx] = tmp * p_real[idx];
+                p_imag[idx] = tmp * p_imag[idx];
             }
         }
     }
     else {
         for (size_t y = 0; y < height; ++y) {
             for (size_t idx = y * stride, idx_pot = y * tile_width; idx < y * stride + width; ++idx, ++idx_pot) {
-                double norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
-                double norm_3 = norm_2 * sqrt(norm_2);
-                double tmp = exp(-1. * (coupling_a * norm_2 + coupling_aa * norm_3));
-                p_real[idx] = tmp * external_pot_real[idx_pot] * p_real[idx];
-                p_imag[idx] = tmp * external_pot_real[idx_pot] * p_imag[idx];
+                real_t norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
+                real_t norm_3 = norm_2 * sqrt(norm_2);
+                real_t tmp = phase_exp<accuracy>(-(coupling_a * norm_2 + coupling_aa * norm_3));
+                if (external) {
+                    tmp *= external_pot_real[idx_pot];
+                }
+                p_real[idx] = tmp * p_real[idx];
+                p_imag[idx] = tmp * p_imag[idx];
             }
         }
     }
 }
 
+template<int accuracy, typename real_t>
+static void potential_phase(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                            const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag) {
+    if (external_pot_real == NULL) {
+        potential_phase_rows<accuracy, false>(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+                                              external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+    else {
+        potential_phase_rows<accuracy, true>(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+                                             external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+}
+
+template<int accuracy, typename real_t>
+static void potential_phase_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                                      const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag) {
+    if (external_pot_real == NULL) {
+        potential_phase_imaginary_rows<accuracy, false>(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+                                                        external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+    else {
+        potential_phase_imaginary_rows<accuracy, true>(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+                                                       external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+}
+
+template<typename real_t>
+void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                            const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag) {
+    potential_phase<PHASE_FULL>(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+                                external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+}
+
+template<typename real_t>
+void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                                      const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag) {
+    potential_phase_imaginary<PHASE_FULL>(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+                                          external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+}
+
+template<typename real_t>
+PotentialKernels<real_t> get_potential_kernels(string accuracy) {
+    PotentialKernels<real_t> kernels;
+    if (accuracy == "full") {
+        kernels.accuracy = "full";
+        kernels.real_time = block_kernel_potential<real_t>;
+        kernels.imaginary_time = block_kernel_potential_imaginary<real_t>;
+    }
+    else if (accuracy == "high") {
+        kernels.accuracy = "high";
+        kernels.real_time = potential_phase<PHASE_HIGH, real_t>;
+        kernels.imaginary_time = potential_phase_imaginary<PHASE_HIGH, real_t>;
+    }
+    else if (accuracy == "fast") {
+        kernels.accuracy = "fast";
+        kernels.real_time = potential_phase<PHASE_FAST, real_t>;
+        kernels.imaginary_time = potential_phase_imaginary<PHASE_FAST, real_t>;
+    }
+    else {
+        my_abort("Unknown phase accuracy: " + accuracy);
+    }
+    return kernels;
+}
+
+// Evolution operator of the external potential: exp(-i delta_t V), or exp(-delta_t V) in imaginary time
+template<int accuracy>
+static void exp_potential_phase(bool imag_time, double delta_t, size_t count, const double *potential, double *pot_real, double *pot_imag) {
+    if (imag_time) {
+        for (size_t i = 0; i < count; i++) {
+            pot_real[i] = phase_exp<accuracy>(-delta_t * potential[i]);
+        }
+        if (pot_imag != NULL) {
+            memset(pot_imag, 0, count * sizeof(double));
+        }
+    }
+    else {
+        for (size_t i = 0; i < count; i++) {
+            phase_sincos<accuracy>(-delta_t * potential[i], pot_real[i], pot_imag[i]);
+        }
+    }
+}
+
+exp_potential_kernel get_exp_potential_kernel(string accuracy) {
+    if (accuracy == "full") {
+        return exp_potential_phase<PHASE_FULL>;
+    }
+    else if (accuracy == "high") {
+        return exp_potential_phase<PHASE_HIGH>;
+    }
+    else if (accuracy == "fast") {
+        return exp_potential_phase<PHASE_FAST>;
+    }
+    my_abort("Unknown phase accuracy: " + accuracy);
+    return NULL;
+}
+
 //rotation
-void block_kernel_rotation(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
+template<typename real_t>
+void rotation_coefficients(bool imag_time, double alpha, double offset, size_t count, real_t *table) {
+    for (size_t i = 0; i < count; ++i) {
+        double angle = alpha * (offset + i);
+        table[2 * i] = imag_time ? cosh(angle) : cos(angle);
+        table[2 * i + 1] = imag_time ? sinh(angle) : sin(angle);
+    }
+}
+
+template<typename real_t>
+void block_kernel_rotation(size_t stride, size_t width, size_t height, const real_t *rotation_x, const real_t *rotation_y, real_t * p_real, real_t * p_imag) {
 
-    double tmp_r, tmp_i;
+    real_t tmp_r, tmp_i;
 
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cos(alpha_yy), b = sin(alpha_yy);
+    for (size_t j = 0; j < height; ++j) {
+        real_t a = rotation_y[2 * j], b = rotation_y[2 * j + 1];
         for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
             tmp_r = p_real[idx], tmp_i = p_imag[idx];
             p_real[idx] = a * p_real[idx] + b * p_real[peer];
@@ -161,9 +433,8 @@ void block_kernel_rotation(size_t stride, size_t width, size_t height, int offse
         }
     }
 
-    for (int i = 0, x = offset_x; i < width; ++i, ++x) {
-        double alpha_xx = alpha_x * x;
-        double a = cos(alpha_xx), b = sin(alpha_xx);
+    for (size_t i = 0; i < width; ++i) {
+        real_t a = rotation_x[2 * i], b = rotation_x[2 * i + 1];
         for (size_t j = 0, idx = i, peer = stride + idx; j < height - 1; j += 2, idx += 2 * stride, peer += 2 * stride) {
             tmp_r = p_real[idx], tmp_i = p_imag[idx];
             p_real[idx] = a * p_real[idx] + b * p_real[peer];
@@ -180,9 +451,8 @@ void block_kernel_rotation(size_t stride, size_t width, size_t height, int offse
         }
     }
 
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cos(alpha_yy), b = sin(alpha_yy);
+    for (size_t j = 0; j < height; ++j) {
+        real_t a = rotation_y[2 * j], b = rotation_y[2 * j + 1];
         for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
             tmp_r = p_real[idx], tmp_i = p_imag[idx];
             p_real[idx] = a * p_real[idx] + b * p_real[peer];
@@ -200,12 +470,12 @@ void block_kernel_rotation(size_t stride, size_t width, size_t height, int offse
     }
 }
 
-void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
+template<typename real_t>
+void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, const real_t *rotation_x, const real_t *rotation_y, real_t * p_real, real_t * p_imag) {
 
-    double tmp_r, tmp_i;
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cosh(alpha_yy), b = sinh(alpha_yy);
+    real_t tmp_r, tmp_i;
+    for (size_t j = 0; j < height; ++j) {
+        real_t a = rotation_y[2 * j], b = rotation_y[2 * j + 1];
         for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
             tmp_r = p_real[idx], tmp_i = p_imag[idx];
             p_real[idx] = a * p_real[idx] + b * p_imag[peer];
@@ -222,9 +492,8 @@ void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height,
         }
     }
 
-    for (int i = 0, x = offset_x; i < width; ++i, ++x) {
-        double alpha_xx = alpha_x * x;
-        double a = cosh(alpha_xx), b = sinh(alpha_xx);
+    for (size_t i = 0; i < width; ++i) {
+        real_t a = rotation_x[2 * i], b = rotation_x[2 * i + 1];
         for (size_t j = 0, idx = i, peer = stride + idx; j < height - 1; j += 2, idx += 2 * stride, peer += 2 * stride) {
             tmp_r = p_real[idx], tmp_i = p_imag[idx];
             p_real[idx] = a * p_real[idx] + b * p_imag[peer];
@@ -241,9 +510,8 @@ void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height,
         }
     }
 
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cosh(alpha_yy), b = sinh(alpha_yy);
+    for (size_t j = 0; j < height; ++j) {
+        real_t a = rotation_y[2 * j], b = rotation_y[2 * j + 1];
         for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
             tmp_r = p_real[idx], tmp_i = p_imag[idx];
             p_real[idx] = a * p_real[idx] + b * p_imag[peer];
@@ -261,8 +529,10 @@ void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height,
     }
 }
 
-void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
-    double real, imag;
+template<typename real_t>
+void rabi_coupling_real(size_t stride, size_t width, size_t height, double _cc, double _cs_r, double _cs_i, real_t *p_real, real_t *p_imag, real_t *pb_real, real_t *pb_imag) {
+    real_t cc = _cc, cs_r = _cs_r, cs_i = _cs_i;
+    real_t real, imag;
     for(size_t i = 0; i < height; i++) {
         for(size_t j = 0, idx = i * stride; j < width; j++, idx++) {
             real = p_real[idx];
@@ -275,8 +545,10 @@ void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, d
     }
 }
 
-void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
-    double real, imag;
+template<typename real_t>
+void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double _cc, double _cs_r, double _cs_i, real_t *p_real, real_t *p_imag, real_t *pb_real, real_t *pb_imag) {
+    real_t cc = _cc, cs_r = _cs_r, cs_i = _cs_i;
+    real_t real, imag;
     for(size_t i = 0; i < height; i++) {
         for(size_t j = 0, idx = i * stride; j < width; j++, idx++) {
             real = p_real[idx];
@@ -288,3 +560,20 @@ void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double
         }
     }
 }
+
+#define INSTANTIATE_CARTESIAN_KERNELS(real_t) \
+    template void block_kernel_vertical<real_t>(size_t, size_t, size_t, size_t, real_t, real_t, real_t *, real_t *); \
+    template void block_kernel_vertical_imaginary<real_t>(size_t, size_t, size_t, size_t, real_t, real_t, real_t *, real_t *); \
+    template void block_kernel_horizontal<real_t>(size_t, size_t, size_t, size_t, real_t, real_t, real_t *, real_t *); \
+    template void block_kernel_horizontal_imaginary<real_t>(size_t, size_t, size_t, size_t, real_t, real_t, real_t *, real_t *); \
+    template void block_kernel_potential<real_t>(bool, size_t, size_t, size_t, double, double, double, size_t, const real_t *, const real_t *, const real_t *, const real_t *, real_t *, real_t *); \
+    template void block_kernel_potential_imaginary<real_t>(bool, size_t, size_t, size_t, double, double, double, size_t, const real_t *, const real_t *, const real_t *, const real_t *, real_t *, real_t *); \
+    template PotentialKernels<real_t> get_potential_kernels<real_t>(string); \
+    template void rotation_coefficients<real_t>(bool, double, double, size_t, real_t *); \
+    template void block_kernel_rotation<real_t>(size_t, size_t, size_t, const real_t *, const real_t *, real_t *, real_t *); \
+    template void block_kernel_rotation_imaginary<real_t>(size_t, size_t, size_t, const real_t *, const real_t *, real_t *, real_t *); \
+    template void rabi_coupling_real<real_t>(size_t, size_t, size_t, double, double, double, real_t *, real_t *, real_t *, real_t *); \
+    template void rabi_coupling_imaginary<real_t>(size_t, size_t, size_t, double, double, double, real_t *, real_t *, real_t *, real_t *);
+
+INSTANTIATE_CARTESIAN_KERNELS(double)
+INSTANTIATE_CARTESIAN_KERNELS(float)
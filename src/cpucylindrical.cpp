@@ -1,81 +1,77 @@
 #include <complex>
+#include "common.h"
+#include "kernel.h"
 
-//real radial kinetic term
-void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height,
-                                 double offset_x, double _kin_radial,
-                                 double * p_real, double * p_imag) {
-
-    double tmp_r, tmp_i;
-    int start_i = 0;
-
-    // The first two points of the radial coordinate have a different coupling
-    if (offset_x + start_offset == 0) {
-        double kin_radial = 2 * _kin_radial;
-        double a = cos(kin_radial), b = - sin(kin_radial);
-        for (size_t j = 0, idx = 0, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r - b * p_imag[peer];
-            p_imag[idx] = a * tmp_i + b * p_real[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_i;
-            p_imag[peer] = a * p_imag[peer] + b * tmp_r;
+/*
+ * The coefficients of a pair of dots only depend on the radial coordinate x
+ * of its first dot, so the kernels read them from a table holding a, b and c
+ * for every column, filled by radial_coefficients when the kernel is built.
+ * The first two points of the radial coordinate have a different coupling:
+ * their entry, at x = 0, has c = b.
+ */
+template<typename real_t>
+void radial_coefficients(bool imag_time, double _kin_radial, double offset_x, size_t count, real_t *table) {
+    for (size_t i = 0; i < count; i++) {
+        double x = offset_x + i;
+        real_t *coefficients = &table[3 * i];
+        if (x == 0) {
+            double kin_radial = 2 * _kin_radial;
+            coefficients[0] = imag_time ? cosh(kin_radial) : cos(kin_radial);
+            coefficients[1] = imag_time ? - sinh(kin_radial) : - sin(kin_radial);
+            coefficients[2] = coefficients[1];
         }
-        start_i = 2;
-    }
-
-    double x = double(start_i) + offset_x + start_offset;
-    for (int i = start_i + start_offset; i < width - 1; i += 2, x += 2) {
-        double kin_radial = _kin_radial / sqrt(x * x - 0.25);
-        double ratio = sqrt((2 * x + 1) / (2 * x - 1));
-        double sinh_kin_radial = sinh(kin_radial);
-        double a = cosh(kin_radial), b = sinh_kin_radial * ratio, c = - sinh_kin_radial / ratio;
-        for (size_t j = 0, idx = i, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r - b * p_imag[peer];
-            p_imag[idx] = a * tmp_i + b * p_real[peer];
-            p_real[peer] = a * p_real[peer] - c * tmp_i;
-            p_imag[peer] = a * p_imag[peer] + c * tmp_r;
+        else {
+            double kin_radial = _kin_radial / sqrt(x * x - 0.25);
+            double ratio = sqrt((2 * x + 1) / (2 * x - 1));
+            double sin_kin_radial = imag_time ? sin(kin_radial) : sinh(kin_radial);
+            coefficients[0] = imag_time ? cos(kin_radial) : cosh(kin_radial);
+            coefficients[1] = sin_kin_radial * ratio;
+            coefficients[2] = - sin_kin_radial / ratio;
         }
     }
+}
 
+//real radial kinetic term
+template<typename real_t>
+void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height,
+                                 const real_t *radial, real_t * p_real, real_t * p_imag) {
 
+    real_t tmp_r, tmp_i;
+    for (size_t j = 0; j < height; j++) {
+        real_t *row_real = &p_real[j * stride], *row_imag = &p_imag[j * stride];
+        for (size_t i = start_offset, peer = i + 1; i + 1 < width; i += 2, peer += 2) {
+            real_t a = radial[3 * i], b = radial[3 * i + 1], c = radial[3 * i + 2];
+            tmp_r = row_real[i], tmp_i = row_imag[i];
+            row_real[i] = a * tmp_r - b * row_imag[peer];
+            row_imag[i] = a * tmp_i + b * row_real[peer];
+            row_real[peer] = a * row_real[peer] - c * tmp_i;
+            row_imag[peer] = a * row_imag[peer] + c * tmp_r;
+        }
+    }
 }
 
 //imaginary radial kinetic term
+template<typename real_t>
 void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height,
-        double offset_x, double _kin_radial,
-        double * p_real, double * p_imag) {
-
-    double tmp_r, tmp_i;
-    int start_i = 0;
+        const real_t *radial, real_t * p_real, real_t * p_imag) {
 
-    // The first two points of the radial coordinate have a different coupling
-    if (offset_x + start_offset == 0) {
-        double kin_radial = 2 * _kin_radial;
-        double a = cosh(kin_radial), b = -sinh(kin_radial);
-        for (size_t j = 0, idx = 0, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r + b * p_real[peer];
-            p_imag[idx] = a * tmp_i + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] + b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] + b * tmp_i;
+    real_t tmp_r, tmp_i;
+    for (size_t j = 0; j < height; j++) {
+        real_t *row_real = &p_real[j * stride], *row_imag = &p_imag[j * stride];
+        for (size_t i = start_offset, peer = i + 1; i + 1 < width; i += 2, peer += 2) {
+            real_t a = radial[3 * i], b = radial[3 * i + 1], c = radial[3 * i + 2];
+            tmp_r = row_real[i], tmp_i = row_imag[i];
+            row_real[i] = a * tmp_r + b * row_real[peer];
+            row_imag[i] = a * tmp_i + b * row_imag[peer];
+            row_real[peer] = a * row_real[peer] + c * tmp_r;
+            row_imag[peer] = a * row_imag[peer] + c * tmp_i;
         }
-        start_i = 2;
     }
-
-    double x = double(start_i) + offset_x + start_offset;
-    for (int i = start_i + start_offset; i < width - 1; i += 2, x += 2) {
-        double kin_radial = _kin_radial / sqrt(x * x - 0.25);
-        double ratio = sqrt((2 * x + 1) / (2 * x - 1));
-        double sin_kin_radial = sin(kin_radial);
-        double a = cos(kin_radial), b = sin_kin_radial * ratio, c = - sin_kin_radial / ratio;
-        for (size_t j = 0, idx = i, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r + b * p_real[peer];
-            p_imag[idx] = a * tmp_i + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] + c * tmp_r;
-            p_imag[peer] = a * p_imag[peer] + c * tmp_i;
-        }
-    }
-
-
 }
+
+template void radial_coefficients<double>(bool, double, double, size_t, double *);
+template void radial_coefficients<float>(bool, double, double, size_t, float *);
+template void block_kernel_radial_kinetic<double>(size_t, size_t, size_t, size_t, const double *, double *, double *);
+template void block_kernel_radial_kinetic_imaginary<double>(size_t, size_t, size_t, size_t, const double *, double *, double *);
+template void block_kernel_radial_kinetic<float>(size_t, size_t, size_t, size_t, const float *, float *, float *);
+template void block_kernel_radial_kinetic_imaginary<float>(size_t, size_t, size_t, size_t, const float *, float *, float *);
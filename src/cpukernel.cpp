@@ -18,160 +18,892 @@
 #include "common.h"
 #include "kernel.h"
 #include <iostream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#if defined(HAVE_MPI) && !defined(WIN32)
+#include <sched.h>
+#endif
 
-void full_step(bool two_wavefunctions, size_t stride, size_t width, size_t height,
-               double offset_x, double offset_y, double alpha_x, double alpha_y,
-               double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
-               size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
-               const double *pb_real, const double *pb_imag, double * real, double * imag,
-               string coordinate_system) {
-    if (height > 1 ) {
-        block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic(0u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic(1u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_potential (two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
-    if (alpha_x != 0. && alpha_y != 0.) {
-        block_kernel_rotation  (stride, width, height, offset_x, offset_y, alpha_x, alpha_y, real, imag);
-    }
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic(1u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic(0u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
-    }
-}
-
-void full_step_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height,
-                         double offset_x, double offset_y, double alpha_x, double alpha_y,
-                         double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
-                         size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
-                         const double *pb_real, const double *pb_imag, double * real, double * imag,
-                         string coordinate_system) {
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic_imaginary(0u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic_imaginary(1u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_potential_imaginary (two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
-    if (alpha_x != 0. && alpha_y != 0.) {
-        block_kernel_rotation_imaginary(stride, width, height, offset_x, offset_y, alpha_x, alpha_y, real, imag);
-    }
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic_imaginary(1u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic_imaginary(0u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
-    }
-}
-
-void process_sides(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
-                   double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag,
-                   const double * p_real, const double * p_imag, const double * pb_real, const double * pb_imag,
-                   double * next_real, double * next_imag, double * block_real, double * block_imag, bool imag_time, string coordinate_system) {
-
-    // First block [0..block_width - halo_x]
-    memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-    memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-    if(imag_time)
-        full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                            &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-    else
-        full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                  &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-    memcpy2D(&next_real[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_real[write_offset * block_width], block_width * sizeof(double), (block_width - halo_x) * sizeof(double), write_height);
-    memcpy2D(&next_imag[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_imag[write_offset * block_width], block_width * sizeof(double), (block_width - halo_x) * sizeof(double), write_height);
-
-    size_t block_start = ((tile_width - block_width) / (block_width - 2 * halo_x) + 1) * (block_width - 2 * halo_x);
-    // Last block
-    memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width + block_start], tile_width * sizeof(double), (tile_width - block_start) * sizeof(double), read_height);
-    memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width + block_start], tile_width * sizeof(double), (tile_width - block_start) * sizeof(double), read_height);
-    if(imag_time)
-        full_step_imaginary(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                            &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-    else
-        full_step(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                  &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-    memcpy2D(&next_real[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_real[write_offset * block_width + halo_x], block_width * sizeof(double), (tile_width - block_start - halo_x) * sizeof(double), write_height);
-    memcpy2D(&next_imag[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_imag[write_offset * block_width + halo_x], block_width * sizeof(double), (tile_width - block_start - halo_x) * sizeof(double), write_height);
-}
-
-void process_band(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t block_height, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
-                  double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag, const double * p_real, const double * p_imag,
-                  const double * pb_real, const double * pb_imag, double * next_real, double * next_imag, int inner, int sides, bool imag_time, string coordinate_system) {
-    double *block_real = new double[block_height * block_width];
-    double *block_imag = new double[block_height * block_width];
+/*
+ * Block step.
+ *
+ * The step is a template over the terms of the Hamiltonian, so that every
+ * combination is compiled into its own function with no string or flag
+ * tests left inside; CPUBlock picks the instance once in its constructor
+ * through get_block_step.
+ */
+// Entries of a table from the i-th on, NULL if there is no table
+template<typename real_t>
+static inline const real_t *entries_from(const real_t *table, size_t i) {
+    return table == NULL ? NULL : &table[i];
+}
 
+// Potential step on height rows of a block. A separable potential is the product of its factors, built for one row at a time.
+template<bool imag_time, bool two_wavefunctions, typename real_t>
+static void potential_rows(const PotentialKernels<real_t> &potential, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa,
+                           size_t tile_width, const real_t *potential_x, const real_t *potential_y, const real_t *external_pot_real, const real_t *external_pot_imag,
+                           const real_t *pb_real, const real_t *pb_imag, real_t * real, real_t * imag) {
+    potential_kernel<real_t> potential_step = imag_time ? potential.imaginary_time : potential.real_time;
+    if (potential_x == NULL) {
+        potential_step(two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
+        return;
+    }
+    real_t row_real[BLOCK_WIDTH_MAX], row_imag[BLOCK_WIDTH_MAX];
+    for (size_t y = 0; y < height; y++) {
+        real_t y_real = potential_y[2 * y], y_imag = potential_y[2 * y + 1];
+        for (size_t x = 0; x < width; x++) {
+            row_real[x] = potential_x[2 * x] * y_real - potential_x[2 * x + 1] * y_imag;
+            row_imag[x] = potential_x[2 * x] * y_imag + potential_x[2 * x + 1] * y_real;
+        }
+        potential_step(two_wavefunctions, stride, width, 1, coupling_a, coupling_b, coupling_aa, tile_width, row_real, row_imag,
+                       &pb_real[y * tile_width], &pb_imag[y * tile_width], &real[y * stride], &imag[y * stride]);
+    }
+}
+
+template<typename real_t, bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool two_dimensional>
+static void sweep_step(size_t stride, size_t width, size_t height,
+                       const real_t *radial, const real_t *rotation_x, const real_t *rotation_y, const real_t *potential_x, const real_t *potential_y,
+                       double aH, double bH, double aV, double bV, double coupling_a, double coupling_b, double coupling_aa,
+                       size_t tile_width, const real_t *external_pot_real, const real_t *external_pot_imag,
+                       const real_t *pb_real, const real_t *pb_imag, real_t * real, real_t * imag,
+                       const KineticKernels<real_t> &kinetic, const PotentialKernels<real_t> &potential) {
+    kinetic_kernel<real_t> vertical = imag_time ? kinetic.vertical_imaginary : kinetic.vertical;
+    kinetic_kernel<real_t> horizontal = imag_time ? kinetic.horizontal_imaginary : kinetic.horizontal;
+    if (two_dimensional) {
+        vertical(0u, stride, width, height, aV, bV, real, imag);
+    }
+    horizontal(0u, stride, width, height, aH, bH, real, imag);
+    if (two_dimensional) {
+        vertical(1u, stride, width, height, aV, bV, real, imag);
+    }
+    horizontal(1u, stride, width, height, aH, bH, real, imag);
+    if (cylindrical) {
+        if (imag_time) {
+            block_kernel_radial_kinetic_imaginary(0u, stride, width, height, radial, real, imag);
+            block_kernel_radial_kinetic_imaginary(1u, stride, width, height, radial, real, imag);
+        }
+        else {
+            block_kernel_radial_kinetic(0u, stride, width, height, radial, real, imag);
+            block_kernel_radial_kinetic(1u, stride, width, height, radial, real, imag);
+        }
+    }
+    potential_rows<imag_time, two_wavefunctions>(potential, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width,
+            potential_x, potential_y, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
+    if (rotation) {
+        if (imag_time) {
+            block_kernel_rotation_imaginary(stride, width, height, rotation_x, rotation_y, real, imag);
+        }
+        else {
+            block_kernel_rotation(stride, width, height, rotation_x, rotation_y, real, imag);
+        }
+    }
+    if (cylindrical) {
+        if (imag_time) {
+            block_kernel_radial_kinetic_imaginary(1u, stride, width, height, radial, real, imag);
+            block_kernel_radial_kinetic_imaginary(0u, stride, width, height, radial, real, imag);
+        }
+        else {
+            block_kernel_radial_kinetic(1u, stride, width, height, radial, real, imag);
+            block_kernel_radial_kinetic(0u, stride, width, height, radial, real, imag);
+        }
+    }
+    horizontal(1u, stride, width, height, aH, bH, real, imag);
+    if (two_dimensional) {
+        vertical(1u, stride, width, height, aV, bV, real, imag);
+    }
+    horizontal(0u, stride, width, height, aH, bH, real, imag);
+    if (two_dimensional) {
+        vertical(0u, stride, width, height, aV, bV, real, imag);
+    }
+}
+
+/*
+ * Fused splitting step.
+ *
+ * sweep_step sweeps the whole block once for every factor of the splitting
+ * sequence. The fused version applies the sequence as a wavefront moving
+ * down the block: every pass is applied to one row as soon as the previous
+ * pass has finished with the rows it depends on, so that a row goes through
+ * all the passes while it is still in L1. Passes acting within a row
+ * (horizontal kinetic, potential) follow the previous pass on the same row,
+ * vertical kinetic passes lag one row behind because they pair a row with
+ * the next one. The radial and rotation passes, which work along whole
+ * columns of the block, are applied between two wavefronts.
+ * Every dot goes through the same operations as in sweep_step, so the results
+ * are identical.
+ */
+enum {
+    PASS_VERTICAL,
+    PASS_HORIZONTAL,
+    PASS_POTENTIAL,
+    PASS_RADIAL,
+    PASS_ROTATION
+};
+
+#define MAX_PASSES 16
+#define WAVEFRONT_ROWS 8
+
+struct BlockPass {
+    int kind;
+    size_t offset;
+};
+
+template<typename real_t>
+struct BlockStep {
+    size_t stride, width, height, tile_width;
+    double aH, bH, aV, bV, coupling_a, coupling_b, coupling_aa;
+    const real_t *radial, *rotation_x, *rotation_y, *potential_x, *potential_y, *external_pot_real, *external_pot_imag, *pb_real, *pb_imag;
+    real_t *real, *imag;
+    const KineticKernels<real_t> *kinetic;
+    const PotentialKernels<real_t> *potential;
+};
+
+// Apply a pass to rows [y, y + rows) of the block
+template<bool imag_time, bool two_wavefunctions, typename real_t>
+static void apply_pass_to_rows(const BlockStep<real_t> &step, const BlockPass &pass, size_t y, size_t rows) {
+    real_t *real = &step.real[y * step.stride];
+    real_t *imag = &step.imag[y * step.stride];
+    switch (pass.kind) {
+    case PASS_VERTICAL:
+        // Pairs starting on these rows, the last row of the block has none
+        if (y + rows == step.height) {
+            --rows;
+        }
+        if (rows > 0) {
+            kinetic_kernel<real_t> vertical = imag_time ? step.kinetic->vertical_imaginary : step.kinetic->vertical;
+            vertical((pass.offset + y) % 2, step.stride, step.width, rows + 1, step.aV, step.bV, real, imag);
+        }
+        break;
+    case PASS_HORIZONTAL: {
+        kinetic_kernel<real_t> horizontal = imag_time ? step.kinetic->horizontal_imaginary : step.kinetic->horizontal;
+        horizontal((pass.offset + y) % 2, step.stride, step.width, rows, step.aH, step.bH, real, imag);
+        break;
+    }
+    case PASS_POTENTIAL:
+        potential_rows<imag_time, two_wavefunctions>(*step.potential, step.stride, step.width, rows, step.coupling_a, step.coupling_b, step.coupling_aa, step.tile_width,
+                step.potential_x, step.potential_y == NULL ? NULL : &step.potential_y[2 * y],
+                entries_from(step.external_pot_real, y * step.tile_width), entries_from(step.external_pot_imag, y * step.tile_width),
+                &step.pb_real[y * step.tile_width], &step.pb_imag[y * step.tile_width], real, imag);
+        break;
+    }
+}
+
+template<bool imag_time, typename real_t>
+static void apply_pass_to_block(const BlockStep<real_t> &step, const BlockPass &pass) {
+    if (pass.kind == PASS_RADIAL) {
+        if (imag_time) {
+            block_kernel_radial_kinetic_imaginary(pass.offset, step.stride, step.width, step.height, step.radial, step.real, step.imag);
+        }
+        else {
+            block_kernel_radial_kinetic(pass.offset, step.stride, step.width, step.height, step.radial, step.real, step.imag);
+        }
+    }
+    else {
+        if (imag_time) {
+            block_kernel_rotation_imaginary(step.stride, step.width, step.height, step.rotation_x, step.rotation_y, step.real, step.imag);
+        }
+        else {
+            block_kernel_rotation(step.stride, step.width, step.height, step.rotation_x, step.rotation_y, step.real, step.imag);
+        }
+    }
+}
+
+template<bool imag_time, bool two_wavefunctions, typename real_t>
+static void run_wavefront(const BlockStep<real_t> &step, const BlockPass *passes, int count) {
+    if (count == 0) {
+        return;
+    }
+    // Pass p works on rows [t - lag[p], t - lag[p] + WAVEFRONT_ROWS) at wavefront position t
+    size_t lag[MAX_PASSES];
+    lag[0] = 0;
+    for (int p = 1; p < count; ++p) {
+        lag[p] = lag[p - 1] + (passes[p].kind == PASS_VERTICAL ? 1 : 0);
+    }
+    for (size_t t = 0; t < step.height + lag[count - 1]; t += WAVEFRONT_ROWS) {
+        for (int p = 0; p < count; ++p) {
+            size_t first = t > lag[p] ? t - lag[p] : 0;
+            size_t last = t + WAVEFRONT_ROWS > lag[p] ? t + WAVEFRONT_ROWS - lag[p] : 0;
+            if (last > step.height) {
+                last = step.height;
+            }
+            if (first < last) {
+                apply_pass_to_rows<imag_time, two_wavefunctions>(step, passes[p], first, last - first);
+            }
+        }
+    }
+}
+
+static void add_pass(BlockPass *passes, int &count, int kind, size_t offset) {
+    passes[count].kind = kind;
+    passes[count].offset = offset;
+    ++count;
+}
+
+template<typename real_t, bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool two_dimensional>
+static void fused_step(size_t stride, size_t width, size_t height,
+                       const real_t *radial, const real_t *rotation_x, const real_t *rotation_y, const real_t *potential_x, const real_t *potential_y,
+                       double aH, double bH, double aV, double bV, double coupling_a, double coupling_b, double coupling_aa,
+                       size_t tile_width, const real_t *external_pot_real, const real_t *external_pot_imag,
+                       const real_t *pb_real, const real_t *pb_imag, real_t * real, real_t * imag,
+                       const KineticKernels<real_t> &kinetic, const PotentialKernels<real_t> &potential) {
+    BlockStep<real_t> step = {stride, width, height, tile_width,
+                      aH, bH, aV, bV, coupling_a, coupling_b, coupling_aa,
+                      radial, rotation_x, rotation_y, potential_x, potential_y, external_pot_real, external_pot_imag, pb_real, pb_imag,
+                      real, imag, &kinetic, &potential
+                     };
+
+    // Splitting sequence, as in sweep_step
+    BlockPass passes[MAX_PASSES];
+    int count = 0;
+    if (two_dimensional) {
+        add_pass(passes, count, PASS_VERTICAL, 0);
+    }
+    add_pass(passes, count, PASS_HORIZONTAL, 0);
+    if (two_dimensional) {
+        add_pass(passes, count, PASS_VERTICAL, 1);
+    }
+    add_pass(passes, count, PASS_HORIZONTAL, 1);
+    if (cylindrical) {
+        add_pass(passes, count, PASS_RADIAL, 0);
+        add_pass(passes, count, PASS_RADIAL, 1);
+    }
+    add_pass(passes, count, PASS_POTENTIAL, 0);
+    if (rotation) {
+        add_pass(passes, count, PASS_ROTATION, 0);
+    }
+    if (cylindrical) {
+        add_pass(passes, count, PASS_RADIAL, 1);
+        add_pass(passes, count, PASS_RADIAL, 0);
+    }
+    add_pass(passes, count, PASS_HORIZONTAL, 1);
+    if (two_dimensional) {
+        add_pass(passes, count, PASS_VERTICAL, 1);
+    }
+    add_pass(passes, count, PASS_HORIZONTAL, 0);
+    if (two_dimensional) {
+        add_pass(passes, count, PASS_VERTICAL, 0);
+    }
+
+    int first = 0;
+    for (int p = 0; p < count; ++p) {
+        if (passes[p].kind == PASS_RADIAL || passes[p].kind == PASS_ROTATION) {
+            run_wavefront<imag_time, two_wavefunctions>(step, &passes[first], p - first);
+            apply_pass_to_block<imag_time>(step, passes[p]);
+            first = p + 1;
+        }
+    }
+    run_wavefront<imag_time, two_wavefunctions>(step, &passes[first], count - first);
+}
+
+template<typename real_t, bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation>
+static block_step<real_t> select_dimension(bool two_dimensional, bool fused) {
+    if (fused) {
+        return two_dimensional ? fused_step<real_t, imag_time, cylindrical, two_wavefunctions, rotation, true>
+               : fused_step<real_t, imag_time, cylindrical, two_wavefunctions, rotation, false>;
+    }
+    return two_dimensional ? sweep_step<real_t, imag_time, cylindrical, two_wavefunctions, rotation, true>
+           : sweep_step<real_t, imag_time, cylindrical, two_wavefunctions, rotation, false>;
+}
+
+template<typename real_t, bool imag_time, bool cylindrical, bool two_wavefunctions>
+static block_step<real_t> select_rotation(bool rotation, bool two_dimensional, bool fused) {
+    return rotation ? select_dimension<real_t, imag_time, cylindrical, two_wavefunctions, true>(two_dimensional, fused)
+           : select_dimension<real_t, imag_time, cylindrical, two_wavefunctions, false>(two_dimensional, fused);
+}
+
+template<typename real_t, bool imag_time, bool cylindrical>
+static block_step<real_t> select_components(bool two_wavefunctions, bool rotation, bool two_dimensional, bool fused) {
+    return two_wavefunctions ? select_rotation<real_t, imag_time, cylindrical, true>(rotation, two_dimensional, fused)
+           : select_rotation<real_t, imag_time, cylindrical, false>(rotation, two_dimensional, fused);
+}
+
+template<typename real_t, bool imag_time>
+static block_step<real_t> select_coordinates(bool cylindrical, bool two_wavefunctions, bool rotation, bool two_dimensional, bool fused) {
+    return cylindrical ? select_components<real_t, imag_time, true>(two_wavefunctions, rotation, two_dimensional, fused)
+           : select_components<real_t, imag_time, false>(two_wavefunctions, rotation, two_dimensional, fused);
+}
+
+template<typename real_t>
+block_step<real_t> get_block_step(bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool two_dimensional, bool fused) {
+    return imag_time ? select_coordinates<real_t, true>(cylindrical, two_wavefunctions, rotation, two_dimensional, fused)
+           : select_coordinates<real_t, false>(cylindrical, two_wavefunctions, rotation, two_dimensional, fused);
+}
+
+template block_step<double> get_block_step<double>(bool, bool, bool, bool, bool, bool);
+template block_step<float> get_block_step<float>(bool, bool, bool, bool, bool, bool);
+
+// Copy a rectangle of width x height values, strides in number of values
+template<typename src_t, typename dest_t>
+static void copy_rectangle(dest_t *dest, size_t dest_stride, const src_t *src, size_t src_stride, size_t width, size_t height) {
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            dest[y * dest_stride + x] = src[y * src_stride + x];
+        }
+    }
+}
+
+template<typename real_t>
+static void copy_rectangle(real_t *dest, size_t dest_stride, const real_t *src, size_t src_stride, size_t width, size_t height) {
+    memcpy2D(dest, dest_stride * sizeof(real_t), src, src_stride * sizeof(real_t), width * sizeof(real_t), height);
+}
+
+// Copy the width x height rectangle at (x, y) of a tile stored in layout to two split arrays
+template<typename src_t, typename dest_t>
+static void gather(const TileLayout &layout, const src_t *real, const src_t *imag, size_t x, size_t y, size_t width, size_t height,
+                   dest_t *dest_real, dest_t *dest_imag, size_t dest_stride) {
+    if (layout.split()) {
+        copy_rectangle(dest_real, dest_stride, &real[layout.index(x, y)], layout.width, width, height);
+        copy_rectangle(dest_imag, dest_stride, &imag[layout.index(x, y)], layout.width, width, height);
+        return;
+    }
+    for (size_t row = 0; row < height; row++) {
+        for (size_t col = 0, run; col < width; col += run) {
+            run = std::min(layout.run(x + col), width - col);
+            const src_t *src_real = &real[layout.index(x + col, y + row)], *src_imag = &imag[layout.index(x + col, y + row)];
+            dest_t *row_real = &dest_real[row * dest_stride + col], *row_imag = &dest_imag[row * dest_stride + col];
+            for (size_t i = 0; i < run; i++) {
+                row_real[i] = src_real[2 * i];
+                row_imag[i] = src_imag[2 * i];
+            }
+        }
+    }
+}
+
+// Copy a rectangle of width x height values with non-temporal stores, strides in number of values
+template<typename src_t, typename dest_t>
+static void stream_rectangle(dest_t *dest, size_t dest_stride, const src_t *src, size_t src_stride, size_t width, size_t height) {
+    copy_rectangle(dest, dest_stride, src, src_stride, width, height);
+}
+
+template<typename real_t>
+static void stream_rectangle(real_t *dest, size_t dest_stride, const real_t *src, size_t src_stride, size_t width, size_t height) {
+    stream2D(dest, dest_stride * sizeof(real_t), src, src_stride * sizeof(real_t), width * sizeof(real_t), height);
+}
+
+// Copy two split arrays to the width x height rectangle at (x, y) of a tile stored in layout,
+// streaming the rows of a split tile to memory if stream is set
+template<typename src_t, typename dest_t>
+static void scatter(const TileLayout &layout, const src_t *src_real, const src_t *src_imag, size_t src_stride,
+                    dest_t *real, dest_t *imag, size_t x, size_t y, size_t width, size_t height, bool stream = false) {
+    if (layout.split() && stream) {
+        stream_rectangle(&real[layout.index(x, y)], layout.width, src_real, src_stride, width, height);
+        stream_rectangle(&imag[layout.index(x, y)], layout.width, src_imag, src_stride, width, height);
+        return;
+    }
+    if (layout.split()) {
+        copy_rectangle(&real[layout.index(x, y)], layout.width, src_real, src_stride, width, height);
+        copy_rectangle(&imag[layout.index(x, y)], layout.width, src_imag, src_stride, width, height);
+        return;
+    }
+    for (size_t row = 0; row < height; row++) {
+        for (size_t col = 0, run; col < width; col += run) {
+            run = std::min(layout.run(x + col), width - col);
+            dest_t *dest_real = &real[layout.index(x + col, y + row)], *dest_imag = &imag[layout.index(x + col, y + row)];
+            const src_t *row_real = &src_real[row * src_stride + col], *row_imag = &src_imag[row * src_stride + col];
+            for (size_t i = 0; i < run; i++) {
+                dest_real[2 * i] = row_real[i];
+                dest_imag[2 * i] = row_imag[i];
+            }
+        }
+    }
+}
+
+// Pairs of a table from the i-th on, NULL if there is no table
+template<typename real_t>
+static inline const real_t *pairs_from(const real_t *table, size_t i) {
+    return table == NULL ? NULL : &table[2 * i];
+}
+
+// Values of one part of a scratch block, rounded up to whole cache lines
+template<typename real_t>
+static size_t scratch_part(size_t block_width, size_t block_height) {
+    size_t line = SCRATCH_ALIGNMENT / sizeof(real_t);
+    return (block_width * block_height + line - 1) / line * line;
+}
+
+// Blocks in a band of a tile: the first block, the inner blocks and the last block, or a single block if the tile is narrow
+static size_t band_blocks(size_t tile_width, size_t block_width, size_t halo_x) {
     if (tile_width <= block_width) {
-        if (sides) {
-            // One full block
-            memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), read_height);
-            memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), read_height);
-            if(imag_time)
-                full_step_imaginary(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                                    &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-            else
-                full_step(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                          &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-            memcpy2D(&next_real[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_real[write_offset * block_width], block_width * sizeof(double), tile_width * sizeof(double), write_height);
-            memcpy2D(&next_imag[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_imag[write_offset * block_width], block_width * sizeof(double), tile_width * sizeof(double), write_height);
+        return 1;
+    }
+    return (tile_width - block_width - 1) / (block_width - 2 * halo_x) + 2;
+}
+
+// Evolve the block-th block of the band read_y..read_y + read_height in the scratch slot of the calling thread.
+// The block is read from the tile, or from the tile and the strips of the previous step when it is evolved in place.
+template<typename real_t>
+void process_block(const TileLayout &layout, const real_t *radial, const real_t *rotation_x, const real_t *rotation_y, const real_t *potential_x, const real_t *potential_y, size_t tile_width, size_t block_width, size_t block_height, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
+                   double aH, double bH, double aV, double bV, double coupling_a, double coupling_b, double coupling_aa, const real_t *external_pot_real, const real_t *external_pot_imag, const real_t * p_real, const real_t * p_imag,
+                   const real_t * pb_real, const real_t * pb_imag, real_t * next_real, real_t * next_imag, bool stream, const ShadowStrips<real_t> *strips, const ScratchArena &scratch, size_t block, block_step<real_t> step, const KineticKernels<real_t> &kinetic, const PotentialKernels<real_t> &potential) {
+    // Scratch block of the calling thread, the imaginary part starting on a cache line of its own
+    real_t *block_real = static_cast<real_t *>(scratch.slot());
+    real_t *block_imag = block_real + scratch_part<real_t>(block_width, block_height);
+    size_t blocks = band_blocks(tile_width, block_width, halo_x);
+
+    // Columns read by the block and columns written back: the first and the last blocks also write the halos of the tile
+    size_t block_start = 0, read_width = tile_width, write_x = 0, write_width = tile_width;
+    if (blocks > 1) {
+        block_start = block * (block_width - 2 * halo_x);
+        read_width = block == blocks - 1 ? tile_width - block_start : block_width;
+        write_x = block == 0 ? 0 : halo_x;
+        write_width = (block == blocks - 1 ? read_width : read_width - halo_x) - write_x;
+    }
+    if (strips == NULL) {
+        gather(layout, p_real, p_imag, block_start, read_y, read_width, read_height, block_real, block_imag, block_width);
+    }
+    else {
+        strips->load(layout, p_real, p_imag, block, block_start, read_y, read_width, read_height, write_x, write_offset, write_width, write_height, block_real, block_imag, block_width);
+    }
+    step(block_width, read_width, read_height, &radial[3 * block_start], &rotation_x[2 * block_start], &rotation_y[2 * read_y], pairs_from(potential_x, block_start), pairs_from(potential_y, read_y), aH, bH, aV, bV, coupling_a, coupling_b, coupling_aa, tile_width,
+         entries_from(external_pot_real, read_y * tile_width + block_start), entries_from(external_pot_imag, read_y * tile_width + block_start), &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, kinetic, potential);
+    scatter(layout, &block_real[write_offset * block_width + write_x], &block_imag[write_offset * block_width + write_x], block_width, next_real, next_imag, block_start + write_x, read_y + write_offset, write_width, write_height, stream);
+}
+
+/*
+ * Precision of the CPU kernel.
+ *
+ * CPUBlock<double, double> evolves the buffers of the states and of the
+ * potentials in place. The single precision instances work on float copies:
+ * the states are converted when the kernel is built, the potentials whenever
+ * they are updated, and get_sample converts the result back to double.
+ */
+#ifdef HAVE_MPI
+template<typename real_t> static MPI_Datatype mpi_type();
+
+template<> MPI_Datatype mpi_type<double>() {
+    return MPI_DOUBLE;
+}
+
+template<> MPI_Datatype mpi_type<float>() {
+    return MPI_FLOAT;
+}
+#endif
+
+// Point buffer to values for the double kernel
+static void import_tile(double *&buffer, double *values, size_t size, size_t rows, double scale = 1.) {
+    buffer = values;
+}
+
+// Convert values, multiplied by scale, into buffer for the float kernels, allocating it on first use as a grid of rows rows
+static void import_tile(float *&buffer, double *values, size_t size, size_t rows, double scale = 1.) {
+    if (buffer == NULL) {
+        buffer = new_grid<float>(size, rows);
+    }
+    #pragma omp parallel for
+    for (int i = 0; i < int(size); i++) {
+        buffer[i] = scale * values[i];
+    }
+}
+
+/*
+ * In real time every kinetic pass rotates the pairs by (a, b) rounded to
+ * real_t, which multiplies the squared norm by a^2 + b^2 instead of 1. In
+ * single precision the error is a few 1e-8 per pass and always of the same
+ * sign, so the norm would drift steadily. The float kernels cancel it by
+ * folding the inverse factor into the converted potential, which every dot
+ * goes through once per step.
+ */
+template<typename real_t>
+static double rounded_rotation_norm(double a, double b) {
+    // volatile keeps -ffast-math from folding the round trip away
+    volatile real_t rounded_a = a, rounded_b = b;
+    return double(rounded_a) * double(rounded_a) + double(rounded_b) * double(rounded_b);
+}
+
+template<typename real_t>
+static double potential_scale(bool imag_time, bool two_dimensional, double aH, double bH, double aV, double bV) {
+    if (imag_time) {
+        return 1.;
+    }
+    // Four horizontal and four vertical passes per step
+    double norm_factor = pow(rounded_rotation_norm<real_t>(aH, bH), 4);
+    if (two_dimensional) {
+        norm_factor *= pow(rounded_rotation_norm<real_t>(aV, bV), 4);
+    }
+    return 1. / sqrt(norm_factor);
+}
+
+static void release_tile(double *buffer) {
+}
+
+static void release_tile(float *buffer) {
+    free_grid(buffer);
+}
+
+// Whether import_tile converts the values into a buffer of the kernel, rather than pointing to them
+static bool converted_tile(const double *buffer) {
+    return false;
+}
+
+static bool converted_tile(const float *buffer) {
+    return true;
+}
+
+// Import a table of the operator of the potential, or drop the converted copy when there is no table
+template<typename real_t>
+static void import_potential(real_t *&buffer, double *values, size_t size, size_t rows, double scale) {
+    if (values == NULL) {
+        release_tile(buffer);
+        buffer = NULL;
+        return;
+    }
+    import_tile(buffer, values, size, rows, scale);
+}
+
+TileLayout::TileLayout(string _name, size_t _width, size_t _height):
+    name(_name), width(_width), height(_height) {
+    if (name == "split") {
+        kind = SPLIT;
+    }
+    else if (name == "interleaved") {
+        kind = INTERLEAVED;
+    }
+    else if (name == "tiled") {
+        kind = TILED;
+    }
+    else {
+        my_abort("Unknown memory layout: " + name);
+    }
+    tiles_x = (width + TILE_SIDE - 1) / TILE_SIDE;
+}
+
+size_t TileLayout::size() const {
+    switch (kind) {
+    case INTERLEAVED:
+        return 2 * width * height;
+    case TILED:
+        return 2 * tiles_x * ((height + TILE_SIDE - 1) / TILE_SIDE) * TILE_SIDE * TILE_SIDE;
+    default:
+        return width * height;
+    }
+}
+
+ScratchArena::ScratchArena():
+    memory(NULL), slot_size(0), slot_count(0) {
+}
+
+ScratchArena::~ScratchArena() {
+    free_grid(memory);
+}
+
+void ScratchArena::reserve(size_t bytes) {
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    bytes = (bytes + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT;
+    if (bytes <= slot_size && threads <= slot_count) {
+        return;
+    }
+    slot_size = std::max(bytes, slot_size);
+    slot_count = std::max(threads, slot_count);
+    free_grid(memory);
+    memory = new_grid<char>(slot_size * slot_count, slot_count);
+}
+
+BlockSchedule::BlockSchedule():
+    tasks(NULL), task_count(0), cursors(NULL), ends(NULL), thread_count(0) {
+}
+
+BlockSchedule::~BlockSchedule() {
+    delete [] tasks;
+    delete [] cursors;
+    delete [] ends;
+}
+
+void BlockSchedule::plan(size_t capacity) {
+    delete [] tasks;
+    tasks = new BlockTask[std::max(capacity, size_t(1))];
+    task_count = 0;
+}
+
+void BlockSchedule::add(size_t read_y, size_t read_height, size_t write_offset, size_t write_height, size_t block) {
+    BlockTask task = {read_y, read_height, write_offset, write_height, block};
+    tasks[task_count++] = task;
+}
+
+void BlockSchedule::reserve_threads() {
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    if (threads <= thread_count) {
+        return;
+    }
+    thread_count = threads;
+    delete [] cursors;
+    delete [] ends;
+    cursors = new int[thread_count * CURSOR_STRIDE];
+    ends = new int[thread_count * CURSOR_STRIDE];
+}
+
+void BlockSchedule::start(int thread, int threads) {
+    cursors[thread * CURSOR_STRIDE] = int(long(task_count) * thread / threads);
+    ends[thread * CURSOR_STRIDE] = int(long(task_count) * (thread + 1) / threads);
+}
+
+template<typename real_t>
+ShadowStrips<real_t>::ShadowStrips():
+    tile_width(0), tile_height(0), halo_x(0), halo_y(0), band_step(1), row_boundaries(0), block_step(1), column_boundaries(0) {
+    for (int i = 0; i < 2; i++) {
+        rows[i] = NULL;
+        columns[i] = NULL;
+    }
+}
+
+template<typename real_t>
+ShadowStrips<real_t>::~ShadowStrips() {
+    for (int i = 0; i < 2; i++) {
+        free_grid(rows[i]);
+        free_grid(columns[i]);
+    }
+}
+
+template<typename real_t>
+void ShadowStrips<real_t>::plan(size_t _tile_width, size_t _tile_height, size_t _halo_x, size_t _halo_y, size_t _band_step, size_t _row_boundaries, size_t _block_step, size_t _column_boundaries) {
+    tile_width = _tile_width;
+    tile_height = _tile_height;
+    halo_x = _halo_x;
+    halo_y = _halo_y;
+    band_step = _band_step;
+    row_boundaries = halo_y == 0 ? 0 : _row_boundaries;
+    block_step = _block_step;
+    column_boundaries = _column_boundaries;
+    for (int i = 0; i < 2; i++) {
+        free_grid(rows[i]);
+        free_grid(columns[i]);
+        rows[i] = NULL;
+        columns[i] = NULL;
+        if (row_boundaries > 0) {
+            rows[i] = new_grid<real_t>(2 * halo_y * tile_width * row_boundaries, 2 * halo_y * row_boundaries);
+        }
+        if (column_boundaries > 0) {
+            columns[i] = new_grid<real_t>(2 * halo_x * column_boundaries * tile_height, tile_height);
+        }
+    }
+}
+
+template<typename real_t>
+void ShadowStrips<real_t>::save(const TileLayout &layout, const real_t *real, const real_t *imag) {
+    size_t column_width = 2 * halo_x * column_boundaries;
+    #pragma omp parallel
+    {
+        #pragma omp for nowait
+        for (int y = 0; y < int(tile_height); y++) {
+            for (size_t j = 0; j < column_boundaries; j++) {
+                gather(layout, real, imag, (j + 1) * block_step, y, 2 * halo_x, 1, &columns[0][y * column_width + 2 * halo_x * j], &columns[1][y * column_width + 2 * halo_x * j], column_width);
+            }
+        }
+        #pragma omp for
+        for (int k = 0; k < int(row_boundaries); k++) {
+            size_t offset = 2 * halo_y * tile_width * k;
+            gather(layout, real, imag, 0, (k + 1) * band_step, tile_width, 2 * halo_y, &rows[0][offset], &rows[1][offset], tile_width);
+        }
+    }
+}
+
+/*
+ * The band at row y is the (y / band_step)-th one: the halo_y rows above the
+ * ones it writes are the upper half of the strip across the boundary with
+ * the previous band, the halo_y rows below are the lower half of the strip
+ * across the boundary with the next band. The columns on the left and on the
+ * right of the block are found in the same way in the column strips.
+ */
+template<typename real_t>
+void ShadowStrips<real_t>::load(const TileLayout &layout, const real_t *real, const real_t *imag, size_t block, size_t x, size_t y, size_t width, size_t height,
+                                size_t write_x, size_t write_y, size_t write_width, size_t write_height, real_t *dest_real, real_t *dest_imag, size_t dest_stride) const {
+    size_t band = y / band_step, column_width = 2 * halo_x * column_boundaries;
+    size_t write_bottom = write_y + write_height, write_right = write_x + write_width;
+    if (write_y > 0) {
+        size_t offset = 2 * halo_y * tile_width * (band - 1) + x;
+        copy_rectangle(dest_real, dest_stride, &rows[0][offset], tile_width, width, write_y);
+        copy_rectangle(dest_imag, dest_stride, &rows[1][offset], tile_width, width, write_y);
+    }
+    if (write_bottom < height) {
+        size_t offset = (2 * halo_y * band + halo_y) * tile_width + x;
+        copy_rectangle(&dest_real[write_bottom * dest_stride], dest_stride, &rows[0][offset], tile_width, width, height - write_bottom);
+        copy_rectangle(&dest_imag[write_bottom * dest_stride], dest_stride, &rows[1][offset], tile_width, width, height - write_bottom);
+    }
+    gather(layout, real, imag, x + write_x, y + write_y, write_width, write_height, &dest_real[write_y * dest_stride + write_x], &dest_imag[write_y * dest_stride + write_x], dest_stride);
+    if (write_x > 0) {
+        size_t offset = (y + write_y) * column_width + 2 * halo_x * (block - 1);
+        copy_rectangle(&dest_real[write_y * dest_stride], dest_stride, &columns[0][offset], column_width, write_x, write_height);
+        copy_rectangle(&dest_imag[write_y * dest_stride], dest_stride, &columns[1][offset], column_width, write_x, write_height);
+    }
+    if (write_right < width) {
+        size_t offset = (y + write_y) * column_width + 2 * halo_x * block + halo_x;
+        copy_rectangle(&dest_real[write_y * dest_stride + write_right], dest_stride, &columns[0][offset], column_width, width - write_right, write_height);
+        copy_rectangle(&dest_imag[write_y * dest_stride + write_right], dest_stride, &columns[1][offset], column_width, width - write_right, write_height);
+    }
+}
+
+template<typename real_t>
+string ShadowStrips<real_t>::placement() const {
+    stringstream placement;
+    const char *parts[2] = {"real", "imaginary"};
+    for (int i = 0; i < 2; i++) {
+        if (rows[i] != NULL) {
+            placement << "kernel strips of the rows " << parts[i] << ": " << numa_placement(rows[i], 2 * halo_y * tile_width * row_boundaries * sizeof(real_t)) << endl;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (columns[i] != NULL) {
+            placement << "kernel strips of the columns " << parts[i] << ": " << numa_placement(columns[i], 2 * halo_x * column_boundaries * tile_height * sizeof(real_t)) << endl;
+        }
+    }
+    return placement.str();
+}
+
+/*
+ * Wave function buffers in a memory layout.
+ *
+ * In the split layout the buffers of the current time step are imported
+ * with import_tile, so that the double kernel keeps evolving the arrays of
+ * the state. The other layouts allocate one buffer per time step, holding
+ * both parts, and convert the state into it. A wave function evolved in
+ * place has a single buffer, pointed to for both time steps.
+ */
+template<typename real_t>
+static void import_state(const TileLayout &layout, State *state, real_t *real[2], real_t *imag[2], bool in_place) {
+    if (layout.split()) {
+        real[0] = NULL;
+        imag[0] = NULL;
+        import_tile(real[0], state->p_real, layout.size(), layout.height);
+        import_tile(imag[0], state->p_imag, layout.size(), layout.height);
+        if (in_place) {
+            real[1] = real[0];
+            imag[1] = imag[0];
+            return;
         }
+        real[1] = new_grid<real_t>(layout.size(), layout.height);
+        imag[1] = new_grid<real_t>(layout.size(), layout.height);
+        memcpy(real[1], real[0], layout.size() * sizeof(real_t));
+        memcpy(imag[1], imag[0], layout.size() * sizeof(real_t));
     }
     else {
-        if (sides) {
-            process_sides(two_wavefunctions, offset_tile_x, offset_tile_y, alpha_x, alpha_y, tile_width, block_width, halo_x, read_y, read_height, write_offset, write_height, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, external_pot_real, external_pot_imag, p_real, p_imag, pb_real, pb_imag, next_real, next_imag, block_real, block_imag, imag_time, coordinate_system);
-        }
-        if (inner) {
-            for (size_t block_start = block_width - 2 * halo_x; block_start < tile_width - block_width; block_start += block_width - 2 * halo_x) {
-                memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width + block_start], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-                memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width + block_start], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-                if(imag_time)
-                    full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                                        &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-                else
-                    full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                              &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-                memcpy2D(&next_real[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_real[write_offset * block_width + halo_x], block_width * sizeof(double), (block_width - 2 * halo_x) * sizeof(double), write_height);
-                memcpy2D(&next_imag[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_imag[write_offset * block_width + halo_x], block_width * sizeof(double), (block_width - 2 * halo_x) * sizeof(double), write_height);
+        for (int i = 0; i < 2; i++) {
+            if (in_place && i == 1) {
+                real[1] = real[0];
+                imag[1] = imag[0];
+                break;
             }
+            real[i] = new_grid<real_t>(layout.size(), layout.height);
+            imag[i] = real[i] + 1;
+            scatter(layout, state->p_real, state->p_imag, layout.width, real[i], imag[i], 0, 0, layout.width, layout.height);
         }
     }
+}
 
+template<typename real_t>
+static void release_state(const TileLayout &layout, real_t *real[2], real_t *imag[2]) {
+    bool in_place = real[1] == real[0];
+    if (layout.split()) {
+        release_tile(real[0]);
+        release_tile(imag[0]);
+        if (!in_place) {
+            free_grid(real[1]);
+            free_grid(imag[1]);
+        }
+    }
+    else {
+        free_grid(real[0]);
+        if (!in_place) {
+            free_grid(real[1]);
+        }
+    }
+}
+
+// Copy the width x height rectangle at (src_x, src_y) of a tile stored in src_layout to (dest_x, dest_y) of a tile stored in dest_layout
+template<typename real_t>
+static void copy_between_tiles(const TileLayout &src_layout, const real_t *src_real, const real_t *src_imag, size_t src_x, size_t src_y,
+                               const TileLayout &dest_layout, real_t *dest_real, real_t *dest_imag, size_t dest_x, size_t dest_y, size_t width, size_t height) {
+    if (src_layout.split()) {
+        memcpy2D(&dest_real[dest_layout.index(dest_x, dest_y)], dest_layout.width * sizeof(real_t), &src_real[src_layout.index(src_x, src_y)], src_layout.width * sizeof(real_t), width * sizeof(real_t), height);
+        memcpy2D(&dest_imag[dest_layout.index(dest_x, dest_y)], dest_layout.width * sizeof(real_t), &src_imag[src_layout.index(src_x, src_y)], src_layout.width * sizeof(real_t), width * sizeof(real_t), height);
+        return;
+    }
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            dest_real[dest_layout.index(dest_x + x, dest_y + y)] = src_real[src_layout.index(src_x + x, src_y + y)];
+            dest_imag[dest_layout.index(dest_x + x, dest_y + y)] = src_imag[src_layout.index(src_x + x, src_y + y)];
+        }
+    }
+}
 
-    delete[] block_real;
-    delete[] block_imag;
+// Copy the width x height rectangle at (src_x, src_y) of a tile stored in layout to (dest_x, dest_y)
+template<typename real_t>
+static void copy_region(const TileLayout &layout, real_t *real, real_t *imag, size_t src_x, size_t src_y, size_t dest_x, size_t dest_y, size_t width, size_t height) {
+    copy_between_tiles(layout, real, imag, src_x, src_y, layout, real, imag, dest_x, dest_y, width, height);
+}
+
+// Apply a Rabi coupling kernel to two tiles stored in layout, going through split rows if the layout is not split
+template<typename real_t>
+static void rabi_coupling_tile(const TileLayout &layout, const ScratchArena &scratch, void (*kernel)(size_t, size_t, size_t, double, double, double, real_t *, real_t *, real_t *, real_t *),
+                               double cc, double cs_r, double cs_i, real_t *p_real, real_t *p_imag, real_t *pb_real, real_t *pb_imag) {
+    if (layout.split()) {
+        kernel(layout.width, layout.width, layout.height, cc, cs_r, cs_i, p_real, p_imag, pb_real, pb_imag);
+        return;
+    }
+    size_t width = layout.width;
+    #pragma omp parallel
+    {
+        real_t *rows = static_cast<real_t *>(scratch.slot());
+        #pragma omp for
+        for (int y = 0; y < int(layout.height); y++) {
+            gather(layout, p_real, p_imag, 0, y, width, 1, rows, rows + width, width);
+            gather(layout, pb_real, pb_imag, 0, y, width, 1, rows + 2 * width, rows + 3 * width, width);
+            kernel(width, width, 1, cc, cs_r, cs_i, rows, rows + width, rows + 2 * width, rows + 3 * width);
+            scatter(layout, rows, rows + width, width, p_real, p_imag, 0, y, width, 1);
+            scatter(layout, rows + 2 * width, rows + 3 * width, width, pb_real, pb_imag, 0, y, width, 1);
+        }
+    }
+}
+
+#ifdef HAVE_MPI
+// Datatype of the width x height rectangle at (x, y) of a tile stored in layout, with displacements from the index of (x, y)
+template<typename real_t>
+static MPI_Datatype halo_datatype(const TileLayout &layout, size_t x, size_t y, size_t width, size_t height) {
+    MPI_Datatype type;
+    if (layout.split()) {
+        MPI_Type_vector(height, width, layout.width, mpi_type<real_t>(), &type);
+    }
+    else {
+        int *displacements = new int[width * height];
+        for (size_t row = 0; row < height; row++) {
+            for (size_t col = 0; col < width; col++) {
+                displacements[row * width + col] = layout.index(x + col, y + row) - layout.index(x, y);
+            }
+        }
+        MPI_Type_create_indexed_block(width * height, 1, displacements, mpi_type<real_t>(), &type);
+        delete [] displacements;
+    }
+    MPI_Type_commit(&type);
+    return type;
+}
+#endif
+
+// Whether the halos are exchanged in shared memory, which only has a meaning under MPI
+static bool shares_halos(const string &halo_exchange) {
+#ifdef HAVE_MPI
+    return halo_exchange == "shared";
+#else
+    return false;
+#endif
 }
 
 // Class methods
-CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
-                   double *_external_pot_real, double *_external_pot_imag,
-                   double delta_t, double _norm, bool _imag_time):
+template<typename real_t, typename accum_t>
+CPUBlock<real_t, accum_t>::CPUBlock(Lattice *grid, State *state, Hamiltonian *_hamiltonian,
+                                    double *_external_pot_real, double *_external_pot_imag,
+                                    double delta_t, double _norm, bool _imag_time, string phase_accuracy, string memory_layout,
+                                    size_t _block_width, size_t _block_height, bool _in_place, string halo_exchange):
+    hamiltonian(_hamiltonian),
+    in_place(_in_place),
+    exchange_corners(halo_exchange != "phases"),
+    shared_halos(shares_halos(halo_exchange)),
     sense(0),
     state_index(0),
     imag_time(_imag_time) {
@@ -179,11 +911,11 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     delta_y = grid->delta_y;
     halo_x = grid->halo_x;
     halo_y = grid->halo_y;
+    block_halo_x = halo_x / grid->exchange_interval;
+    block_halo_y = halo_y / grid->exchange_interval;
     periods = grid->periods;
     rot_coord_x = hamiltonian->rot_coord_x;
     rot_coord_y = hamiltonian->rot_coord_y;
-    alpha_x = hamiltonian->angular_velocity * delta_t * grid->delta_x / (2 * grid->delta_y);
-    alpha_y = hamiltonian->angular_velocity * delta_t * grid->delta_y / (2 * grid->delta_x);
     coupling_const = new double [3];
     LeeHuangYang_coupling = new double [2];
     norm = new double [1];
@@ -192,44 +924,17 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     aV = new double [1];
     bV = new double [1];
     kin_radial = new double [1];
-    if (imag_time) {
-        aH[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aV[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-        }
-    }
-    else {
-        aH[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aV[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-        }
-    }
-    coupling_const[0] = hamiltonian->coupling_a * delta_t;
-    coupling_const[1] = 0.;
-    coupling_const[2] = 0.;
-    LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
-    LeeHuangYang_coupling[1] = 0;
     norm[0] = _norm;
     tot_norm = norm[0];
     coordinate_system = grid->coordinate_system;
     angular_momentum[0] = state->angular_momentum;
+    two_wavefunctions = false;
 #ifdef HAVE_MPI
     cartcomm = grid->cartcomm;
-    MPI_Cart_shift(cartcomm, 0, 1, &neighbors[UP], &neighbors[DOWN]);
-    MPI_Cart_shift(cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
+    norm_request = MPI_REQUEST_NULL;
 #endif
-    if (halo_y == 0) {
-        block_height = 1;
-    }
-    else {
-        block_height = BLOCK_HEIGHT_CACHE;
-    }
+    norm_sum = 0.;
+    set_block_size(_block_width, _block_height);
     start_x = grid->start_x;
     end_x = grid->end_x;
     inner_start_x = grid->inner_start_x;
@@ -240,41 +945,51 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     inner_end_y = grid->inner_end_y;
     tile_width = end_x - start_x;
     tile_height = end_y - start_y;
+    rotation_x = new real_t[2 * tile_width];
+    rotation_y = new real_t[2 * tile_height];
+    radial[0] = new real_t[3 * tile_width]();
+    radial[1] = NULL;
+    pot_scale[1] = 1.;
+    set_coefficients(delta_t);
 
-    p_real[0][0] = state->p_real;
-    p_imag[0][0] = state->p_imag;
-    p_real[0][1] = new double[tile_width * tile_height];
-    p_imag[0][1] = new double[tile_width * tile_height];
+    layout = TileLayout(memory_layout, tile_width, tile_height);
+    import_state(layout, state, p_real[0], p_imag[0], in_place);
     p_real[1][0] = NULL;
     p_imag[1][0] = NULL;
     p_real[1][1] = NULL;
     p_imag[1][1] = NULL;
-    external_pot_real[0] = _external_pot_real;
-    external_pot_imag[0] = _external_pot_imag;
-    two_wavefunctions = false;
+    for (int i = 0; i < 2; i++) {
+        external_pot_real[i] = NULL;
+        external_pot_imag[i] = NULL;
+        potential_x[i] = NULL;
+        potential_y[i] = NULL;
+    }
+    // A separable potential is passed to update_separable_potential afterwards
+    update_potential(_external_pot_real, _external_pot_imag, 0);
+    pb_real = NULL;
+    pb_imag = NULL;
+    kinetic_kernels = select_kinetic_kernels<real_t>();
+    potential_kernels = get_potential_kernels<real_t>(phase_accuracy);
+    step = get_block_step<real_t>(imag_time, coordinate_system == "cylindrical", two_wavefunctions, alpha_x != 0. && alpha_y != 0., halo_y != 0);
+    plan_blocks();
+    reserve_scratch();
 
 #ifdef HAVE_MPI
-    // Halo exchange uses wave pattern to communicate
-    // halo_x-wide inner rows are sent first to left and right
-    // Then full length rows are exchanged to the top and bottom
-    int count = inner_end_y - inner_start_y;  // The number of rows in the halo submatrix
-    int block_length = halo_x;  // The number of columns in the halo submatrix
-    int stride = tile_width;  // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &verticalBorder);
-    MPI_Type_commit (&verticalBorder);
-
-    count = halo_y; // The vertical halo in rows
-    block_length = tile_width;  // The number of columns of the matrix
-    stride = tile_width;  // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
-    MPI_Type_commit (&horizontalBorder);
+    share_tiles();
+    plan_halo_exchange();
 #endif
 }
 
-CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
-                   Hamiltonian2Component *hamiltonian,
-                   double **_external_pot_real, double **_external_pot_imag,
-                   double delta_t, double *_norm, bool _imag_time):
+template<typename real_t, typename accum_t>
+CPUBlock<real_t, accum_t>::CPUBlock(Lattice *grid, State *state1, State *state2,
+                                    Hamiltonian2Component *_hamiltonian,
+                                    double **_external_pot_real, double **_external_pot_imag,
+                                    double delta_t, double *_norm, bool _imag_time, string phase_accuracy, string memory_layout,
+                                    size_t _block_width, size_t _block_height, bool _in_place, string halo_exchange):
+    hamiltonian(_hamiltonian),
+    in_place(_in_place),
+    exchange_corners(halo_exchange != "phases"),
+    shared_halos(shares_halos(halo_exchange)),
     sense(0),
     state_index(0),
     imag_time(_imag_time) {
@@ -282,8 +997,8 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     delta_y = grid->delta_y;
     halo_x = grid->halo_x;
     halo_y = grid->halo_y;
-    alpha_x = hamiltonian->angular_velocity * delta_t * grid->delta_x / (2 * grid->delta_y),
-    alpha_y = hamiltonian->angular_velocity * delta_t * grid->delta_y / (2 * grid->delta_x),
+    block_halo_x = halo_x / grid->exchange_interval;
+    block_halo_y = halo_y / grid->exchange_interval;
     rot_coord_x = hamiltonian->rot_coord_x;
     rot_coord_y = hamiltonian->rot_coord_y;
     aH = new double [2];
@@ -291,62 +1006,23 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     aV = new double [2];
     bV = new double [2];
     kin_radial = new double [2];
-    if (imag_time) {
-        aH[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aH[1] = cosh(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        bH[1] = sinh(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        aV[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        aV[1] = cosh(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        bV[1] = sinh(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-            kin_radial[1] = delta_t / (8. * hamiltonian->mass_b * grid->delta_x * grid->delta_x);
-        }
-    }
-    else {
-        aH[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aH[1] = cos(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        bH[1] = sin(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        aV[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        aV[1] = cos(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        bV[1] = sin(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-            kin_radial[1] = delta_t / (8. * hamiltonian->mass_b * grid->delta_x * grid->delta_x);
-        }
-    }
     norm = new double [2];
     norm[0] = _norm[0];
     norm[1] = _norm[1];
     tot_norm = norm[0] + norm[1];
     coupling_const = new double[5];
-    coupling_const[0] = delta_t * hamiltonian->coupling_a;
-    coupling_const[1] = delta_t * hamiltonian->coupling_b;
-    coupling_const[2] = delta_t * hamiltonian->coupling_ab;
-    coupling_const[3] = 0.5 * hamiltonian->omega_r;
-    coupling_const[4] = 0.5 * hamiltonian->omega_i;
     LeeHuangYang_coupling = new double [2];
-    // LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
-    // LeeHuangYang_coupling[1] = hamiltonian->LeeHuangYang_coupling_b  * delta_t;
     periods = grid->periods;
     coordinate_system = grid->coordinate_system;
     angular_momentum[0] = state1->angular_momentum;
     angular_momentum[1] = state2->angular_momentum;
+    two_wavefunctions = true;
 #ifdef HAVE_MPI
     cartcomm = grid->cartcomm;
-    MPI_Cart_shift(cartcomm, 0, 1, &neighbors[UP], &neighbors[DOWN]);
-    MPI_Cart_shift(cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
+    norm_request = MPI_REQUEST_NULL;
 #endif
-    if (halo_y == 0) {
-        block_height = 1;
-    }
-    else {
-        block_height = BLOCK_HEIGHT_CACHE;
-    }
+    norm_sum = 0.;
+    set_block_size(_block_width, _block_height);
 
     start_x = grid->start_x;
     end_x = grid->end_x;
@@ -358,206 +1034,680 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     inner_end_y = grid->inner_end_y;
     tile_width = end_x - start_x;
     tile_height = end_y - start_y;
-    p_real[0][0] = state1->p_real;
-    p_imag[0][0] = state1->p_imag;
-    p_real[1][0] = state2->p_real;
-    p_imag[1][0] = state2->p_imag;
+    rotation_x = new real_t[2 * tile_width];
+    rotation_y = new real_t[2 * tile_height];
+    radial[0] = new real_t[3 * tile_width]();
+    radial[1] = new real_t[3 * tile_width]();
+    set_coefficients(delta_t);
+    State *states[2] = {state1, state2};
+    layout = TileLayout(memory_layout, tile_width, tile_height);
 
     for(int i = 0; i < 2; i++) {
-        p_real[i][1] = new double[tile_width * tile_height];
-        p_imag[i][1] = new double[tile_width * tile_height];
-        memcpy2D(p_real[i][1], tile_width * sizeof(double), p_real[i][0], tile_width * sizeof(double), tile_width * sizeof(double), tile_height);
-        memcpy2D(p_imag[i][1], tile_width * sizeof(double), p_imag[i][0], tile_width * sizeof(double), tile_width * sizeof(double), tile_height);
-        external_pot_real[i] = _external_pot_real[i];
-        external_pot_imag[i] = _external_pot_imag[i];
+        // The second wave function reads the first one at the previous time step, which has to be kept
+        import_state(layout, states[i], p_real[i], p_imag[i], in_place && i == 1);
+        external_pot_real[i] = NULL;
+        external_pot_imag[i] = NULL;
+        potential_x[i] = NULL;
+        potential_y[i] = NULL;
+        update_potential(_external_pot_real[i], _external_pot_imag[i], i);
     }
-    two_wavefunctions = true;
+    pb_real = NULL;
+    pb_imag = NULL;
+    if (!layout.split()) {
+        pb_real = new_grid<real_t>(tile_width * tile_height, tile_height);
+        pb_imag = new_grid<real_t>(tile_width * tile_height, tile_height);
+    }
+    kinetic_kernels = select_kinetic_kernels<real_t>();
+    potential_kernels = get_potential_kernels<real_t>(phase_accuracy);
+    step = get_block_step<real_t>(imag_time, coordinate_system == "cylindrical", two_wavefunctions, alpha_x != 0. && alpha_y != 0., halo_y != 0);
+    plan_blocks();
+    reserve_scratch();
 
 #ifdef HAVE_MPI
-    // Halo exchange uses wave pattern to communicate
-    // halo_x-wide inner rows are sent first to left and right
-    // Then full length rows are exchanged to the top and bottom
-    int count = inner_end_y - inner_start_y;    // The number of rows in the halo submatrix
-    int block_length = halo_x;  // The number of columns in the halo submatrix
-    int stride = tile_width;    // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &verticalBorder);
-    MPI_Type_commit (&verticalBorder);
-
-    count = halo_y; // The vertical halo in rows
-    block_length = tile_width;  // The number of columns of the matrix
-    stride = tile_width;    // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
-    MPI_Type_commit (&horizontalBorder);
+    share_tiles();
+    plan_halo_exchange();
 #endif
 }
 
-void CPUBlock::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
-    external_pot_real[which] = _external_pot_real;
-    external_pot_imag[which] = _external_pot_imag;
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
+    import_potential(external_pot_real[which], _external_pot_real, tile_width * tile_height, tile_height, pot_scale[which]);
+    import_potential(external_pot_imag[which], _external_pot_imag, tile_width * tile_height, tile_height, pot_scale[which]);
+    delete [] potential_x[which];
+    delete [] potential_y[which];
+    potential_x[which] = NULL;
+    potential_y[which] = NULL;
+    // Without a potential the potential kernels skip the multiplication, unless the float kernels need their scale: then it is a uniform separable factor
+    if (_external_pot_real == NULL && pot_scale[which] != 1.) {
+        potential_x[which] = new real_t[2 * tile_width];
+        potential_y[which] = new real_t[2 * tile_height];
+        for (size_t x = 0; x < tile_width; x++) {
+            potential_x[which][2 * x] = pot_scale[which];
+            potential_x[which][2 * x + 1] = 0.;
+        }
+        for (size_t y = 0; y < tile_height; y++) {
+            potential_y[which][2 * y] = 1.;
+            potential_y[which][2 * y + 1] = 0.;
+        }
+    }
+}
+
+// The factors are stored as pairs, like the rotation coefficients; the scale of the float kernels goes into the factor along x
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::update_separable_potential(const double *pot_x_real, const double *pot_x_imag, const double *pot_y_real, const double *pot_y_imag, int which) {
+    if (potential_x[which] == NULL) {
+        potential_x[which] = new real_t[2 * tile_width];
+        potential_y[which] = new real_t[2 * tile_height];
+    }
+    for (size_t x = 0; x < tile_width; x++) {
+        potential_x[which][2 * x] = pot_scale[which] * pot_x_real[x];
+        potential_x[which][2 * x + 1] = pot_scale[which] * pot_x_imag[x];
+    }
+    for (size_t y = 0; y < tile_height; y++) {
+        potential_y[which][2 * y] = pot_y_real[y];
+        potential_y[which][2 * y + 1] = pot_y_imag[y];
+    }
+    release_tile(external_pot_real[which]);
+    release_tile(external_pot_imag[which]);
+    external_pot_real[which] = NULL;
+    external_pot_imag[which] = NULL;
+}
+
+// A block reaches over the halos on both sides and has to leave rows and columns to write; on one-dimensional lattices it is a single row
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::set_block_size(size_t width, size_t height) {
+    if (halo_y == 0) {
+        height = 1;
+    }
+    // The blocks start on even dots, or they would pair the dots of the kinetic steps differently from the tile
+    if (width <= 2 * block_halo_x || width > BLOCK_WIDTH_MAX || width % 2 != 0 || (halo_y != 0 && (height <= 2 * block_halo_y || height % 2 != 0))) {
+        stringstream message;
+        message << "Invalid block size " << width << "x" << height << ": the blocks have to be even, larger than twice the halos of a time step ("
+                << block_halo_x << "x" << block_halo_y << ") and at most " << BLOCK_WIDTH_MAX << " dots wide.";
+        my_abort(message.str());
+    }
+    block_width = width;
+    block_height = height;
+}
+
+// A thread evolves a block in its slot, and the Rabi coupling goes through four rows of the tile there in a layout that is not split.
+// The slots are reserved again before every parallel region in case the number of threads grew.
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::reserve_scratch() {
+    size_t bytes = 2 * scratch_part<real_t>(block_width, block_height) * sizeof(real_t);
+    if (two_wavefunctions && !layout.split()) {
+        bytes = std::max(bytes, 4 * tile_width * sizeof(real_t));
+    }
+    scratch.reserve(bytes);
+}
+
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::set_time_step(double delta_t) {
+    set_coefficients(delta_t);
+}
+
+// Every coefficient proportional to the time step, so that a kernel can change it between two steps
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::set_coefficients(double delta_t) {
+    double mass[2] = {hamiltonian->mass, 0.};
+    if (two_wavefunctions) {
+        Hamiltonian2Component *hamiltonian2 = static_cast<Hamiltonian2Component*>(hamiltonian);
+        mass[1] = hamiltonian2->mass_b;
+        coupling_const[0] = delta_t * hamiltonian2->coupling_a;
+        coupling_const[1] = delta_t * hamiltonian2->coupling_b;
+        coupling_const[2] = delta_t * hamiltonian2->coupling_ab;
+        coupling_const[3] = 0.5 * hamiltonian2->omega_r;
+        coupling_const[4] = 0.5 * hamiltonian2->omega_i;
+        // LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
+        // LeeHuangYang_coupling[1] = hamiltonian->LeeHuangYang_coupling_b  * delta_t;
+    }
+    else {
+        coupling_const[0] = hamiltonian->coupling_a * delta_t;
+        coupling_const[1] = 0.;
+        coupling_const[2] = 0.;
+        LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
+        LeeHuangYang_coupling[1] = 0;
+    }
+    for (int i = 0; i < (two_wavefunctions ? 2 : 1); i++) {
+        if (imag_time) {
+            aH[i] = cosh(delta_t / (4. * mass[i] * delta_x * delta_x));
+            bH[i] = sinh(delta_t / (4. * mass[i] * delta_x * delta_x));
+            aV[i] = cosh(delta_t / (4. * mass[i] * delta_y * delta_y));
+            bV[i] = sinh(delta_t / (4. * mass[i] * delta_y * delta_y));
+        }
+        else {
+            aH[i] = cos(delta_t / (4. * mass[i] * delta_x * delta_x));
+            bH[i] = sin(delta_t / (4. * mass[i] * delta_x * delta_x));
+            aV[i] = cos(delta_t / (4. * mass[i] * delta_y * delta_y));
+            bV[i] = sin(delta_t / (4. * mass[i] * delta_y * delta_y));
+        }
+        kin_radial[i] = delta_t / (8. * mass[i] * delta_x * delta_x);
+        if (coordinate_system == "cylindrical") {
+            radial_coefficients(imag_time, kin_radial[i], start_x, tile_width, radial[i]);
+        }
+        pot_scale[i] = potential_scale<real_t>(imag_time, halo_y != 0, aH[i], bH[i], aV[i], bV[i]);
+    }
+    // The rotation only depends on the coordinates of the dots, so its coefficients are tabulated per column and row of the tile
+    alpha_x = hamiltonian->angular_velocity * delta_t * delta_x / (2 * delta_y);
+    alpha_y = hamiltonian->angular_velocity * delta_t * delta_y / (2 * delta_x);
+    rotation_coefficients(imag_time, alpha_x, start_x - rot_coord_x, tile_width, rotation_x);
+    rotation_coefficients(imag_time, -0.5 * alpha_y, start_y - rot_coord_y, tile_height, rotation_y);
+}
+
+template<typename real_t, typename accum_t>
+string CPUBlock<real_t, accum_t>::memory_placement() const {
+    stringstream placement;
+    size_t bytes = layout.size() * sizeof(real_t);
+    for (int i = 0; i < (two_wavefunctions ? 2 : 1); i++) {
+        for (int s = 0; s < 2; s++) {
+            // The split buffers of the current step may be the arrays of the state, which the solver reports, unless they were moved to the shared window
+            if ((layout.split() && s == 0 && !shared_halos && !converted_tile(p_real[i][0])) || (s == 1 && p_real[i][1] == p_real[i][0])) {
+                continue;
+            }
+            placement << "kernel wave function " << i + 1 << ", buffer " << s;
+            if (layout.split()) {
+                placement << " real: " << numa_placement(p_real[i][s], bytes) << endl;
+                placement << "kernel wave function " << i + 1 << ", buffer " << s << " imaginary: " << numa_placement(p_imag[i][s], bytes) << endl;
+            }
+            else {
+                placement << ": " << numa_placement(p_real[i][s], bytes) << endl;
+            }
+        }
+        if (external_pot_real[i] != NULL && converted_tile(external_pot_real[i])) {
+            placement << "kernel potential " << i + 1 << " real: " << numa_placement(external_pot_real[i], tile_width * tile_height * sizeof(real_t)) << endl;
+        }
+        if (external_pot_imag[i] != NULL && converted_tile(external_pot_imag[i])) {
+            placement << "kernel potential " << i + 1 << " imaginary: " << numa_placement(external_pot_imag[i], tile_width * tile_height * sizeof(real_t)) << endl;
+        }
+    }
+    if (pb_real != NULL) {
+        placement << "kernel copy of the other wave function real: " << numa_placement(pb_real, tile_width * tile_height * sizeof(real_t)) << endl;
+        placement << "kernel copy of the other wave function imaginary: " << numa_placement(pb_imag, tile_width * tile_height * sizeof(real_t)) << endl;
+    }
+    placement << strips.placement();
+    return placement.str();
 }
 
-CPUBlock::~CPUBlock() {
-    delete [] p_real[0][1];
-    delete [] p_imag[0][1];
-    delete [] p_real[1][1];
-    delete [] p_imag[1][1];
+template<typename real_t, typename accum_t>
+CPUBlock<real_t, accum_t>::~CPUBlock() {
+    for (int i = 0; i < 2; i++) {
+        // The buffers in the shared window are freed with it
+        if (!shared_halos) {
+            release_state(layout, p_real[i], p_imag[i]);
+        }
+        release_tile(external_pot_real[i]);
+        release_tile(external_pot_imag[i]);
+        delete [] potential_x[i];
+        delete [] potential_y[i];
+        delete [] radial[i];
+    }
+    free_grid(pb_real);
+    free_grid(pb_imag);
+    delete [] rotation_x;
+    delete [] rotation_y;
     delete [] aH;
     delete [] bH;
     delete [] aV;
     delete [] bV;
+    delete [] kin_radial;
     delete [] norm;
     delete [] coupling_const;
     delete [] LeeHuangYang_coupling;
+#ifdef HAVE_MPI
+    for (int i = 0; i < 2; i++) {
+        for (int buffer = 0; buffer < 2; buffer++) {
+            for (int request = 0; request < first_requests + second_requests; request++) {
+                if (exchange_requests[i][buffer][request] != MPI_REQUEST_NULL) {
+                    MPI_Request_free(&exchange_requests[i][buffer][request]);
+                }
+            }
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (halo_types[i][j] != MPI_DATATYPE_NULL) {
+                MPI_Type_free(&halo_types[i][j]);
+            }
+        }
+    }
+#if MPI_VERSION >= 3
+    if (shared_halos) {
+        MPI_Win_unlock_all(shared_window);
+        MPI_Win_free(&shared_window);
+        MPI_Comm_free(&node_comm);
+    }
+#endif
+#endif
 }
 
-void CPUBlock::run_kernel() {
-    // Inner part
-    int inner = 1, sides = 0;
-    if (halo_y == 0) {
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, block_height, halo_y, block_height - 2 * halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+#ifdef HAVE_MPI
+// Offsets along y and x of the neighbour in each direction
+static const int neighbor_offset_y[8] = {-1, 1, 0, 0, -1, -1, 1, 1}, neighbor_offset_x[8] = {0, 0, -1, 1, -1, 1, -1, 1};
 
+// Rectangle {x, y, width, height} of the halo a tile receives from the neighbour in direction or, with send, of the strip
+// of its inner part sent to the opposite neighbour. inner holds the first column and row of the inner part, then the ends.
+// The rows up and down span the whole width of the tile, unless the corners come from the diagonal neighbours.
+static void halo_region(int direction, bool send, bool corners, size_t tile_width, const size_t inner[4], size_t halo_x, size_t halo_y, size_t region[4]) {
+    const int offset[2] = {neighbor_offset_x[direction], neighbor_offset_y[direction]};
+    const size_t halo[2] = {halo_x, halo_y};
+    for (int axis = 0; axis < 2; axis++) {
+        if (offset[axis] == 0) {
+            bool whole = axis == 0 && !corners;
+            region[axis] = whole ? 0 : inner[axis];
+            region[axis + 2] = whole ? tile_width : inner[axis + 2] - inner[axis];
+        }
+        else if (send) {
+            region[axis] = offset[axis] < 0 ? inner[axis + 2] - halo[axis] : halo[axis];
+            region[axis + 2] = halo[axis];
+        }
+        else {
+            region[axis] = offset[axis] < 0 ? 0 : inner[axis + 2];
+            region[axis + 2] = halo[axis];
+        }
     }
-    else {
-#ifndef HAVE_MPI
-        #pragma omp parallel default(shared)
+}
+
+#if MPI_VERSION >= 3
+// Wait until a counter in the shared window reaches count; the stores made before it was set are then visible
+static void wait_for_counter(MPI_Win window, volatile long *counter, long count) {
+    MPI_Win_sync(window);
+    while (*counter < count) {
+#ifndef WIN32
+        sched_yield();
 #endif
-        {
-#ifndef HAVE_MPI
-            #pragma omp for
+        MPI_Win_sync(window);
+    }
+    MPI_Win_sync(window);
+}
+
+// Set a counter in the shared window, after the stores made so far
+static void set_counter(MPI_Win window, volatile long *counter, long count) {
+    MPI_Win_sync(window);
+    *counter = count;
+    MPI_Win_sync(window);
+}
 #endif
-            for (int block_start = block_height - 2 * halo_y;
-            block_start < int(tile_height - block_height);
-            block_start += block_height - 2 * halo_y) {
-
-                process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                alpha_x, alpha_y, tile_width, block_width, block_height,
-                halo_x, block_start, block_height, halo_y, block_height - 2 * halo_y,
-                aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                external_pot_real[state_index], external_pot_imag[state_index],
-                p_real[state_index][sense], p_imag[state_index][sense],
-                p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                inner, sides, imag_time, coordinate_system);
+
+/*
+ * With shared halos each process allocates its segment of a window shared by the processes of its node: a SharedTile,
+ * then its buffers, each 64-byte aligned. The imported buffers are copied there and released. The segments are
+ * allocated apart, so that each lands on the NUMA node of its process.
+ */
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::share_tiles() {
+    node_comm = MPI_COMM_NULL;
+    shared_tile = NULL;
+    exchanges = 0;
+    if (!shared_halos) {
+        return;
+    }
+#if MPI_VERSION >= 3
+    size_t bytes = layout.size() * sizeof(real_t);
+    size_t stride = (bytes + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT;
+    size_t segment = (sizeof(SharedTile) + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT;
+    size_t offsets[2][2][2];
+    for (int state = 0; state < 2; state++) {
+        for (int buffer = 0; buffer < 2; buffer++) {
+            size_t *offset = offsets[state][buffer];
+            if (p_real[state][buffer] == NULL) {
+                offset[0] = offset[1] = 0;
+            }
+            else if (buffer == 1 && p_real[state][1] == p_real[state][0]) {
+                offset[0] = offsets[state][0][0];
+                offset[1] = offsets[state][0][1];
+            }
+            else {
+                offset[0] = segment;
+                segment += stride;
+                if (layout.split()) {
+                    offset[1] = segment;
+                    segment += stride;
+                }
+                else {
+                    offset[1] = offset[0] + sizeof(real_t);
+                }
             }
         }
     }
-    sense = 1 - sense;
+    MPI_Comm_split_type(cartcomm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, (char *)"alloc_shared_noncontig", (char *)"true");
+    MPI_Win_allocate_shared(MPI_Aint(segment), 1, info, node_comm, &shared_tile, &shared_window);
+    MPI_Info_free(&info);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_window);
+
+    shared_tile->published = 0;
+    shared_tile->consumed = 0;
+    shared_tile->width = tile_width;
+    shared_tile->height = tile_height;
+    shared_tile->inner[0] = inner_start_x - start_x;
+    shared_tile->inner[1] = inner_start_y - start_y;
+    shared_tile->inner[2] = inner_end_x - start_x;
+    shared_tile->inner[3] = inner_end_y - start_y;
+    memcpy(shared_tile->offsets, offsets, sizeof(offsets));
+    char *base = (char *)shared_tile;
+    for (int state = 0; state < 2; state++) {
+        if (p_real[state][0] == NULL) {
+            continue;
+        }
+        for (int buffer = 0; buffer < 2; buffer++) {
+            if (buffer == 0 || p_real[state][1] != p_real[state][0]) {
+                memcpy(base + offsets[state][buffer][0], p_real[state][buffer], bytes);
+                if (layout.split()) {
+                    memcpy(base + offsets[state][buffer][1], p_imag[state][buffer], bytes);
+                }
+            }
+        }
+        release_state(layout, p_real[state], p_imag[state]);
+        for (int buffer = 0; buffer < 2; buffer++) {
+            p_real[state][buffer] = (real_t *)(base + offsets[state][buffer][0]);
+            p_imag[state][buffer] = (real_t *)(base + offsets[state][buffer][1]);
+        }
+    }
+    // The neighbours read the headers as soon as they query the window
+    MPI_Win_sync(shared_window);
+    MPI_Barrier(node_comm);
+#else
+    my_abort("Exchanging the halos in shared memory needs MPI 3");
+#endif
+}
+
+/*
+ * The halo received from each neighbour is the strip of the opposite edge of the neighbour's inner part, sent to it
+ * with a tag of its own for each direction and for the real and imaginary parts. The exchange goes by default in two
+ * waves: the halo_x-wide inner rows left and right, then full length rows up and down, which carry the corners received
+ * in the first wave. With exchange_corners the rows up and down only span the inner columns and the corners come from
+ * the diagonal neighbours, so all the messages are started together. The requests are set up once for both buffers
+ * of each wave function and started at every exchange. With shared halos the strips of the neighbours on the node are
+ * copied by copy_shared_halos instead, and only the neighbours on other nodes get requests.
+ */
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::plan_halo_exchange() {
+    int dims[2], periodic[2], coords[2];
+    MPI_Cart_get(cartcomm, 2, dims, periodic, coords);
+    MPI_Cart_shift(cartcomm, 0, 1, &neighbors[UP], &neighbors[DOWN]);
+    MPI_Cart_shift(cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
+    const int opposite[8] = {DOWN, UP, RIGHT, LEFT, DOWN_RIGHT, DOWN_LEFT, UP_RIGHT, UP_LEFT};
+    for (int i = UP_LEFT; i <= DOWN_RIGHT; i++) {
+        int neighbor[2] = {coords[0] + neighbor_offset_y[i], coords[1] + neighbor_offset_x[i]};
+        neighbors[i] = MPI_PROC_NULL;
+        if ((periodic[0] || (neighbor[0] >= 0 && neighbor[0] < dims[0])) && (periodic[1] || (neighbor[1] >= 0 && neighbor[1] < dims[1]))) {
+            MPI_Cart_rank(cartcomm, neighbor, &neighbors[i]);
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        neighbor_tiles[i] = NULL;
+    }
+#if MPI_VERSION >= 3
+    if (shared_halos) {
+        MPI_Group cart_group, node_group;
+        MPI_Comm_group(cartcomm, &cart_group);
+        MPI_Comm_group(node_comm, &node_group);
+        for (int i = 0; i < 8; i++) {
+            int node_rank = MPI_UNDEFINED;
+            if (neighbors[i] != MPI_PROC_NULL) {
+                MPI_Group_translate_ranks(cart_group, 1, &neighbors[i], node_group, &node_rank);
+            }
+            if (node_rank != MPI_UNDEFINED) {
+                MPI_Aint size;
+                int unit;
+                MPI_Win_shared_query(shared_window, node_rank, &size, &unit, &neighbor_tiles[i]);
+                neighbor_layouts[i] = TileLayout(layout.name, neighbor_tiles[i]->width, neighbor_tiles[i]->height);
+            }
+        }
+        MPI_Group_free(&cart_group);
+        MPI_Group_free(&node_group);
+    }
+#endif
+
+    size_t inner[4] = {size_t(inner_start_x - start_x), size_t(inner_start_y - start_y), size_t(inner_end_x - start_x), size_t(inner_end_y - start_y)};
+    const int order[8] = {LEFT, RIGHT, UP, DOWN, UP_LEFT, UP_RIGHT, DOWN_LEFT, DOWN_RIGHT};
+    int directions = exchange_corners ? 8 : 4;
+    first_requests = 0;
+    second_requests = 0;
+    for (int i = 0; i < 8; i++) {
+        halo_types[i][0] = halo_types[i][1] = MPI_DATATYPE_NULL;
+    }
+    size_t receive[8][4], send[8][4];
+    for (int k = 0; k < directions; k++) {
+        int i = order[k];
+        halo_region(i, false, exchange_corners, tile_width, inner, halo_x, halo_y, receive[i]);
+        halo_region(i, true, exchange_corners, tile_width, inner, halo_x, halo_y, send[i]);
+        halo_types[i][0] = halo_datatype<real_t>(layout, receive[i][0], receive[i][1], receive[i][2], receive[i][3]);
+        halo_types[i][1] = halo_datatype<real_t>(layout, send[i][0], send[i][1], send[i][2], send[i][3]);
+    }
+    for (int state = 0; state < 2; state++) {
+        for (int buffer = 0; buffer < 2; buffer++) {
+            MPI_Request *requests = exchange_requests[state][buffer];
+            for (int request = 0; request < 32; request++) {
+                requests[request] = MPI_REQUEST_NULL;
+            }
+            if (p_real[state][buffer] == NULL) {
+                continue;
+            }
+            for (int k = 0; k < directions; k++) {
+                int i = order[k];
+                size_t receive_offset = layout.index(receive[i][0], receive[i][1]), send_offset = layout.index(send[i][0], send[i][1]);
+                if (neighbor_tiles[i] == NULL) {
+                    MPI_Recv_init(p_real[state][buffer] + receive_offset, 1, halo_types[i][0], neighbors[i], 2 * i + 1, cartcomm, requests++);
+                    MPI_Recv_init(p_imag[state][buffer] + receive_offset, 1, halo_types[i][0], neighbors[i], 2 * i + 2, cartcomm, requests++);
+                }
+                if (neighbor_tiles[opposite[i]] == NULL) {
+                    MPI_Send_init(p_real[state][buffer] + send_offset, 1, halo_types[i][1], neighbors[opposite[i]], 2 * i + 1, cartcomm, requests++);
+                    MPI_Send_init(p_imag[state][buffer] + send_offset, 1, halo_types[i][1], neighbors[opposite[i]], 2 * i + 2, cartcomm, requests++);
+                }
+                // Without the corners the rows up and down wait for the columns left and right
+                if (k == 1 && !exchange_corners) {
+                    first_requests = requests - exchange_requests[state][buffer];
+                }
+            }
+            if (exchange_corners) {
+                first_requests = requests - exchange_requests[state][buffer];
+            }
+            else {
+                second_requests = requests - exchange_requests[state][buffer] - first_requests;
+            }
+        }
+    }
+}
+
+// The neighbours on the node wrote the strips of the buffer being exchanged before setting their counter in start_halo_exchange
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::copy_shared_halos() {
+#if MPI_VERSION >= 3
+    for (int i = 0; i < 8; i++) {
+        SharedTile *neighbor = neighbor_tiles[i];
+        if (neighbor == NULL) {
+            continue;
+        }
+        wait_for_counter(shared_window, &neighbor->published, exchanges);
+        size_t from[4], to[4];
+        halo_region(i, true, true, neighbor->width, neighbor->inner, halo_x, halo_y, from);
+        halo_region(i, false, true, tile_width, shared_tile->inner, halo_x, halo_y, to);
+        const char *base = (const char *)neighbor;
+        const size_t *offset = neighbor->offsets[state_index][sense];
+        copy_between_tiles(neighbor_layouts[i], (const real_t *)(base + offset[0]), (const real_t *)(base + offset[1]), from[0], from[1],
+                           layout, p_real[state_index][sense], p_imag[state_index][sense], to[0], to[1], to[2], to[3]);
+    }
+#endif
+}
+#endif
+
+// Append to blocks the inner blocks of a band, the blocks on its sides, or both. The blocks overlap by 2 * block_halo_x
+// columns. A side block reads the left or right halo, or writes the columns sent to the neighbours, which are exchanged
+// while the inner blocks are evolved: with narrow blocks, a narrow last block or deep halos, these columns reach past
+// the first and the last block.
+static void plan_band(BlockSchedule &blocks, size_t tile_width, size_t block_width, size_t block_halo_x, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height, bool inner, bool sides) {
+    size_t blocks_in_band = band_blocks(tile_width, block_width, block_halo_x);
+    for (size_t block = 0; block < blocks_in_band; block++) {
+        size_t block_start = block * (block_width - 2 * block_halo_x);
+        bool side = block == 0 || block == blocks_in_band - 1 || block_start < 2 * halo_x || block_start + block_width > tile_width - 2 * halo_x;
+        if (side ? sides : inner) {
+            blocks.add(read_y, read_height, write_offset, write_height, block);
+        }
+    }
 }
 
-void CPUBlock::run_kernel_on_halo() {
-    int inner = 0, sides = 0;
+/*
+ * The bands overlap by 2 * block_halo_y rows. run_kernel_on_halo evolves the blocks
+ * that depend on the halos of the tile: the first and the last band, and the
+ * sides of the others. run_kernel evolves the inner blocks of the other
+ * bands, which only read the previous step of the tile, while the halos are
+ * exchanged. A tile no higher than a block is a single band, evolved by
+ * run_kernel_on_halo; on one-dimensional lattices, which have no upper and
+ * lower halos, run_kernel still evolves its inner blocks.
+ */
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::plan_blocks() {
+    size_t blocks = band_blocks(tile_width, block_width, block_halo_x);
+    size_t band_step = block_height - 2 * block_halo_y;
+    size_t bands = tile_height / band_step + 2;
+    inner_blocks.plan(bands * blocks);
+    halo_blocks.plan(bands * blocks);
+    // A block written back with plain stores would first read the lines of the tile it overwrites
+    size_t swept_bytes = (two_wavefunctions ? 2 : 1) * (in_place ? 2 : 4) * layout.size() * sizeof(real_t);
+    stream_stores = layout.split() && swept_bytes > last_level_cache();
+    if (in_place) {
+        strips.plan(tile_width, tile_height, block_halo_x, block_halo_y, band_step, tile_height <= block_height ? 0 : (tile_height - 2 * block_halo_y - 1) / band_step,
+                    block_width - 2 * block_halo_x, blocks - 1);
+    }
     if (tile_height <= block_height) {
-        // One full band
-        inner = 1;
-        sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, tile_height, 0, tile_height,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+        // The band writes the upper and lower halos, so it has to be over before they are exchanged, unless there are none
+        plan_band(halo_blocks, tile_width, block_width, block_halo_x, halo_x, 0, tile_height, 0, tile_height, halo_y != 0, true);
+        if (halo_y == 0) {
+            plan_band(inner_blocks, tile_width, block_width, block_halo_x, halo_x, 0, tile_height, 0, tile_height, true, false);
+        }
+        return;
     }
-    else {
+    plan_band(halo_blocks, tile_width, block_width, block_halo_x, halo_x, 0, block_height, 0, block_height - block_halo_y, true, true);
+    size_t read_y;
+    for (read_y = band_step; read_y + block_height < tile_height; read_y += band_step) {
+        // Exchanging the corners starts the rows sent up and down, and the halos received, before run_kernel: bands writing them are evolved whole first
+        size_t write_y = read_y + block_halo_y;
+        bool edge = exchange_corners && (write_y < 2 * halo_y || write_y + band_step > tile_height - 2 * halo_y);
+        plan_band(halo_blocks, tile_width, block_width, block_halo_x, halo_x, read_y, block_height, block_halo_y, band_step, edge, true);
+        plan_band(inner_blocks, tile_width, block_width, block_halo_x, halo_x, read_y, block_height, block_halo_y, band_step, !edge, false);
+    }
+    plan_band(halo_blocks, tile_width, block_width, block_halo_x, halo_x, read_y, tile_height - read_y, block_halo_y, tile_height - read_y - block_halo_y, true, true);
+}
 
-        // Sides
-        inner = 0;
-        sides = 1;
-#ifndef HAVE_MPI
-        #pragma omp parallel for
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::run_blocks(BlockSchedule &blocks) {
+    if (blocks.size() == 0) {
+        return;
+    }
+    reserve_scratch();
+    blocks.reserve_threads();
+    const real_t *other_real = pb_real != NULL ? pb_real : p_real[1 - state_index][sense];
+    const real_t *other_imag = pb_imag != NULL ? pb_imag : p_imag[1 - state_index][sense];
+    #pragma omp parallel default(shared)
+    {
+#ifdef _OPENMP
+        int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+#else
+        int thread = 0, threads = 1;
+#endif
+        blocks.start(thread, threads);
+        #pragma omp barrier
+        const BlockTask *task;
+        while ((task = blocks.next(thread, threads)) != NULL) {
+            process_block(layout, radial[state_index], rotation_x, rotation_y, potential_x[state_index], potential_y[state_index],
+                          tile_width, block_width, block_height,
+                          block_halo_x, task->read_y, task->read_height, task->write_offset, task->write_height,
+                          aH[state_index], bH[state_index], aV[state_index], bV[state_index],
+                          coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
+                          external_pot_real[state_index], external_pot_imag[state_index],
+                          p_real[state_index][sense], p_imag[state_index][sense],
+                          other_real, other_imag,
+                          p_real[state_index][1 - sense], p_imag[state_index][1 - sense], stream_stores,
+                          evolves_in_place() ? &strips : NULL, scratch, task->block, step, kinetic_kernels, potential_kernels);
+        }
+    }
+}
+
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::run_kernel() {
+    run_blocks(inner_blocks);
+    sense = 1 - sense;
+    if (normalizes_steps()) {
+        start_norm_sum();
+    }
+}
+
+template<typename real_t, typename accum_t>
+bool CPUBlock<real_t, accum_t>::normalizes_steps() const {
+    return imag_time && norm[state_index] != 0;
+}
+
+// The inner dots are all evolved by now and the halo exchange only writes the halos, so the sum runs while they are received
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::start_norm_sum() {
+    norm_sum = calculate_squared_norm(false);
+#ifdef HAVE_MPI
+#if MPI_VERSION >= 3
+    MPI_Iallreduce(MPI_IN_PLACE, &norm_sum, 1, MPI_DOUBLE, MPI_SUM, cartcomm, &norm_request);
+#else
+    MPI_Allreduce(MPI_IN_PLACE, &norm_sum, 1, MPI_DOUBLE, MPI_SUM, cartcomm);
 #endif
-        for (int block_start = block_height - 2 * halo_y; block_start < tile_height - block_height; block_start += block_height - 2 * halo_y) {
-            process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                         alpha_x, alpha_y, tile_width, block_width, block_height,
-                         halo_x, block_start, block_height, halo_y, block_height - 2 * halo_y,
-                         aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                         coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                         external_pot_real[state_index], external_pot_imag[state_index],
-                         p_real[state_index][sense], p_imag[state_index][sense],
-                         p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                         p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                         inner, sides, imag_time, coordinate_system);
-        }
-        size_t block_start;
-        for (block_start = block_height - 2 * halo_y; block_start < tile_height - block_height; block_start += block_height - 2 * halo_y) {}
-        // First band
-        inner = 1;
-        sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, block_height, 0, block_height - halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
-
-        // Last band
-        inner = 1;
-        sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, block_start, tile_height - block_start, halo_y, tile_height - block_start - halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
-    }
-}
-
-double CPUBlock::calculate_squared_norm(bool global) const {
-    double norm2 = 0.;
-#ifndef HAVE_MPI
-    #pragma omp parallel for reduction(+:norm2)
 #endif
+}
+
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::run_kernel_on_halo() {
+    if (pb_real != NULL) {
+        // The potential step reads the other wave function with the stride of the tile
+        const real_t *other_real = p_real[1 - state_index][sense], *other_imag = p_imag[1 - state_index][sense];
+        #pragma omp parallel for
+        for (int y = 0; y < int(tile_height); y++) {
+            gather(layout, other_real, other_imag, 0, y, tile_width, 1, &pb_real[y * tile_width], &pb_imag[y * tile_width], tile_width);
+        }
+    }
+    // The blocks of both halves of the step read their edges at the previous time step
+    if (evolves_in_place()) {
+        strips.save(layout, p_real[state_index][sense], p_imag[state_index][sense]);
+    }
+    run_blocks(halo_blocks);
+}
+
+template<typename real_t, typename accum_t>
+bool CPUBlock<real_t, accum_t>::runs_in_place() const {
+    return in_place && !two_wavefunctions && layout.split() && !shared_halos && !converted_tile(p_real[0][0]);
+}
+
+template<typename real_t, typename accum_t>
+double CPUBlock<real_t, accum_t>::calculate_squared_norm(bool global) const {
+    accum_t sum = 0.;
+    #pragma omp parallel for reduction(+:sum)
     for(int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
         for(int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
-            norm2 += p_real[state_index][sense][j + i * tile_width] * p_real[state_index][sense][j + i * tile_width] + p_imag[state_index][sense][j + i * tile_width] * p_imag[state_index][sense][j + i * tile_width];
+            accum_t real = p_real[state_index][sense][layout.index(j, i)], imag = p_imag[state_index][sense][layout.index(j, i)];
+            sum += real * real + imag * imag;
         }
     }
+    double norm2 = sum;
 #ifdef HAVE_MPI
     if (global) {
-        int nProcs = 1;
-        MPI_Comm_size(cartcomm, &nProcs);
-        double *sums = new double[nProcs];
-        MPI_Allgather(&norm2, 1, MPI_DOUBLE, sums, 1, MPI_DOUBLE, cartcomm);
-        norm2 = 0.;
-        for(int i = 0; i < nProcs; i++)
-            norm2 += sums[i];
-        delete [] sums;
+        MPI_Allreduce(MPI_IN_PLACE, &norm2, 1, MPI_DOUBLE, MPI_SUM, cartcomm);
     }
 #endif
     return norm2 * delta_x * delta_y;
 }
 
-void CPUBlock::wait_for_completion() {
-    if (imag_time && norm[state_index] != 0) {
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::wait_for_completion() {
+    if (normalizes_steps()) {
         //normalization
-        double tot_norm = calculate_squared_norm(true);
-        double _norm = sqrt(tot_norm / norm[state_index]);
+#ifdef HAVE_MPI
+        MPI_Wait(&norm_request, MPI_STATUS_IGNORE);
+#endif
+        double _norm = sqrt(norm_sum / norm[state_index]);
 
-        for (size_t i = 0; i < tile_height; i++) {
+        #pragma omp parallel for
+        for (int i = 0; i < int(tile_height); i++) {
             for (size_t j = 0; j < tile_width; j++) {
-                p_real[state_index][sense][j + i * tile_width] /= _norm;
-                p_imag[state_index][sense][j + i * tile_width] /= _norm;
+                p_real[state_index][sense][layout.index(j, i)] /= _norm;
+                p_imag[state_index][sense][layout.index(j, i)] /= _norm;
             }
         }
     }
@@ -569,16 +1719,25 @@ void CPUBlock::wait_for_completion() {
     }
 }
 
-void CPUBlock::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double *dest_real2, double * dest_imag2) const {
-    memcpy2D(dest_real, dest_stride * sizeof(double), &(p_real[0][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
-    memcpy2D(dest_imag, dest_stride * sizeof(double), &(p_imag[0][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double *dest_real2, double * dest_imag2) const {
+    gather(layout, p_real[0][sense], p_imag[0][sense], x, y, width, height, dest_real, dest_imag, dest_stride);
     if (dest_real2 != 0) {
-        memcpy2D(dest_real2, dest_stride * sizeof(double), &(p_real[1][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
-        memcpy2D(dest_imag2, dest_stride * sizeof(double), &(p_imag[1][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
+        gather(layout, p_real[1][sense], p_imag[1][sense], x, y, width, height, dest_real2, dest_imag2, dest_stride);
+    }
+}
+
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::set_sample(size_t src_stride, size_t x, size_t y, size_t width, size_t height, const double * src_real, const double * src_imag, const double *src_real2, const double * src_imag2) {
+    scatter(layout, src_real, src_imag, src_stride, p_real[0][sense], p_imag[0][sense], x, y, width, height);
+    if (src_real2 != 0) {
+        scatter(layout, src_real2, src_imag2, src_stride, p_real[1][sense], p_imag[1][sense], x, y, width, height);
     }
 }
 
-void CPUBlock::rabi_coupling(double var, double delta_t) {
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::rabi_coupling(double var, double delta_t) {
+    reserve_scratch();
     double norm_omega = sqrt(coupling_const[3] * coupling_const[3] + coupling_const[4] * coupling_const[4]);
     double cc, cs_r, cs_i;
     if(imag_time) {
@@ -591,7 +1750,7 @@ void CPUBlock::rabi_coupling(double var, double delta_t) {
             cs_r = coupling_const[3] / norm_omega * sinh(- delta_t * var * norm_omega);
             cs_i = coupling_const[4] / norm_omega * sinh(- delta_t * var * norm_omega);
         }
-        rabi_coupling_imaginary(tile_width, tile_width, tile_height, cc, cs_r, cs_i, p_real[0][sense], p_imag[0][sense], p_real[1][sense], p_imag[1][sense]);
+        rabi_coupling_tile<real_t>(layout, scratch, rabi_coupling_imaginary, cc, cs_r, cs_i, p_real[0][sense], p_imag[0][sense], p_real[1][sense], p_imag[1][sense]);
     }
     else {
         cc = cos(- delta_t * var * norm_omega);
@@ -603,83 +1762,74 @@ void CPUBlock::rabi_coupling(double var, double delta_t) {
             cs_r = coupling_const[3] / norm_omega * sin(- delta_t * var * norm_omega);
             cs_i = coupling_const[4] / norm_omega * sin(- delta_t * var * norm_omega);
         }
-        rabi_coupling_real(tile_width, tile_width, tile_height, cc, cs_r, cs_i, p_real[0][sense], p_imag[0][sense], p_real[1][sense], p_imag[1][sense]);
+        rabi_coupling_tile<real_t>(layout, scratch, rabi_coupling_real, cc, cs_r, cs_i, p_real[0][sense], p_imag[0][sense], p_real[1][sense], p_imag[1][sense]);
     }
 }
 
-void CPUBlock::normalization() {
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::normalization() {
     if(imag_time && (coupling_const[3] != 0 || coupling_const[4] != 0)) {
         //normalization
-        int nProcs = 1;
-#ifdef HAVE_MPI
-        MPI_Comm_size(cartcomm, &nProcs);
-#endif
-
-        double sum_a = 0., sum_b = 0., *sums, *sums_a, *sums_b;
-        sums = new double[nProcs];
-        sums_a = new double[nProcs];
-        sums_b = new double[nProcs];
+        accum_t partial_a = 0., partial_b = 0.;
+        #pragma omp parallel for reduction(+:partial_a)
         for(int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
             for(int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
-                sum_a += p_real[0][sense][j + i * tile_width] * p_real[0][sense][j + i * tile_width] + p_imag[0][sense][j + i * tile_width] * p_imag[0][sense][j + i * tile_width];
+                accum_t real = p_real[0][sense][layout.index(j, i)], imag = p_imag[0][sense][layout.index(j, i)];
+                partial_a += real * real + imag * imag;
             }
         }
         if(p_real[1] != NULL) {
+            #pragma omp parallel for reduction(+:partial_b)
             for(int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
                 for(int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
-                    sum_b += p_real[1][sense][j + i * tile_width] * p_real[1][sense][j + i * tile_width] + p_imag[1][sense][j + i * tile_width] * p_imag[1][sense][j + i * tile_width];
+                    accum_t real = p_real[1][sense][layout.index(j, i)], imag = p_imag[1][sense][layout.index(j, i)];
+                    partial_b += real * real + imag * imag;
                 }
             }
         }
+        // Both components are added up over the tiles in a single message
+        double sums[2] = {double(partial_a), double(partial_b)};
 #ifdef HAVE_MPI
-
-        MPI_Allgather(&sum_a, 1, MPI_DOUBLE, sums_a, 1, MPI_DOUBLE, cartcomm);
-        MPI_Allgather(&sum_b, 1, MPI_DOUBLE, sums_b, 1, MPI_DOUBLE, cartcomm);
-#else
-        sums_a[0] = sum_a;
-        sums_b[0] = sum_b;
+        MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, cartcomm);
 #endif
-        double tot_sum_a = 0., tot_sum_b = 0.;
-        for(int i = 0; i < nProcs; i++) {
-            tot_sum_a += sums_a[i];
-            tot_sum_b += sums_b[i];
-        }
+        double tot_sum_a = sums[0], tot_sum_b = sums[1];
         double _norm = sqrt((tot_sum_a + tot_sum_b) * delta_x * delta_y / tot_norm);
 
         for(size_t i = 0; i < tile_height; i++) {
             for(size_t j = 0; j < tile_width; j++) {
-                p_real[0][sense][j + i * tile_width] /= _norm;
-                p_imag[0][sense][j + i * tile_width] /= _norm;
+                p_real[0][sense][layout.index(j, i)] /= _norm;
+                p_imag[0][sense][layout.index(j, i)] /= _norm;
             }
         }
         norm[0] = tot_sum_a / (tot_sum_a + tot_sum_b) * tot_norm;
         if(p_real[1] != NULL) {
             for(size_t i = 0; i < tile_height; i++) {
                 for(size_t j = 0; j < tile_width; j++) {
-                    p_real[1][sense][j + i * tile_width] /= _norm;
-                    p_imag[1][sense][j + i * tile_width] /= _norm;
+                    p_real[1][sense][layout.index(j, i)] /= _norm;
+                    p_imag[1][sense][layout.index(j, i)] /= _norm;
                 }
             }
             norm[1] = tot_sum_b / (tot_sum_a + tot_sum_b) * tot_norm;
         }
-        delete[] sums;
     }
 }
 
-void CPUBlock::cpy_first_positive_to_first_negative() {
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::cpy_first_positive_to_first_negative() {
     if (imag_time && coordinate_system == "cylindrical") {
         // performs the copy only for the tiles containing the origin of the radial coordinate
         if (start_x <= 0) {
-            int stride = end_x - start_x;
             double sign;
             sign = (angular_momentum[0] % 2 == 0 ? 1 : -1);
-            for (int j = start_y, idx = 1, peer = 0; j < end_y; j += 1, idx += stride, peer += stride) {
+            for (size_t y = 0; y < tile_height; y++) {
+                size_t idx = layout.index(1, y), peer = layout.index(0, y);
                 p_real[0][sense][peer] = sign * p_real[0][sense][idx];
                 p_imag[0][sense][peer] = sign * p_imag[0][sense][idx];
             }
             if (two_wavefunctions) {
                 sign = (angular_momentum[1] % 2 == 0 ? 1 : -1);
-                for (int j = start_y, idx = 1, peer = 0; j < end_y; j += 1, idx += stride, peer += stride) {
+                for (size_t y = 0; y < tile_height; y++) {
+                    size_t idx = layout.index(1, y), peer = layout.index(0, y);
                     p_real[1][sense][peer] = sign * p_real[1][sense][idx];
                     p_imag[1][sense][peer] = sign * p_imag[1][sense][idx];
                 }
@@ -688,60 +1838,57 @@ void CPUBlock::cpy_first_positive_to_first_negative() {
     }
 }
 
-void CPUBlock::start_halo_exchange() {
-    // Halo exchange: LEFT/RIGHT
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::start_halo_exchange() {
 #ifdef HAVE_MPI
-    int offset = (inner_start_y - start_y) * tile_width;
-    MPI_Irecv(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 1, cartcomm, req);
-    MPI_Irecv(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 2, cartcomm, req + 1);
-    offset = (inner_start_y - start_y) * tile_width + inner_end_x - start_x;
-    MPI_Irecv(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 3, cartcomm, req + 2);
-    MPI_Irecv(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 4, cartcomm, req + 3);
-
-    offset = (inner_start_y - start_y) * tile_width + inner_end_x - halo_x - start_x;
-    MPI_Isend(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 1, cartcomm, req + 4);
-    MPI_Isend(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[RIGHT], 2, cartcomm, req + 5);
-    offset = (inner_start_y - start_y) * tile_width + halo_x;
-    MPI_Isend(p_real[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 3, cartcomm, req + 6);
-    MPI_Isend(p_imag[state_index][1 - sense] + offset, 1, verticalBorder, neighbors[LEFT], 4, cartcomm, req + 7);
+    MPI_Startall(first_requests, exchange_requests[state_index][1 - sense]);
+#if MPI_VERSION >= 3
+    if (shared_halos) {
+        exchanges++;
+        set_counter(shared_window, &shared_tile->published, exchanges);
+    }
+#endif
 #else
     if(periods[1] != 0) {
-        int offset = (inner_start_y - start_y) * tile_width;
-        memcpy2D(&(p_real[state_index][1 - sense][offset]), tile_width * sizeof(double), &(p_real[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_imag[state_index][1 - sense][offset]), tile_width * sizeof(double), &(p_imag[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_real[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_real[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_imag[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_imag[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+        size_t y = inner_start_y - start_y;
+        copy_region(layout, p_real[state_index][1 - sense], p_imag[state_index][1 - sense], tile_width - 2 * halo_x, y, 0, y, halo_x, tile_height - 2 * halo_y);
+        copy_region(layout, p_real[state_index][1 - sense], p_imag[state_index][1 - sense], halo_x, y, tile_width - halo_x, y, halo_x, tile_height - 2 * halo_y);
     }
 #endif
 }
 
-void CPUBlock::finish_halo_exchange() {
+template<typename real_t, typename accum_t>
+void CPUBlock<real_t, accum_t>::finish_halo_exchange() {
 #ifdef HAVE_MPI
-    MPI_Waitall(8, req, statuses);
-
-    // Halo exchange: UP/DOWN
-    int offset = 0;
-    MPI_Irecv(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 1, cartcomm, req);
-    MPI_Irecv(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 2, cartcomm, req + 1);
-    offset = (inner_end_y - start_y) * tile_width;
-    MPI_Irecv(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 3, cartcomm, req + 2);
-    MPI_Irecv(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 4, cartcomm, req + 3);
-
-    offset = (inner_end_y - halo_y - start_y) * tile_width;
-    MPI_Isend(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 1, cartcomm, req + 4);
-    MPI_Isend(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[DOWN], 2, cartcomm, req + 5);
-    offset = halo_y * tile_width;
-    MPI_Isend(p_real[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 3, cartcomm, req + 6);
-    MPI_Isend(p_imag[state_index][sense] + offset, 1, horizontalBorder, neighbors[UP], 4, cartcomm, req + 7);
-
-    MPI_Waitall(8, req, statuses);
+    // run_kernel turned the buffer being exchanged into the current one
+    MPI_Request *requests = exchange_requests[state_index][sense];
+    MPI_Waitall(first_requests, requests, MPI_STATUSES_IGNORE);
+    if (second_requests != 0) {
+        MPI_Startall(second_requests, requests + first_requests);
+        MPI_Waitall(second_requests, requests + first_requests, MPI_STATUSES_IGNORE);
+    }
+#if MPI_VERSION >= 3
+    // The messages go first: a process waiting for its neighbours on the node has no message of the exchange left
+    if (shared_halos) {
+        copy_shared_halos();
+        // The neighbours must not overwrite or normalize the strips before they are copied
+        set_counter(shared_window, &shared_tile->consumed, exchanges);
+        for (int i = 0; i < 8; i++) {
+            if (neighbor_tiles[i] != NULL) {
+                wait_for_counter(shared_window, &neighbor_tiles[i]->consumed, exchanges);
+            }
+        }
+    }
+#endif
 #else
     if(periods[0] != 0) {
-        int offset = (inner_end_y - start_y) * tile_width;
-        memcpy2D(&(p_real[state_index][sense][0]), tile_width * sizeof(double), &(p_real[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_imag[state_index][sense][0]), tile_width * sizeof(double), &(p_imag[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_real[state_index][sense][offset]), tile_width * sizeof(double), &(p_real[state_index][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_imag[state_index][sense][offset]), tile_width * sizeof(double), &(p_imag[state_index][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        size_t y = inner_end_y - start_y;
+        copy_region(layout, p_real[state_index][sense], p_imag[state_index][sense], 0, y - halo_y, 0, 0, tile_width, halo_y);
+        copy_region(layout, p_real[state_index][sense], p_imag[state_index][sense], 0, halo_y, 0, y, tile_width, halo_y);
     }
 #endif
 }
+
+template class CPUBlock<double, double>;
+template class CPUBlock<float, float>;
+template class CPUBlock<float, double>;
@@ -0,0 +1,479 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "common.h"
+#include "kernel.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Vectorised kinetic kernels.
+ *
+ * Every dot of the block belongs to exactly one pair, and the pair update is
+ * symmetric: each member is rotated with the old value of its partner.
+ * Instead of walking the pairs with stride 2, the kernels below update full
+ * SIMD vectors of consecutive dots at once:
+ *  - horizontal pairs are adjacent in memory, so the partner vector is the
+ *    same vector with the two members of each pair swapped;
+ *  - for vertical pairs, even and odd dots of a row have their partner in the
+ *    row below and in the row above respectively (or vice versa), so the
+ *    partner vector is a blend of the two neighbouring rows selected by the
+ *    parity of the lane. The old value of the row above is kept in a small
+ *    buffer, and the block is processed in strips of VERTICAL_STRIP columns
+ *    so that the buffer stays on the stack.
+ */
+#define VERTICAL_STRIP 64
+
+// Update of a single dot with the old value of its partner
+template<bool imaginary, typename real_t>
+static inline void pair_update(real_t a, real_t b, real_t self_real, real_t self_imag,
+                               real_t peer_real, real_t peer_imag, real_t *real, real_t *imag) {
+    if (imaginary) {
+        *real = a * self_real + b * peer_real;
+        *imag = a * self_imag + b * peer_imag;
+    }
+    else {
+        *real = a * self_real - b * peer_imag;
+        *imag = a * self_imag + b * peer_real;
+    }
+}
+
+// Scalar update of the dots [x_start, x_end) of row y, used for the tails of the vectorised loops
+template<bool imaginary, typename real_t>
+static inline void vertical_row_scalar(size_t start_offset, size_t stride, size_t height, size_t y, size_t x_start, size_t x_end,
+                                       real_t a, real_t b, real_t *p_real, real_t *p_imag,
+                                       real_t *saved_real, real_t *saved_imag) {
+    for (size_t x = x_start; x < x_end; ++x) {
+        size_t idx = y * stride + x;
+        real_t self_real = p_real[idx], self_imag = p_imag[idx];
+        bool peer_below = (x % 2) == ((start_offset + y) % 2);
+        bool has_peer = peer_below ? y + 1 < height : y > 0;
+        if (has_peer) {
+            real_t peer_real = peer_below ? p_real[idx + stride] : saved_real[x - x_start];
+            real_t peer_imag = peer_below ? p_imag[idx + stride] : saved_imag[x - x_start];
+            pair_update<imaginary>(a, b, self_real, self_imag, peer_real, peer_imag, &p_real[idx], &p_imag[idx]);
+        }
+        saved_real[x - x_start] = self_real;
+        saved_imag[x - x_start] = self_imag;
+    }
+}
+
+#ifdef X86_SIMD
+
+/*
+ * The target attribute cannot depend on a template parameter, so the
+ * intrinsics of every instruction set are wrapped in a traits structure
+ * specialised for double and float, and the kernels are templates over it.
+ * Float vectors hold twice as many dots; the pairs are swapped within each
+ * 64 bit half and the lane masks have twice as many bits.
+ */
+#define AVX2 __attribute__((target("avx2,fma")))
+#define AVX512 __attribute__((target("avx512f")))
+
+template<typename real_t> struct Avx2;
+
+template<> struct Avx2<double> {
+    typedef __m256d vector;
+    static const size_t lanes = 4;
+    static const int even_mask = 0x5;           // lanes on even columns
+    static const int odd_mask = 0xA;            // lanes on odd columns
+    static const int all_mask = 0xF;
+    static inline AVX2 vector set1(double x) {
+        return _mm256_set1_pd(x);
+    }
+    static inline AVX2 vector load(const double *p) {
+        return _mm256_loadu_pd(p);
+    }
+    static inline AVX2 void store(double *p, vector x) {
+        _mm256_storeu_pd(p, x);
+    }
+    static inline AVX2 vector mul(vector a, vector b) {
+        return _mm256_mul_pd(a, b);
+    }
+    static inline AVX2 vector fmadd(vector a, vector b, vector c) {
+        return _mm256_fmadd_pd(a, b, c);
+    }
+    static inline AVX2 vector fnmadd(vector a, vector b, vector c) {
+        return _mm256_fnmadd_pd(a, b, c);
+    }
+    static inline AVX2 vector swap_pairs(vector x) {
+        return _mm256_permute_pd(x, 0x5);
+    }
+    template<int mask>
+    static inline AVX2 vector blend(vector a, vector b) {
+        return _mm256_blend_pd(a, b, mask);
+    }
+};
+
+template<> struct Avx2<float> {
+    typedef __m256 vector;
+    static const size_t lanes = 8;
+    static const int even_mask = 0x55;
+    static const int odd_mask = 0xAA;
+    static const int all_mask = 0xFF;
+    static inline AVX2 vector set1(float x) {
+        return _mm256_set1_ps(x);
+    }
+    static inline AVX2 vector load(const float *p) {
+        return _mm256_loadu_ps(p);
+    }
+    static inline AVX2 void store(float *p, vector x) {
+        _mm256_storeu_ps(p, x);
+    }
+    static inline AVX2 vector mul(vector a, vector b) {
+        return _mm256_mul_ps(a, b);
+    }
+    static inline AVX2 vector fmadd(vector a, vector b, vector c) {
+        return _mm256_fmadd_ps(a, b, c);
+    }
+    static inline AVX2 vector fnmadd(vector a, vector b, vector c) {
+        return _mm256_fnmadd_ps(a, b, c);
+    }
+    static inline AVX2 vector swap_pairs(vector x) {
+        return _mm256_permute_ps(x, 0xB1);
+    }
+    template<int mask>
+    static inline AVX2 vector blend(vector a, vector b) {
+        return _mm256_blend_ps(a, b, mask);
+    }
+};
+
+// AVX2 + FMA: four doubles or eight floats per vector
+template<bool imaginary, class V>
+static inline AVX2 void pair_update_avx2(typename V::vector a, typename V::vector b, typename V::vector self_real, typename V::vector self_imag,
+        typename V::vector peer_real, typename V::vector peer_imag, typename V::vector *real, typename V::vector *imag) {
+    if (imaginary) {
+        *real = V::fmadd(b, peer_real, V::mul(a, self_real));
+        *imag = V::fmadd(b, peer_imag, V::mul(a, self_imag));
+    }
+    else {
+        *real = V::fnmadd(b, peer_imag, V::mul(a, self_real));
+        *imag = V::fmadd(b, peer_real, V::mul(a, self_imag));
+    }
+}
+
+template<bool imaginary, typename real_t>
+static AVX2 void block_kernel_horizontal_avx2(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
+    typedef Avx2<real_t> V;
+    typename V::vector va = V::set1(a), vb = V::set1(b);
+    for (size_t y = 0; y < height; ++y) {
+        size_t first = (start_offset + y) % 2;
+        if (width <= first) {
+            continue;
+        }
+        real_t *real = &p_real[y * stride + first];
+        real_t *imag = &p_imag[y * stride + first];
+        size_t count = (width - first) & ~size_t(1);
+        size_t k = 0;
+        for (; k + V::lanes <= count; k += V::lanes) {
+            typename V::vector self_real = V::load(&real[k]);
+            typename V::vector self_imag = V::load(&imag[k]);
+            typename V::vector new_real, new_imag;
+            pair_update_avx2<imaginary, V>(va, vb, self_real, self_imag, V::swap_pairs(self_real), V::swap_pairs(self_imag), &new_real, &new_imag);
+            V::store(&real[k], new_real);
+            V::store(&imag[k], new_imag);
+        }
+        for (; k < count; k += 2) {
+            real_t self_real = real[k], self_imag = imag[k];
+            pair_update<imaginary>(a, b, self_real, self_imag, real[k + 1], imag[k + 1], &real[k], &imag[k]);
+            pair_update<imaginary>(a, b, real[k + 1], imag[k + 1], self_real, self_imag, &real[k + 1], &imag[k + 1]);
+        }
+    }
+}
+
+// below_mask selects the lanes whose partner is in the row below
+template<bool imaginary, int below_mask, typename real_t>
+static inline AVX2 void vertical_row_avx2(size_t stride, size_t height, size_t y, size_t x_start, size_t x_end,
+        typename Avx2<real_t>::vector a, typename Avx2<real_t>::vector b, real_t *p_real, real_t *p_imag,
+        real_t *saved_real, real_t *saved_imag) {
+    typedef Avx2<real_t> V;
+    const int above_mask = ~below_mask & V::all_mask;
+    for (size_t x = x_start; x < x_end; x += V::lanes) {
+        size_t idx = y * stride + x;
+        typename V::vector self_real = V::load(&p_real[idx]);
+        typename V::vector self_imag = V::load(&p_imag[idx]);
+        typename V::vector above_real = y > 0 ? V::load(&saved_real[x - x_start]) : self_real;
+        typename V::vector above_imag = y > 0 ? V::load(&saved_imag[x - x_start]) : self_imag;
+        typename V::vector below_real = y + 1 < height ? V::load(&p_real[idx + stride]) : self_real;
+        typename V::vector below_imag = y + 1 < height ? V::load(&p_imag[idx + stride]) : self_imag;
+        V::store(&saved_real[x - x_start], self_real);
+        V::store(&saved_imag[x - x_start], self_imag);
+        typename V::vector new_real, new_imag;
+        pair_update_avx2<imaginary, V>(a, b, self_real, self_imag,
+                                       V::template blend<below_mask>(above_real, below_real),
+                                       V::template blend<below_mask>(above_imag, below_imag),
+                                       &new_real, &new_imag);
+        // Dots on the first and last rows without a partner are left untouched
+        if (y == 0) {
+            new_real = V::template blend<above_mask>(new_real, self_real);
+            new_imag = V::template blend<above_mask>(new_imag, self_imag);
+        }
+        if (y + 1 == height) {
+            new_real = V::template blend<below_mask>(new_real, self_real);
+            new_imag = V::template blend<below_mask>(new_imag, self_imag);
+        }
+        V::store(&p_real[idx], new_real);
+        V::store(&p_imag[idx], new_imag);
+    }
+}
+
+template<bool imaginary, typename real_t>
+static AVX2 void block_kernel_vertical_avx2(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
+    typedef Avx2<real_t> V;
+    if (height < 2) {
+        return;
+    }
+    typename V::vector va = V::set1(a), vb = V::set1(b);
+    real_t saved_real[VERTICAL_STRIP], saved_imag[VERTICAL_STRIP];
+    for (size_t x_start = 0; x_start < width; x_start += VERTICAL_STRIP) {
+        size_t x_end = x_start + VERTICAL_STRIP < width ? x_start + VERTICAL_STRIP : width;
+        size_t x_vector_end = x_start + ((x_end - x_start) & ~(V::lanes - 1));
+        for (size_t y = 0; y < height; ++y) {
+            vertical_row_scalar<imaginary>(start_offset, stride, height, y, x_vector_end, x_end, a, b, p_real, p_imag,
+                                           &saved_real[x_vector_end - x_start], &saved_imag[x_vector_end - x_start]);
+            if ((start_offset + y) % 2 == 0) {
+                vertical_row_avx2<imaginary, V::even_mask>(stride, height, y, x_start, x_vector_end, va, vb, p_real, p_imag, saved_real, saved_imag);
+            }
+            else {
+                vertical_row_avx2<imaginary, V::odd_mask>(stride, height, y, x_start, x_vector_end, va, vb, p_real, p_imag, saved_real, saved_imag);
+            }
+        }
+    }
+}
+
+template<typename real_t> struct Avx512;
+
+template<> struct Avx512<double> {
+    typedef __m512d vector;
+    typedef __mmask8 mask;
+    static const size_t lanes = 8;
+    static const mask even_mask = 0x55;
+    static const mask odd_mask = 0xAA;
+    static const mask all_mask = 0xFF;
+    static inline AVX512 vector set1(double x) {
+        return _mm512_set1_pd(x);
+    }
+    static inline AVX512 vector load(const double *p) {
+        return _mm512_loadu_pd(p);
+    }
+    static inline AVX512 void store(double *p, vector x) {
+        _mm512_storeu_pd(p, x);
+    }
+    static inline AVX512 vector mul(vector a, vector b) {
+        return _mm512_mul_pd(a, b);
+    }
+    static inline AVX512 vector fmadd(vector a, vector b, vector c) {
+        return _mm512_fmadd_pd(a, b, c);
+    }
+    static inline AVX512 vector fnmadd(vector a, vector b, vector c) {
+        return _mm512_fnmadd_pd(a, b, c);
+    }
+    static inline AVX512 vector swap_pairs(vector x) {
+        return _mm512_permute_pd(x, 0x55);
+    }
+    static inline AVX512 vector blend(mask m, vector a, vector b) {
+        return _mm512_mask_blend_pd(m, a, b);
+    }
+};
+
+template<> struct Avx512<float> {
+    typedef __m512 vector;
+    typedef __mmask16 mask;
+    static const size_t lanes = 16;
+    static const mask even_mask = 0x5555;
+    static const mask odd_mask = 0xAAAA;
+    static const mask all_mask = 0xFFFF;
+    static inline AVX512 vector set1(float x) {
+        return _mm512_set1_ps(x);
+    }
+    static inline AVX512 vector load(const float *p) {
+        return _mm512_loadu_ps(p);
+    }
+    static inline AVX512 void store(float *p, vector x) {
+        _mm512_storeu_ps(p, x);
+    }
+    static inline AVX512 vector mul(vector a, vector b) {
+        return _mm512_mul_ps(a, b);
+    }
+    static inline AVX512 vector fmadd(vector a, vector b, vector c) {
+        return _mm512_fmadd_ps(a, b, c);
+    }
+    static inline AVX512 vector fnmadd(vector a, vector b, vector c) {
+        return _mm512_fnmadd_ps(a, b, c);
+    }
+    static inline AVX512 vector swap_pairs(vector x) {
+        return _mm512_permute_ps(x, 0xB1);
+    }
+    static inline AVX512 vector blend(mask m, vector a, vector b) {
+        return _mm512_mask_blend_ps(m, a, b);
+    }
+};
+
+// AVX-512: eight doubles or sixteen floats per vector
+template<bool imaginary, class V>
+static inline AVX512 void pair_update_avx512(typename V::vector a, typename V::vector b, typename V::vector self_real, typename V::vector self_imag,
+        typename V::vector peer_real, typename V::vector peer_imag, typename V::vector *real, typename V::vector *imag) {
+    if (imaginary) {
+        *real = V::fmadd(b, peer_real, V::mul(a, self_real));
+        *imag = V::fmadd(b, peer_imag, V::mul(a, self_imag));
+    }
+    else {
+        *real = V::fnmadd(b, peer_imag, V::mul(a, self_real));
+        *imag = V::fmadd(b, peer_real, V::mul(a, self_imag));
+    }
+}
+
+template<bool imaginary, typename real_t>
+static AVX512 void block_kernel_horizontal_avx512(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
+    typedef Avx512<real_t> V;
+    typename V::vector va = V::set1(a), vb = V::set1(b);
+    for (size_t y = 0; y < height; ++y) {
+        size_t first = (start_offset + y) % 2;
+        if (width <= first) {
+            continue;
+        }
+        real_t *real = &p_real[y * stride + first];
+        real_t *imag = &p_imag[y * stride + first];
+        size_t count = (width - first) & ~size_t(1);
+        size_t k = 0;
+        for (; k + V::lanes <= count; k += V::lanes) {
+            typename V::vector self_real = V::load(&real[k]);
+            typename V::vector self_imag = V::load(&imag[k]);
+            typename V::vector new_real, new_imag;
+            pair_update_avx512<imaginary, V>(va, vb, self_real, self_imag, V::swap_pairs(self_real), V::swap_pairs(self_imag), &new_real, &new_imag);
+            V::store(&real[k], new_real);
+            V::store(&imag[k], new_imag);
+        }
+        for (; k < count; k += 2) {
+            real_t self_real = real[k], self_imag = imag[k];
+            pair_update<imaginary>(a, b, self_real, self_imag, real[k + 1], imag[k + 1], &real[k], &imag[k]);
+            pair_update<imaginary>(a, b, real[k + 1], imag[k + 1], self_real, self_imag, &real[k + 1], &imag[k + 1]);
+        }
+    }
+}
+
+template<bool imaginary, typename real_t>
+static AVX512 void block_kernel_vertical_avx512(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag) {
+    typedef Avx512<real_t> V;
+    if (height < 2) {
+        return;
+    }
+    typename V::vector va = V::set1(a), vb = V::set1(b);
+    real_t saved_real[VERTICAL_STRIP], saved_imag[VERTICAL_STRIP];
+    for (size_t x_start = 0; x_start < width; x_start += VERTICAL_STRIP) {
+        size_t x_end = x_start + VERTICAL_STRIP < width ? x_start + VERTICAL_STRIP : width;
+        size_t x_vector_end = x_start + ((x_end - x_start) & ~(V::lanes - 1));
+        for (size_t y = 0; y < height; ++y) {
+            vertical_row_scalar<imaginary>(start_offset, stride, height, y, x_vector_end, x_end, a, b, p_real, p_imag,
+                                           &saved_real[x_vector_end - x_start], &saved_imag[x_vector_end - x_start]);
+            // Lanes whose partner is in the row below, and lanes with a partner at all
+            typename V::mask below_mask = (start_offset + y) % 2 == 0 ? V::even_mask : V::odd_mask;
+            typename V::mask update_mask = V::all_mask;
+            if (y == 0) {
+                update_mask &= below_mask;
+            }
+            if (y + 1 == height) {
+                update_mask &= ~below_mask;
+            }
+            for (size_t x = x_start; x < x_vector_end; x += V::lanes) {
+                size_t idx = y * stride + x;
+                typename V::vector self_real = V::load(&p_real[idx]);
+                typename V::vector self_imag = V::load(&p_imag[idx]);
+                typename V::vector above_real = y > 0 ? V::load(&saved_real[x - x_start]) : self_real;
+                typename V::vector above_imag = y > 0 ? V::load(&saved_imag[x - x_start]) : self_imag;
+                typename V::vector below_real = y + 1 < height ? V::load(&p_real[idx + stride]) : self_real;
+                typename V::vector below_imag = y + 1 < height ? V::load(&p_imag[idx + stride]) : self_imag;
+                V::store(&saved_real[x - x_start], self_real);
+                V::store(&saved_imag[x - x_start], self_imag);
+                typename V::vector new_real, new_imag;
+                pair_update_avx512<imaginary, V>(va, vb, self_real, self_imag,
+                                                 V::blend(below_mask, above_real, below_real),
+                                                 V::blend(below_mask, above_imag, below_imag),
+                                                 &new_real, &new_imag);
+                V::store(&p_real[idx], V::blend(update_mask, self_real, new_real));
+                V::store(&p_imag[idx], V::blend(update_mask, self_imag, new_imag));
+            }
+        }
+    }
+}
+
+#endif // X86_SIMD
+
+bool is_instruction_set_supported(string instruction_set) {
+    if (instruction_set == "scalar") {
+        return true;
+    }
+#ifdef X86_SIMD
+    __builtin_cpu_init();
+    if (instruction_set == "avx2") {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    if (instruction_set == "avx512") {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return false;
+}
+
+template<typename real_t>
+KineticKernels<real_t> get_kinetic_kernels(string instruction_set) {
+    KineticKernels<real_t> kernels;
+    if (!is_instruction_set_supported(instruction_set)) {
+        my_abort("Instruction set " + instruction_set + " is not supported on this CPU or by this build");
+    }
+    kernels.name = "scalar";
+    kernels.vertical = block_kernel_vertical<real_t>;
+    kernels.vertical_imaginary = block_kernel_vertical_imaginary<real_t>;
+    kernels.horizontal = block_kernel_horizontal<real_t>;
+    kernels.horizontal_imaginary = block_kernel_horizontal_imaginary<real_t>;
+#ifdef X86_SIMD
+    if (instruction_set == "avx2") {
+        kernels.name = "avx2";
+        kernels.vertical = block_kernel_vertical_avx2<false, real_t>;
+        kernels.vertical_imaginary = block_kernel_vertical_avx2<true, real_t>;
+        kernels.horizontal = block_kernel_horizontal_avx2<false, real_t>;
+        kernels.horizontal_imaginary = block_kernel_horizontal_avx2<true, real_t>;
+    }
+    else if (instruction_set == "avx512") {
+        kernels.name = "avx512";
+        kernels.vertical = block_kernel_vertical_avx512<false, real_t>;
+        kernels.vertical_imaginary = block_kernel_vertical_avx512<true, real_t>;
+        kernels.horizontal = block_kernel_horizontal_avx512<false, real_t>;
+        kernels.horizontal_imaginary = block_kernel_horizontal_avx512<true, real_t>;
+    }
+#endif
+    return kernels;
+}
+
+template<typename real_t>
+KineticKernels<real_t> select_kinetic_kernels() {
+    if (is_instruction_set_supported("avx512")) {
+        return get_kinetic_kernels<real_t>("avx512");
+    }
+    if (is_instruction_set_supported("avx2")) {
+        return get_kinetic_kernels<real_t>("avx2");
+    }
+    return get_kinetic_kernels<real_t>("scalar");
+}
+
+template KineticKernels<double> get_kinetic_kernels<double>(string instruction_set);
+template KineticKernels<float> get_kinetic_kernels<float>(string instruction_set);
+template KineticKernels<double> select_kinetic_kernels<double>();
+template KineticKernels<float> select_kinetic_kernels<float>();
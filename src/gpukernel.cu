@@ -386,6 +386,18 @@ void CC2Kernel::update_potential(double *_external_pot_real, double *_external_p
     CUDA_SAFE_CALL(cudaMemcpy(dev_external_pot_imag[which], external_pot_imag[which], tile_width * tile_height * sizeof(double), cudaMemcpyHostToDevice));
 }
 
+void CC2Kernel::set_sample(size_t src_stride, size_t x, size_t y, size_t width, size_t height, const double * src_real, const double * src_imag, const double * src_real2, const double * src_imag2) {
+    my_abort("The GPU kernel does not overwrite the evolved wave function.");
+}
+
+void CC2Kernel::update_separable_potential(const double *pot_x_real, const double *pot_x_imag, const double *pot_y_real, const double *pot_y_imag, int which) {
+    my_abort("The GPU kernel only stores the evolution operator of the potential as a matrix.");
+}
+
+void CC2Kernel::set_time_step(double delta_t) {
+    my_abort("The GPU kernel does not change the time step during the evolution.");
+}
+
 
 CC2Kernel::~CC2Kernel() {
     CUDA_SAFE_CALL(cudaFreeHost(left_real_receive));
@@ -486,14 +498,7 @@ double CC2Kernel::calculate_squared_norm(bool global) const {
     norm2 = norm2 * norm2 + result_imag * result_imag;
 #ifdef HAVE_MPI
     if (global) {
-        int nProcs = 1;
-        MPI_Comm_size(cartcomm, &nProcs);
-        double *sums = new double[nProcs];
-        MPI_Allgather(&norm2, 1, MPI_DOUBLE, sums, 1, MPI_DOUBLE, cartcomm);
-        norm2 = 0.;
-        for(int i = 0; i < nProcs; i++)
-            norm2 += sums[i];
-        delete [] sums;
+        MPI_Allreduce(MPI_IN_PLACE, &norm2, 1, MPI_DOUBLE, MPI_SUM, cartcomm);
     }
 #endif
     return norm2 * delta_x * delta_y;
@@ -33,24 +33,282 @@
 #define DOWN  1
 #define LEFT  2
 #define RIGHT 3
+#define UP_LEFT    4
+#define UP_RIGHT   5
+#define DOWN_LEFT  6
+#define DOWN_RIGHT 7
 
 #define BLOCK_WIDTH_CACHE 128u
 #define BLOCK_HEIGHT_CACHE 128u
+#define BLOCK_WIDTH_MAX 512u
 
 /** Functions defining Euclidean geometry
+ *
+ * The kernels are templates over the type real_t the wave function is stored in, instantiated for double and float.
+ * Coefficients are passed in double and rounded to real_t inside the kernels.
  */
-void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
-void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
-void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
-void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
-void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height, double offset_x, double _kin_radial, double * p_real, double * p_imag);
-void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double offset_x, double _kin_radial, double * p_real, double * p_imag);
-void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag);
-void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag);
-void block_kernel_rotation(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag);
-void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag);
-void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
-void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
+template<typename real_t> void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height, const real_t *radial, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, const real_t *radial, real_t * p_real, real_t * p_imag);
+/// Fill table with the (a, b, c) coefficients of the radial kinetic kernels for count columns at radial coordinates offset_x, offset_x + 1, ...
+template<typename real_t> void radial_coefficients(bool imag_time, double kin_radial, double offset_x, size_t count, real_t *table);
+template<typename real_t> void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_rotation(size_t stride, size_t width, size_t height, const real_t *rotation_x, const real_t *rotation_y, real_t * p_real, real_t * p_imag);
+template<typename real_t> void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, const real_t *rotation_x, const real_t *rotation_y, real_t * p_real, real_t * p_imag);
+/// Fill table with the (a, b) pairs of the rotation kernels for count dots at coordinates offset, offset + 1, ...: cos and sin of alpha times the coordinate, cosh and sinh in imaginary time.
+template<typename real_t> void rotation_coefficients(bool imag_time, double alpha, double offset, size_t count, real_t *table);
+template<typename real_t> void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, real_t *p_real, real_t *p_imag, real_t *pb_real, real_t *pb_imag);
+template<typename real_t> void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, real_t *p_real, real_t *p_imag, real_t *pb_real, real_t *pb_imag);
+
+/// Signature of the kinetic kernels, which evolve pairs of neighbouring dots along one axis.
+template<typename real_t>
+using kinetic_kernel = void (*)(size_t start_offset, size_t stride, size_t width, size_t height, real_t a, real_t b, real_t * p_real, real_t * p_imag);
+
+/**
+ * \brief Kinetic kernels compiled for one instruction set.
+ *
+ * The vectorised variants are built into every binary and one of them is picked at run time from CPUID,
+ * so the same library runs on AVX2 and AVX-512 machines, falling back to the scalar kernels elsewhere.
+ */
+template<typename real_t>
+struct KineticKernels {
+    const char *name;                                   ///< Instruction set: "scalar", "avx2" or "avx512".
+    kinetic_kernel<real_t> vertical;                    ///< Vertical pairs, real time evolution.
+    kinetic_kernel<real_t> vertical_imaginary;          ///< Vertical pairs, imaginary time evolution.
+    kinetic_kernel<real_t> horizontal;                  ///< Horizontal pairs, real time evolution.
+    kinetic_kernel<real_t> horizontal_imaginary;        ///< Horizontal pairs, imaginary time evolution.
+};
+
+bool is_instruction_set_supported(string instruction_set);    ///< Whether the CPU and the build support the kinetic kernels for instruction_set ("scalar", "avx2" or "avx512").
+template<typename real_t> KineticKernels<real_t> get_kinetic_kernels(string instruction_set);   ///< Kinetic kernels for the given instruction set.
+template<typename real_t> KineticKernels<real_t> select_kinetic_kernels();                      ///< Fastest kinetic kernels supported by the CPU.
+
+/// Signature of the potential kernels, which apply the external potential and the nonlinear phase to each dot. A NULL external_pot_real stands for no external potential; the imaginary time kernels never read external_pot_imag.
+template<typename real_t>
+using potential_kernel = void (*)(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                                  const real_t *external_pot_real, const real_t *external_pot_imag, const real_t *pb_real, const real_t *pb_imag, real_t * p_real, real_t * p_imag);
+
+/**
+ * \brief Potential kernels for one accuracy of the nonlinear phase.
+ *
+ * "full" calls sin, cos and exp from libm; "high" (error around 1e-12) and "fast" (around 1e-8) use branch-free polynomials that vectorise.
+ * In single precision both polynomial tiers are accurate to the precision of float.
+ */
+template<typename real_t>
+struct PotentialKernels {
+    const char *accuracy;                       ///< Accuracy of the phase: "full", "high" or "fast".
+    potential_kernel<real_t> real_time;         ///< Real time evolution.
+    potential_kernel<real_t> imaginary_time;    ///< Imaginary time evolution.
+};
+
+template<typename real_t> PotentialKernels<real_t> get_potential_kernels(string accuracy);      ///< Potential kernels for the given accuracy of the nonlinear phase.
+
+/// Signature of the kernels that exponentiate count values of the external potential into the evolution operator of a time step delta_t. In imaginary time the operator is real and pot_imag may be NULL.
+typedef void (*exp_potential_kernel)(bool imag_time, double delta_t, size_t count, const double *potential, double *pot_real, double *pot_imag);
+
+exp_potential_kernel get_exp_potential_kernel(string accuracy);      ///< Exponentiation of the external potential for the given accuracy of the phase.
+
+/// Evolve a scratch block by one time step of the splitting sequence. When potential_x is not NULL, the evolution operator of the external potential is the product of potential_x and potential_y, (real, imaginary) pairs per column and per row of the block, instead of external_pot_real and external_pot_imag; when both potential_x and external_pot_real are NULL there is no external potential.
+template<typename real_t>
+using block_step = void (*)(size_t stride, size_t width, size_t height,
+                            const real_t *radial, const real_t *rotation_x, const real_t *rotation_y, const real_t *potential_x, const real_t *potential_y,
+                            double aH, double bH, double aV, double bV, double coupling_a, double coupling_b, double coupling_aa,
+                            size_t tile_width, const real_t *external_pot_real, const real_t *external_pot_imag,
+                            const real_t *pb_real, const real_t *pb_imag, real_t * real, real_t * imag,
+                            const KineticKernels<real_t> &kinetic, const PotentialKernels<real_t> &potential);
+
+/**
+ * \brief Block step compiled for the given terms of the Hamiltonian.
+ *
+ * Every combination of the flags is a separate template instance, so the step runs with no run-time tests on them.
+ * The fused instances apply the splitting sequence as a wavefront of rows that stay in cache, the others sweep the block once per factor.
+ */
+template<typename real_t>
+block_step<real_t> get_block_step(bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool two_dimensional, bool fused = true);
+
+#define TILE_SIDE 16u
+
+/**
+ * \brief Memory layout of the wave function in the tile buffers of the CPU kernel.
+ *
+ * "split" stores the real and the imaginary parts in two row-major arrays.
+ * "interleaved" stores the (real, imaginary) pairs of the dots in one row-major array.
+ * "tiled" stores the pairs in TILE_SIDE x TILE_SIDE tiles, the dots of a tile and the tiles of the lattice in row-major order.
+ * In the last two the imaginary part is read through the buffer pointer plus one, so that the dot (x, y) is at index(x, y) in both parts in every layout.
+ * The blocks are evolved in split scratch buffers, and the layout only changes the way they are read from and written back to the tile.
+ */
+class TileLayout {
+public:
+    TileLayout(string name = "split", size_t width = 0, size_t height = 0);
+    /// Index of the dot (x, y) of the tile in the buffers of both parts.
+    size_t index(size_t x, size_t y) const {
+        switch (kind) {
+        case INTERLEAVED:
+            return 2 * (y * width + x);
+        case TILED:
+            return 2 * ((((y / TILE_SIDE) * tiles_x + x / TILE_SIDE) * TILE_SIDE + y % TILE_SIDE) * TILE_SIDE + x % TILE_SIDE);
+        default:
+            return y * width + x;
+        }
+    }
+    /// Number of dots stored contiguously in a row, starting from the column x.
+    size_t run(size_t x) const {
+        return kind == TILED ? TILE_SIDE - x % TILE_SIDE : width - x;
+    }
+    size_t size() const;      ///< Number of values of a buffer: one part in the split layout, both parts in the others.
+    bool split() const {
+        return kind == SPLIT;
+    }
+    string name;      ///< Name of the layout (split, interleaved or tiled).
+    size_t width;     ///< Width of the tile (number of lattice's dots).
+    size_t height;    ///< Height of the tile (number of lattice's dots).
+
+private:
+    enum { SPLIT, INTERLEAVED, TILED } kind;
+    size_t tiles_x;   ///< Number of tiles in a row (tiled layout only).
+};
+
+#define SCRATCH_ALIGNMENT 64u
+
+/**
+ * \brief Scratch memory of the threads of a CPU kernel.
+ *
+ * Every thread owns a slot, aligned to SCRATCH_ALIGNMENT bytes, where it evolves its blocks.
+ * The slots are allocated once and reused at every step, so that the evolution does not go through the heap allocator;
+ * reserve only allocates again when a slot has to grow or there are more threads.
+ */
+class ScratchArena {
+public:
+    ScratchArena();
+    ~ScratchArena();
+    void reserve(size_t bytes);    ///< Make the slot of every thread at least bytes long, rounded up to whole cache lines.
+    /// Slot of the calling thread.
+    void *slot() const {
+#ifdef _OPENMP
+        return memory + omp_get_thread_num() * slot_size;
+#else
+        return memory;
+#endif
+    }
+
+private:
+    ScratchArena(const ScratchArena &);
+    ScratchArena &operator=(const ScratchArena &);
+    char *memory;         ///< Slots of the threads, allocated with new_grid so that every thread first touches its own.
+    size_t slot_size;     ///< Bytes of a slot, a multiple of SCRATCH_ALIGNMENT.
+    int slot_count;       ///< Number of slots.
+};
+
+/// Block of a band of rows of the tile, the unit of work of the threads of a CPU kernel.
+struct BlockTask {
+    size_t read_y;          ///< First row of the band.
+    size_t read_height;     ///< Rows of the band read by the block.
+    size_t write_offset;    ///< Rows at the top of the band that are only read.
+    size_t write_height;    ///< Rows written back, below write_offset.
+    size_t block;           ///< Index of the block in the band: the first and the last blocks hold the sides of the tile.
+};
+
+/**
+ * \brief Blocks evolved by the threads of a CPU kernel, with work stealing.
+ *
+ * The tasks are planned once, in the order of the rows. In every parallel region each thread starts from its own
+ * contiguous share of the list, the rows it zeroed when the grids were allocated (see allocate_grid), and takes its
+ * tasks one at a time; a thread that runs out of tasks takes the remaining ones of the other threads.
+ * Uneven blocks, such as the narrow last block of a band or the sides of a cylindrical tile, are thus balanced,
+ * and a wide tile with few bands is split among all the threads.
+ */
+class BlockSchedule {
+public:
+    BlockSchedule();
+    ~BlockSchedule();
+    void plan(size_t capacity);    ///< Drop the tasks and make room for capacity of them.
+    void add(size_t read_y, size_t read_height, size_t write_offset, size_t write_height, size_t block);    ///< Append a task.
+    void reserve_threads();    ///< Make room for the cursors of every thread.
+    void start(int thread, int threads);    ///< Point the cursor of the calling thread to its share; every thread calls it, then waits for the others.
+    /// Next task of the calling thread, or NULL when no thread has tasks left.
+    const BlockTask *next(int thread, int threads) {
+        for (int i = 0; i < threads; i++) {
+            int victim = (thread + i) % threads;
+            int task;
+            #pragma omp atomic capture
+            task = cursors[victim * CURSOR_STRIDE]++;
+            if (task < ends[victim * CURSOR_STRIDE]) {
+                return &tasks[task];
+            }
+        }
+        return NULL;
+    }
+    int size() const {
+        return task_count;
+    }
+
+private:
+    BlockSchedule(const BlockSchedule &);
+    BlockSchedule &operator=(const BlockSchedule &);
+    static const int CURSOR_STRIDE = SCRATCH_ALIGNMENT / sizeof(int);    ///< Distance between the cursors of two threads, so that they do not share a cache line.
+    BlockTask *tasks;     ///< Planned tasks.
+    int task_count;       ///< Number of planned tasks.
+    int *cursors;         ///< Next task of the share of every thread.
+    int *ends;            ///< End of the share of every thread.
+    int thread_count;     ///< Number of threads the cursors have room for.
+};
+
+/**
+ * \brief Dots of the previous time step that the blocks of a CPU kernel evolving in place read but do not write.
+ *
+ * Two neighbouring blocks overlap by twice the halo: each of them reads the dots around its edges and writes back only its inner part,
+ * which the other one reads. Before every step a kernel that evolves the tile in place copies the 2 * halo_y rows across each boundary
+ * between two bands and the 2 * halo_x columns across each boundary between two blocks of a band, and the blocks read their edges
+ * from the copies, so that the tile needs no second buffer for the next time step.
+ */
+template<typename real_t>
+class ShadowStrips {
+public:
+    ShadowStrips();
+    ~ShadowStrips();
+    void plan(size_t tile_width, size_t tile_height, size_t halo_x, size_t halo_y, size_t band_step, size_t row_boundaries, size_t block_step, size_t column_boundaries);    ///< Make room for the strips across row_boundaries boundaries between bands band_step rows apart and column_boundaries boundaries between blocks block_step columns apart.
+    void save(const TileLayout &layout, const real_t *real, const real_t *imag);    ///< Copy the strips of a tile, before a step overwrites it.
+    /// Copy the width x height block at (x, y), the block-th of its band, to two split arrays: the write_width x write_height rectangle it writes back, at (write_x, write_y) in the block, from the tile and the rest from the strips.
+    void load(const TileLayout &layout, const real_t *real, const real_t *imag, size_t block, size_t x, size_t y, size_t width, size_t height,
+              size_t write_x, size_t write_y, size_t write_width, size_t write_height, real_t *dest_real, real_t *dest_imag, size_t dest_stride) const;
+    string placement() const;    ///< Describe on which NUMA nodes the strips are placed, one line per buffer.
+
+private:
+    ShadowStrips(const ShadowStrips &);
+    ShadowStrips &operator=(const ShadowStrips &);
+    real_t *rows[2];              ///< Real and imaginary parts of the row strips: 2 * halo_y rows of the tile per boundary.
+    real_t *columns[2];           ///< Real and imaginary parts of the column strips: for every row of the tile, 2 * halo_x values per boundary.
+    size_t tile_width;            ///< Width of the tile (number of lattice's dots).
+    size_t tile_height;           ///< Height of the tile (number of lattice's dots).
+    size_t halo_x;                ///< Thickness of the vertical halos (number of lattice's dots).
+    size_t halo_y;                ///< Thickness of the horizontal halos (number of lattice's dots).
+    size_t band_step;             ///< Distance between the first rows of two bands.
+    size_t row_boundaries;        ///< Number of boundaries between two bands.
+    size_t block_step;            ///< Distance between the first columns of two blocks of a band.
+    size_t column_boundaries;     ///< Number of boundaries between two blocks of a band.
+};
+
+#ifdef HAVE_MPI
+/**
+ * \brief Header of the tile of a CPU kernel exchanging its halos in shared memory, at the start of its segment of the window of the node.
+ *
+ * The neighbours on the same node read the geometry of the tile to find the strips they copy, and the two counters to know when
+ * the strips of an exchange are written and when they have all been copied.
+ */
+struct SharedTile {
+    volatile long published;    ///< Halo exchanges whose strips have been written by the step.
+    volatile long consumed;     ///< Halo exchanges whose halos have been copied from all the neighbours on the node.
+    size_t width;               ///< Width of the tile (number of lattice's dots).
+    size_t height;              ///< Height of the tile (number of lattice's dots).
+    size_t inner[4];            ///< Inner part of the tile: first column and row, then the ends.
+    size_t offsets[2][2][2];    ///< Distance in bytes from the header to the real and imaginary parts of each buffer of each wave function; 0 for no buffer.
+};
+#endif
+
 /**
  * \brief This class defines the CPU kernel.
  *
@@ -61,48 +319,89 @@ void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double
  *  - intra species interaction
  *  - extra species interaction
  *  - Rabi coupling
+ *
+ * The wave function is stored in real_t and the norms are accumulated in accum_t:
+ * CPUBlock<double, double> is the "cpu" kernel, CPUBlock<float, float> is "cpu-float" and CPUBlock<float, double> is "cpu-mixed".
+ * Single precision halves the memory traffic and doubles the SIMD width, at the cost of a norm drift of about 1e-8 per step in real time.
+ * The tile buffers are stored in the memory layout named at construction (see TileLayout); the states are converted when the kernel is built and by get_sample.
+ * A kernel built in place keeps a single buffer per wave function and writes the evolved blocks straight back to it, reading the edges of
+ * the blocks from ShadowStrips; with two wave functions only the second one is evolved in place, since the first one has to be read at the
+ * previous time step while the second one is evolved.
+ * Under MPI the halos are exchanged with persistent requests built with the kernel: left and right first, then the full rows up and down,
+ * which carry the corners; or, with exchange_corners, with all eight neighbours at once. With shared_halos the buffers live in a
+ * shared memory window of the node (MPI 3), and the halos of the neighbours on the same node are copied straight from their buffers.
  */
 
+template<typename real_t, typename accum_t>
 class CPUBlock: public ITrotterKernel {
 public:
-    CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
+    CPUBlock(Lattice *grid, State *state, Hamiltonian *_hamiltonian,
              double *_external_pot_real, double *_external_pot_imag,
-             double delta_t, double _norm, bool _imag_time);    ///< Instantiate the kernel for single wave functions state evolution.
+             double delta_t, double _norm, bool _imag_time, string phase_accuracy = "full", string memory_layout = "split",
+             size_t _block_width = BLOCK_WIDTH_CACHE, size_t _block_height = BLOCK_HEIGHT_CACHE, bool _in_place = false, string halo_exchange = "phases");    ///< Instantiate the kernel for single wave functions state evolution.
 
 
     CPUBlock(Lattice *grid, State *state1, State *state2,
-             Hamiltonian2Component *hamiltonian,
+             Hamiltonian2Component *_hamiltonian,
              double **_external_pot_real, double **_external_pot_imag,
-             double delta_t, double *_norm, bool _imag_time);    ///< Instantiate the kernel for two wave functions state evolution.
+             double delta_t, double *_norm, bool _imag_time, string phase_accuracy = "full", string memory_layout = "split",
+             size_t _block_width = BLOCK_WIDTH_CACHE, size_t _block_height = BLOCK_HEIGHT_CACHE, bool _in_place = false, string halo_exchange = "phases");    ///< Instantiate the kernel for two wave functions state evolution.
 
     ~CPUBlock();
     void run_kernel_on_halo();          ///< Evolve blocks of wave function at the edge of the tile. This comprises the halos.
     void run_kernel();              ///< Evolve the remaining blocks in the inner part of the tile.
-    void wait_for_completion();         ///< Synchronize all the processes at the end of halos communication. Perform normalization for imaginary time evolution in the case of single wave-function evolution.
+    void wait_for_completion();         ///< Synchronize all the processes at the end of halos communication. Perform normalization for imaginary time evolution, with the squared norm summed over the tiles while the halos were exchanged.
     void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function from the two buffers pointed by p_real and p_imag, without halos, to dest_real and dest_imag.
+    void set_sample(size_t src_stride, size_t x, size_t y, size_t width, size_t height, const double * src_real, const double * src_imag, const double * src_real2 = 0, const double * src_imag2 = 0); ///< Copy src_real and src_imag to the two buffers pointed by p_real and p_imag.
     void normalization();    ///< Normalize the state when performing an imaginary time evolution (only two wave-function evolution).
     void rabi_coupling(double var, double delta_t);    ///< Evolution corresponding to the Rabi coupling term of the Hamiltonian (only two wave-function evolution).
     double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the state.
-    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update memory pointed by external_potential_real and external_potential_imag (only non static external potential).
+    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update memory pointed by external_potential_real and external_potential_imag (only non static external potential); NULL tables when there is no external potential, a NULL imaginary table in imaginary time.
+    void update_separable_potential(const double *pot_x_real, const double *pot_x_imag, const double *pot_y_real, const double *pot_y_imag, int which);    ///< Keep the evolution operator of the external potential as a factor per column and a factor per row of the tile.
+    void set_time_step(double delta_t);    ///< Recompute the kinetic, rotation and nonlinear coefficients for a step of delta_t; the potentials of the new step must be passed to update_potential afterwards.
     void cpy_first_positive_to_first_negative();    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
-    bool runs_in_place() const {
-        return false;
-    }
+    bool runs_in_place() const;    ///< Whether the kernel evolves the arrays of the state itself, so that get_sample has nothing to copy: a single wave function evolved in place, in double precision and in the split layout.
     /// Get kernel name.
     string get_name() const {
         return "CPU";
     };
 
-    void start_halo_exchange();         ///< Start vertical halos exchange.
-    void finish_halo_exchange();        ///< Start horizontal halos exchange.
+    void start_halo_exchange();         ///< Start the halo exchange of the buffer written by the step: the vertical halos, or all of them when exchanging the corners; with shared halos, tell the neighbours on the node that the strips are written.
+    void finish_halo_exchange();        ///< Complete the halo exchange, running the horizontal halos after the vertical ones unless exchanging the corners; with shared halos, copy the halos of the neighbours on the node and wait until they have copied theirs.
+    string memory_placement() const;    ///< Describe on which NUMA nodes the buffers of the kernel are placed, one line per buffer; the buffers shared with the solver are left to it.
 
 
 
 private:
-    double *p_real[2][2];       ///< Array of two pointers that point to two buffers used to store the real part of the wave function at i-th time step and (i+1)-th time step.
-    double *p_imag[2][2];       ///< Array of two pointers that point to two buffers used to store the imaginary part of the wave function at i-th time step and (i+1)-th time step.
-    double *external_pot_real[2];   ///< Points to the matrix representation (real entries) of the operator given by the exponential of external potential.
-    double *external_pot_imag[2];   ///< Points to the matrix representation (immaginary entries) of the operator given by the exponential of external potential.
+    void set_coefficients(double delta_t);    ///< Compute the coefficients of the evolution operators which depend on the time step.
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system, read again when the time step changes.
+    real_t *p_real[2][2];       ///< Array of two pointers that point to two buffers used to store the real part of the wave function at i-th time step and (i+1)-th time step; both point to the same buffer for a wave function evolved in place.
+    real_t *p_imag[2][2];       ///< Array of two pointers that point to two buffers used to store the imaginary part of the wave function at i-th time step and (i+1)-th time step (p_real plus one if the layout is not split).
+    bool in_place;              ///< Whether the kernel was built in place.
+    bool exchange_corners;      ///< Whether the corners of the halos come straight from the diagonal neighbours, so that the whole exchange runs alongside run_kernel.
+    bool shared_halos;          ///< Whether the buffers are in the shared window of the node, the neighbours on the node copying their halos from each other (implies exchange_corners).
+    ShadowStrips<real_t> strips;    ///< Edges of the blocks at the previous time step, for the wave function evolved in place.
+    /// Whether the wave function being evolved has a single buffer.
+    bool evolves_in_place() const {
+        return p_real[state_index][0] == p_real[state_index][1];
+    }
+    TileLayout layout;          ///< Memory layout of the buffers pointed by p_real and p_imag.
+    ScratchArena scratch;       ///< Scratch blocks of the threads, and the rows the Rabi coupling goes through in a layout that is not split.
+    void reserve_scratch();     ///< Make room in scratch for the blocks and the rows of every thread.
+    BlockSchedule inner_blocks;    ///< Blocks evolved by run_kernel: the inner blocks of the inner bands.
+    BlockSchedule halo_blocks;     ///< Blocks evolved by run_kernel_on_halo: the blocks next to the halos.
+    void plan_blocks();    ///< Plan the blocks of run_kernel and run_kernel_on_halo for the size of the tile and of the blocks.
+    void run_blocks(BlockSchedule &blocks);    ///< Evolve the planned blocks with all the threads.
+    bool normalizes_steps() const;    ///< Whether the state is normalized after every step: in imaginary time, unless its norm is zero.
+    void start_norm_sum();    ///< Start adding up the squared norm of the tiles, which the halos left to receive are not part of.
+    bool stream_stores;         ///< Whether the blocks are written back to a split tile with non-temporal stores, because the buffers swept at every step do not fit in the last-level cache.
+    real_t *pb_real;            ///< Split copy of the real part of the other wave function, read by the potential step (two wave functions in a layout that is not split).
+    real_t *pb_imag;            ///< Split copy of the imaginary part of the other wave function, read by the potential step (two wave functions in a layout that is not split).
+    real_t *external_pot_real[2];   ///< Points to the matrix representation (real entries) of the operator given by the exponential of external potential; NULL when there is no external potential or it is separable.
+    real_t *external_pot_imag[2];   ///< Points to the matrix representation (immaginary entries) of the operator given by the exponential of external potential; NULL in imaginary time, where the operator is real.
+    real_t *potential_x[2];     ///< Factor per column of the evolution operator of a separable external potential, as (real, imaginary) pairs; NULL when the operator is stored in external_pot_real and external_pot_imag.
+    real_t *potential_y[2];     ///< Factor per row of the evolution operator of a separable external potential, as (real, imaginary) pairs.
+    double pot_scale[2];        ///< Factor applied to the converted potentials to cancel the norm drift due to the rounding of the kinetic coefficients (single precision only).
     double *aH;            ///< Diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *bH;            ///< Off diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *aV;            ///< Diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
@@ -118,18 +417,27 @@ private:
     int state_index;    ///< Takes values 0 or 1 and tells which wave function is pointed by p_real and p_imag, and is being evolved.
     size_t halo_x;          ///< Thickness of the vertical halos (number of lattice's dots).
     size_t halo_y;          ///< Thickness of the horizontal halos (number of lattice's dots).
+    size_t block_halo_x;    ///< Number of columns a time step reads on each side of a block: the halos are as many times thicker as the steps between two exchanges.
+    size_t block_halo_y;    ///< Number of rows a time step reads above and below a block.
     size_t tile_width;        ///< Width of the tile (number of lattice's dots).
     size_t tile_height;       ///< Height of the tile (number of lattice's dots).
     bool imag_time;         ///< True: imaginary time evolution; False: real time evolution.
-    static const size_t block_width = BLOCK_WIDTH_CACHE;      ///< Width of the lattice block which is cached (number of lattice's dots).
-    size_t block_height;     ///< Height of the lattice block which is cached (number of lattice's dots).
+    size_t block_width;      ///< Width of the lattice block which is cached (number of lattice's dots), at most BLOCK_WIDTH_MAX.
+    size_t block_height;     ///< Height of the lattice block which is cached (number of lattice's dots); 1 on one-dimensional lattices.
+    void set_block_size(size_t width, size_t height);    ///< Check and set the size of the blocks.
     bool two_wavefunctions;    ///< Flag parameter to distinguish whether the kernel is evolving a two-wave-function or a single-wave-function
+    KineticKernels<real_t> kinetic_kernels;    ///< Kinetic kernels picked at construction for the instruction set of the CPU.
+    block_step<real_t> step;                   ///< Block step picked at construction for the Hamiltonian and the lattice.
+    PotentialKernels<real_t> potential_kernels;    ///< Potential kernels picked at construction for the requested accuracy of the nonlinear phase.
     int angular_momentum[2];   ///< Angular momentum when cylindrical coordinates are used.
 
     double alpha_x;         ///< Real coupling constant associated to the X*P_y operator, part of the angular momentum.
     double alpha_y;         ///< Real coupling constant associated to the Y*P_x operator, part of the angular momentum.
     double rot_coord_x;        ///< X axis coordinate of the center of rotation.
     double rot_coord_y;        ///< Y axis coordinate of the center of rotation.
+    real_t *rotation_x;      ///< Coefficients of the rotation kernels for each column of the tile, built with alpha_x.
+    real_t *rotation_y;      ///< Coefficients of the rotation kernels for each row of the tile, built with alpha_y.
+    real_t *radial[2];       ///< Coefficients of the radial kinetic kernels for each column of the tile and each wave function, in cylindrical coordinates.
     int start_x;          ///< X axis coordinate of the first dot of the processed tile.
     int start_y;          ///< Y axis coordinate of the first dot of the processed tile.
     int end_x;            ///< X axis coordinate of the last dot of the processed tile.
@@ -142,12 +450,23 @@ private:
     string coordinate_system;  ///< Type of the coordinate system used.
 #ifdef HAVE_MPI
     MPI_Comm cartcomm;        ///< Ensemble of processes communicating the halos and evolving the tiles.
-    int neighbors[4];       ///< Array that stores the processes' rank neighbour of the current process.
-    MPI_Request req[8];       ///< Variable to manage MPI communication.
-    MPI_Status statuses[8];     ///< Variable to manage MPI communication.
-    MPI_Datatype horizontalBorder;  ///< Datatype for the horizontal halos.
-    MPI_Datatype verticalBorder;  ///< Datatype for the vertical halos.
+    int neighbors[8];       ///< Array that stores the processes' rank neighbour of the current process, diagonal ones included.
+    MPI_Datatype halo_types[8][2];     ///< Datatypes of the halo received from each neighbour and of the inner strip sent to the opposite one.
+    MPI_Request exchange_requests[2][2][32];    ///< Persistent requests of the halo exchange of each buffer of each wave function: first those started by start_halo_exchange, then those started by finish_halo_exchange.
+    int first_requests;       ///< Number of requests started by start_halo_exchange.
+    int second_requests;      ///< Number of requests started by finish_halo_exchange.
+    void plan_halo_exchange();    ///< Build the datatypes and the persistent requests of the halo exchange, with the neighbours off the node when the halos are shared.
+    MPI_Comm node_comm;           ///< Processes of cartcomm on the node of this one, sharing shared_window (MPI_COMM_NULL unless shared_halos).
+    MPI_Win shared_window;        ///< Window holding the buffers of the tiles of the node, each one after its SharedTile.
+    SharedTile *shared_tile;      ///< Header of the tile of this process, in shared_window.
+    SharedTile *neighbor_tiles[8];    ///< Headers of the tiles of the neighbours on the node, NULL for the others.
+    TileLayout neighbor_layouts[8];   ///< Layouts of the buffers of the neighbours on the node.
+    long exchanges;               ///< Halo exchanges started so far, the same on every process.
+    void share_tiles();           ///< Move the buffers into shared_window.
+    void copy_shared_halos();     ///< Copy the halos of the buffer being exchanged from the neighbours on the node, once they have written their strips.
+    MPI_Request norm_request;     ///< Sum of norm_sum over the tiles, under way while the halos are exchanged.
 #endif
+    double norm_sum;          ///< Squared norm of the tile, then of the lattice once the sum started by start_norm_sum is over.
 };
 
 #ifdef CUDA
@@ -185,10 +504,13 @@ public:
     void run_kernel();							///< Evolve the remaining blocks in the inner part of the tile.
     void wait_for_completion();					///< Sincronize all the processes at the end of halos communication. Perform normalization for imaginary time evolution.
     void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function from the two buffers pointed by pdev_real and pdev_imag, without halos, to dest_real and dest_imag.
+    void set_sample(size_t src_stride, size_t x, size_t y, size_t width, size_t height, const double * src_real, const double * src_imag, const double * src_real2 = 0, const double * src_imag2 = 0); ///< Not supported by the GPU kernel.
     void normalization();    ///<Normalize the state when performing an imaginary time evolution (only two wave-function evolution).
     void rabi_coupling(double var, double delta_t);    ///< Evolution corresponding to the Rabi coupling term of the Hamiltonian (only two wave-function evolution).
     double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the state.
     void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update memory pointed by external_potential_real and external_potential_imag (only non static external potential).
+    void update_separable_potential(const double *pot_x_real, const double *pot_x_imag, const double *pot_y_real, const double *pot_y_imag, int which);    ///< Not supported by the GPU kernel.
+    void set_time_step(double delta_t);    ///< Not supported by the GPU kernel.
     void cpy_first_positive_to_first_negative();    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
     bool runs_in_place() const {
         return false;
@@ -200,6 +522,10 @@ public:
 
     void start_halo_exchange();		///< Empty function.
     void finish_halo_exchange();	///< Exchange halos.
+    /// The buffers of the GPU kernel are in device memory.
+    string memory_placement() const {
+        return "";
+    }
 
 private:
     dim3 numBlocks;						///< Number of blocks exploited in the lattice.
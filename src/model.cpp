@@ -17,9 +17,12 @@
  */
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 #include "trottersuzuki.h"
 #include "common.h"
 #include <math.h>
+#include <string.h>
 
 double const_potential(double x) {
     return 0.;
@@ -29,7 +32,122 @@ double const_potential(double x, double y) {
     return 0.;
 }
 
-Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coordinate_system) {
+static void check_exchange_interval(int exchange_interval) {
+    if (exchange_interval < 1) {
+        my_abort("The halos have to be exchanged at least every time step.");
+    }
+}
+
+// The halos of a tile are copied from the inner dots of the next tiles, which have to be at least as deep
+static void check_tile(int inner, int halo, bool exchanged) {
+    if (exchanged && inner < halo) {
+        stringstream message;
+        message << "The tiles are " << inner << " dots across, less than their halos (" << halo << "): use fewer processes or exchange the halos more often.";
+        my_abort(message.str());
+    }
+}
+
+/*
+ * The tiles follow the rank order of the Cartesian communicator, row by row. With group_nodes the processes sharing
+ * memory are given the tiles of a block of the grid, and the nodes are arranged so that the fewest halos cross them:
+ * the processes are ordered by their tile before building the topology. Without MPI 3, or when the nodes do not run
+ * as many processes each or cannot tile the grid, the processes keep the order of MPI_COMM_WORLD.
+ */
+void Lattice::create_topology(int length_x, int length_y, int procs_x, int procs_y, bool group_nodes) {
+    mpi_node = 0;
+    mpi_nodes = 1;
+#ifdef HAVE_MPI
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_procs);
+    int length[2] = {length_y, length_x}, halo[2] = {halo_y, halo_x};
+    mpi_dims[0] = procs_y;
+    mpi_dims[1] = procs_x;
+    process_grid(mpi_procs, length, halo, periods, mpi_dims);
+    MPI_Comm ordered = MPI_COMM_WORLD;
+#if MPI_VERSION >= 3
+    if (group_nodes) {
+        MPI_Comm node, leaders;
+        int world_rank, node_rank, node_procs, node_index, nodes, procs_range[2];
+        MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+        MPI_Comm_rank(node, &node_rank);
+        MPI_Comm_size(node, &node_procs);
+        // The first process of each node numbers the nodes
+        MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, world_rank, &leaders);
+        if (node_rank == 0) {
+            MPI_Comm_rank(leaders, &node_index);
+            MPI_Comm_size(leaders, &nodes);
+            MPI_Comm_free(&leaders);
+        }
+        MPI_Bcast(&node_index, 1, MPI_INT, 0, node);
+        MPI_Bcast(&nodes, 1, MPI_INT, 0, node);
+        MPI_Comm_free(&node);
+        procs_range[0] = -node_procs;
+        procs_range[1] = node_procs;
+        MPI_Allreduce(MPI_IN_PLACE, procs_range, 2, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        int node_dims[2];
+        if (nodes > 1 && -procs_range[0] == procs_range[1] && node_grid(nodes, mpi_dims, length, halo, periods, node_dims)) {
+            int block[2] = {mpi_dims[0] / node_dims[0], mpi_dims[1] / node_dims[1]};
+            int y = node_index / node_dims[1] * block[0] + node_rank / block[1];
+            int x = node_index % node_dims[1] * block[1] + node_rank % block[1];
+            MPI_Comm_split(MPI_COMM_WORLD, 0, y * mpi_dims[1] + x, &ordered);
+            mpi_node = node_index;
+            mpi_nodes = nodes;
+        }
+    }
+#endif
+    MPI_Cart_create(ordered, 2, mpi_dims, periods, 0, &cartcomm);
+    if (ordered != MPI_COMM_WORLD) {
+        MPI_Comm_free(&ordered);
+    }
+    MPI_Comm_rank(cartcomm, &mpi_rank);
+    MPI_Cart_coords(cartcomm, mpi_rank, 2, mpi_coords);
+#else
+    if (procs_x > 1 || procs_y > 1) {
+        my_abort("Compiled without MPI: the lattice is a single tile.");
+    }
+    mpi_procs = 1;
+    mpi_rank = 0;
+    mpi_dims[0] = mpi_dims[1] = 1;
+    mpi_coords[0] = mpi_coords[1] = 0;
+#endif
+}
+
+string Lattice::decomposition() {
+    // Coordinates, node, size of the tile and of its inner part for every process
+    const int fields = 7;
+    int tile[fields] = {mpi_coords[0], mpi_coords[1], mpi_node, end_x - start_x, end_y - start_y,
+                        inner_end_x - inner_start_x, inner_end_y - inner_start_y};
+    int *tiles = new int[fields * mpi_procs];
+#ifdef HAVE_MPI
+    MPI_Allgather(tile, fields, MPI_INT, tiles, fields, MPI_INT, cartcomm);
+#else
+    std::copy(tile, tile + fields, tiles);
+#endif
+    double volume = 0.;
+    for (int rank = 0; rank < mpi_procs; rank++) {
+        const int *t = &tiles[fields * rank];
+        volume += double(t[3]) * t[4] - double(t[5]) * t[6];
+    }
+    stringstream description;
+    description << mpi_dims[1] << "x" << mpi_dims[0] << " processes (x by y)";
+    if (mpi_nodes > 1) {
+        description << " on " << mpi_nodes << " nodes";
+    }
+    description << ", " << volume << " dots in the halos" << endl;
+    for (int rank = 0; rank < mpi_procs; rank++) {
+        const int *t = &tiles[fields * rank];
+        description << "rank " << rank << " at (" << t[1] << ", " << t[0] << ")";
+        if (mpi_nodes > 1) {
+            description << " on node " << t[2];
+        }
+        description << ": tile " << t[3] << "x" << t[4] << ", inner " << t[5] << "x" << t[6]
+                    << ", halos " << double(t[3]) * t[4] - double(t[5]) * t[6] << " dots" << endl;
+    }
+    delete [] tiles;
+    return description.str();
+}
+
+Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coordinate_system, int _exchange_interval, bool group_nodes) {
     if (_coordinate_system != "cartesian" &&
             _coordinate_system != "cylindrical") {
         my_abort("The coordinate system you have chosen is not implemented.");
@@ -51,33 +169,23 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
     delta_y = 1.0;
     periods[0] = 0;
     periods[1] = (int) periodic_x_axis;
-#ifdef HAVE_MPI
-    MPI_Comm_size(MPI_COMM_WORLD, &mpi_procs);
-    mpi_dims[0] = mpi_procs;
-    mpi_dims[1] = 1;
-    MPI_Dims_create(mpi_procs, 2, mpi_dims);  //partition all the processes (the size of MPI_COMM_WORLD's group) into an 2-dimensional topology
-    MPI_Cart_create(MPI_COMM_WORLD, 2, mpi_dims, periods, 0, &cartcomm);
-    MPI_Comm_rank(cartcomm, &mpi_rank);
-    MPI_Cart_coords(cartcomm, mpi_rank, 2, mpi_coords);
-#else
-    mpi_procs = 1;
-    mpi_rank = 0;
-    mpi_dims[0] = mpi_dims[1] = 1;
-    mpi_coords[0] = mpi_coords[1] = 0;
-#endif
-    halo_x = 4;
+    check_exchange_interval(_exchange_interval);
+    exchange_interval = _exchange_interval;
+    halo_x = 4 * exchange_interval;
     halo_y = 0;
+    create_topology(dim, 1, 0, 1, group_nodes);
     global_dim_x = dim + periods[1] * 2 * halo_x;
     global_dim_y = 1;
     global_no_halo_dim_x = dim;
     global_no_halo_dim_y = 1;
     //set dimension of tiles and offsets
-    calculate_borders(mpi_coords[0], mpi_dims[0], &start_x, &end_x,
+    calculate_borders(mpi_coords[1], mpi_dims[1], &start_x, &end_x,
                       &inner_start_x, &inner_end_x,
                       dim, halo_x, periods[1]);
     if (coordinate_system == "cylindrical" && mpi_coords[1] == 0) {
         inner_start_x += 1;
     }
+    check_tile(inner_end_x - inner_start_x, halo_x, periods[1] || mpi_dims[1] > 1);
     dim_x = end_x - start_x;
     start_y = 0;
     end_y = 1;
@@ -88,21 +196,24 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
 
 Lattice2D::Lattice2D(int dim, double _length,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string coordinate_system) {
+                     double angular_velocity, string coordinate_system, int exchange_interval,
+                     int procs_x, int procs_y, bool group_nodes) {
     init(dim, _length, dim, _length, periodic_x_axis, periodic_y_axis,
-         angular_velocity, coordinate_system);
+         angular_velocity, coordinate_system, exchange_interval, procs_x, procs_y, group_nodes);
 }
 
 Lattice2D::Lattice2D(int _dim_x, double _length_x, int _dim_y, double _length_y,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string coordinate_system) {
+                     double angular_velocity, string coordinate_system, int exchange_interval,
+                     int procs_x, int procs_y, bool group_nodes) {
     init(_dim_x, _length_x, _dim_y, _length_y, periodic_x_axis, periodic_y_axis,
-         angular_velocity, coordinate_system);
+         angular_velocity, coordinate_system, exchange_interval, procs_x, procs_y, group_nodes);
 }
 
 void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string _coordinate_system) {
+                     double angular_velocity, string _coordinate_system, int _exchange_interval,
+                     int procs_x, int procs_y, bool group_nodes) {
     if (_coordinate_system != "cartesian" &&
             _coordinate_system != "cylindrical") {
         my_abort("The coordinate system you have chosen is not implemented.");
@@ -124,21 +235,11 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     coordinate_system = _coordinate_system;
     periods[0] = (int) periodic_y_axis;
     periods[1] = (int) periodic_x_axis;
-    mpi_dims[0] = mpi_dims[1] = 0;
-#ifdef HAVE_MPI
-    MPI_Comm_size(MPI_COMM_WORLD, &mpi_procs);
-    MPI_Dims_create(mpi_procs, 2, mpi_dims);  //partition all the processes (the size of MPI_COMM_WORLD's group) into an 2-dimensional topology
-    MPI_Cart_create(MPI_COMM_WORLD, 2, mpi_dims, periods, 0, &cartcomm);
-    MPI_Comm_rank(cartcomm, &mpi_rank);
-    MPI_Cart_coords(cartcomm, mpi_rank, 2, mpi_coords);
-#else
-    mpi_procs = 1;
-    mpi_rank = 0;
-    mpi_dims[0] = mpi_dims[1] = 1;
-    mpi_coords[0] = mpi_coords[1] = 0;
-#endif
-    halo_x = (angular_velocity == 0. ? 4 : 8);
-    halo_y = (angular_velocity == 0. ? 4 : 8);
+    check_exchange_interval(_exchange_interval);
+    exchange_interval = _exchange_interval;
+    halo_x = (angular_velocity == 0. ? 4 : 8) * exchange_interval;
+    halo_y = (angular_velocity == 0. ? 4 : 8) * exchange_interval;
+    create_topology(_dim_x, _dim_y, procs_x, procs_y, group_nodes);
     global_dim_x = _dim_x + periods[1] * 2 * halo_x;
     global_dim_y = _dim_y + periods[0] * 2 * halo_y;
     global_no_halo_dim_x = _dim_x;
@@ -153,6 +254,8 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     calculate_borders(mpi_coords[0], mpi_dims[0], &start_y, &end_y,
                       &inner_start_y, &inner_end_y,
                       _dim_y, halo_y, periods[0]);
+    check_tile(inner_end_x - inner_start_x, halo_x, periods[1] || mpi_dims[1] > 1);
+    check_tile(inner_end_y - inner_start_y, halo_y, periods[0] || mpi_dims[0] > 1);
     dim_x = end_x - start_x;
     dim_y = end_y - start_y;
 }
@@ -161,20 +264,15 @@ State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_
     expected_values_updated = false;
     if (_p_real == 0) {
         self_init = true;
-        p_real = new double[grid->dim_x * grid->dim_y];
-        for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
-            p_real[i] = 0;
-        }
+        // Zeroed by the threads that evolve each row
+        p_real = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
     }
     else {
         self_init = false;
         p_real = _p_real;
     }
     if (_p_imag == 0) {
-        p_imag = new double[grid->dim_x * grid->dim_y];
-        for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
-            p_imag[i] = 0;
-        }
+        p_imag = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
     }
     else {
         p_imag = _p_imag;
@@ -186,8 +284,8 @@ State::State(const State &obj): grid(obj.grid), angular_momentum(obj.angular_mom
     mean_X(obj.mean_X), mean_XX(obj.mean_XX), mean_Y(obj.mean_Y), mean_YY(obj.mean_YY),
     mean_Px(obj.mean_Px), mean_PxPx(obj.mean_PxPx), mean_Py(obj.mean_Py), mean_PyPy(obj.mean_PyPy),
     norm2(obj.norm2) {
-    p_real = new double[grid->dim_x * grid->dim_y];
-    p_imag = new double[grid->dim_x * grid->dim_y];
+    p_real = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+    p_imag = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
     for (int y = 0; y < grid->dim_y; y++) {
         for (int x = 0; x < grid->dim_x; x++) {
             p_real[y * grid->dim_x + x] = obj.p_real[y * grid->dim_x + x];
@@ -198,8 +296,8 @@ State::State(const State &obj): grid(obj.grid), angular_momentum(obj.angular_mom
 
 State::~State() {
     if (self_init) {
-        delete [] p_real;
-        delete [] p_imag;
+        free_grid(p_real);
+        free_grid(p_imag);
     }
 }
 
@@ -402,9 +500,7 @@ void State::calculate_expected_values(void) {
     complex<double> const_1 = -1. / 12., const_2 = 4. / 3., const_3 = -2.5;
     complex<double> derivate1_1 = 1. / 6., derivate1_2 = - 1., derivate1_3 = 0.5, derivate1_4 = 1. / 3.;
 
-#ifndef HAVE_MPI
     #pragma omp parallel for reduction(+:sum_norm2,sum_x_mean,sum_y_mean,sum_xx_mean,sum_yy_mean,sum_px_mean,sum_py_mean,sum_pxpx_mean,sum_pypy_mean,sum_angular_momentum) private(x,y)
-#endif
     for (int i = ini_halo_y; i < grid->inner_end_y - grid->start_y; ++i) {
         complex<double> psi_up, psi_down, psi_center, psi_left, psi_right;
         complex<double> psi_up_up, psi_down_down, psi_left_left, psi_right_right;
@@ -465,61 +561,19 @@ void State::calculate_expected_values(void) {
     mean_angular_momentum = sum_angular_momentum;
 
 #ifdef HAVE_MPI
-    double *norm2_mpi = new double[grid->mpi_procs];
-    double *mean_X_mpi = new double[grid->mpi_procs];
-    double *mean_Y_mpi = new double[grid->mpi_procs];
-    double *mean_XX_mpi = new double[grid->mpi_procs];
-    double *mean_YY_mpi = new double[grid->mpi_procs];
-    double *mean_Px_mpi = new double[grid->mpi_procs];
-    double *mean_Py_mpi = new double[grid->mpi_procs];
-    double *mean_PxPx_mpi = new double[grid->mpi_procs];
-    double *mean_PyPy_mpi = new double[grid->mpi_procs];
-    double *mean_angular_momentum_mpi = new double[grid->mpi_procs];
-
-    MPI_Allgather(&norm2, 1, MPI_DOUBLE, norm2_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_X, 1, MPI_DOUBLE, mean_X_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_Y, 1, MPI_DOUBLE, mean_Y_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_XX, 1, MPI_DOUBLE, mean_XX_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_YY, 1, MPI_DOUBLE, mean_YY_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_Px, 1, MPI_DOUBLE, mean_Px_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_Py, 1, MPI_DOUBLE, mean_Py_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_PxPx, 1, MPI_DOUBLE, mean_PxPx_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_PyPy, 1, MPI_DOUBLE, mean_PyPy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&mean_angular_momentum, 1, MPI_DOUBLE, mean_angular_momentum_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-
-    norm2 = 0.;
-    mean_X = 0.;
-    mean_Y = 0.;
-    mean_XX = 0.;
-    mean_YY = 0.;
-    mean_Px = 0.;
-    mean_Py = 0.;
-    mean_PxPx = 0.;
-    mean_PyPy = 0.;
-    mean_angular_momentum = 0.;
-
-    for(int i = 0; i < grid->mpi_procs; i++) {
-        norm2 += norm2_mpi[i];
-        mean_X += mean_X_mpi[i];
-        mean_Y += mean_Y_mpi[i];
-        mean_XX += mean_XX_mpi[i];
-        mean_YY += mean_YY_mpi[i];
-        mean_Px += mean_Px_mpi[i];
-        mean_Py += mean_Py_mpi[i];
-        mean_PxPx += mean_PxPx_mpi[i];
-        mean_PyPy += mean_PyPy_mpi[i];
-        mean_angular_momentum += mean_angular_momentum_mpi[i];
-    }
-    delete [] norm2_mpi;
-    delete [] mean_X_mpi;
-    delete [] mean_Y_mpi;
-    delete [] mean_XX_mpi;
-    delete [] mean_YY_mpi;
-    delete [] mean_Px_mpi;
-    delete [] mean_Py_mpi;
-    delete [] mean_PxPx_mpi;
-    delete [] mean_PyPy_mpi;
-    delete [] mean_angular_momentum_mpi;
+    // The partial sums of the tiles are added up in a single message
+    double sums[10] = {norm2, mean_X, mean_Y, mean_XX, mean_YY, mean_Px, mean_Py, mean_PxPx, mean_PyPy, mean_angular_momentum};
+    MPI_Allreduce(MPI_IN_PLACE, sums, 10, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+    norm2 = sums[0];
+    mean_X = sums[1];
+    mean_Y = sums[2];
+    mean_XX = sums[3];
+    mean_YY = sums[4];
+    mean_Px = sums[5];
+    mean_Py = sums[6];
+    mean_PxPx = sums[7];
+    mean_PyPy = sums[8];
+    mean_angular_momentum = sums[9];
 #endif
     mean_X = mean_X / norm2;
     mean_Y = mean_Y / norm2;
@@ -762,13 +816,7 @@ BesselState::BesselState(Lattice1D *_grid, int _angular_momentum, int _zeros, do
         integral += real(conj(tmp) * tmp);
     }
 #ifdef HAVE_MPI
-    double *integral_mpi = new double[grid->mpi_procs];
-    MPI_Allgather(&integral, 1, MPI_DOUBLE, integral_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    integral = 0;
-    for(int i = 0; i < grid->mpi_procs; i++) {
-        integral += integral_mpi[i];
-    }
-    delete [] integral_mpi;
+    MPI_Allreduce(MPI_IN_PLACE, &integral, 1, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
 #endif
     normalization = sqrt(norm / (integral * grid->length_x / (grid->global_no_halo_dim_x - 1)));
     for (int x = 0; x < grid->dim_x; x++) {
@@ -800,13 +848,7 @@ BesselState::BesselState(Lattice2D *_grid, int _angular_momentum, int _zeros, in
         }
     }
 #ifdef HAVE_MPI
-    double *integral_mpi = new double[grid->mpi_procs];
-    MPI_Allgather(&integral, 1, MPI_DOUBLE, integral_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    integral = 0;
-    for(int i = 0; i < grid->mpi_procs; i++) {
-        integral += integral_mpi[i];
-    }
-    delete [] integral_mpi;
+    MPI_Allreduce(MPI_IN_PLACE, &integral, 1, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
 #endif
     normalization = sqrt(norm / (integral * grid->delta_y * grid->length_x / (grid->global_no_halo_dim_x - 1)));
     for (int y = 0; y < grid->dim_y; y++) {
@@ -836,6 +878,7 @@ Potential::Potential(Lattice *_grid, char *filename): grid(_grid) {
         }
     }
     input.close();
+    current_evolution_time = 0.;
 }
 
 Potential::Potential(Lattice *_grid, double *_external_pot): grid(_grid) {
@@ -851,6 +894,7 @@ Potential::Potential(Lattice *_grid, double *_external_pot): grid(_grid) {
     updated_potential_matrix = false;
     evolving_potential = NULL;
     static_potential = NULL;
+    current_evolution_time = 0.;
 }
 
 Potential::Potential(Lattice *_grid, double (*potential_fuction)(double x, double y)): grid(_grid) {
@@ -860,6 +904,7 @@ Potential::Potential(Lattice *_grid, double (*potential_fuction)(double x, doubl
     evolving_potential = NULL;
     static_potential = potential_fuction;
     matrix = NULL;
+    current_evolution_time = 0.;
 }
 
 Potential::Potential(Lattice *_grid, double (*potential_function)(double x, double y, double t), int _t): grid(_grid) {
@@ -869,12 +914,39 @@ Potential::Potential(Lattice *_grid, double (*potential_function)(double x, doub
     evolving_potential = potential_function;
     static_potential = NULL;
     matrix = NULL;
+    current_evolution_time = _t;
 }
 
 double Potential::get_value(int x) {
     return get_value(x, 0);
 }
 
+void Potential::get_row(int y, const double *coord_x, double coord_y, double *values) {
+    if (matrix != NULL) {
+        memcpy(values, &matrix[y * grid->dim_x], grid->dim_x * sizeof(double));
+    }
+    else if (is_static && static_potential != NULL) {
+        for (int x = 0; x < grid->dim_x; x++) {
+            values[x] = static_potential(coord_x[x], coord_y);
+        }
+    }
+    else if (!is_static && evolving_potential != NULL) {
+        for (int x = 0; x < grid->dim_x; x++) {
+            values[x] = evolving_potential(coord_x[x], coord_y, current_evolution_time);
+        }
+    }
+    else {
+        for (int x = 0; x < grid->dim_x; x++) {
+            values[x] = get_value(x, y);
+        }
+    }
+}
+
+bool Potential::is_zero() {
+    double (*null_potential)(double x, double y) = const_potential;
+    return matrix == NULL && is_static && static_potential == null_potential;
+}
+
 double Potential::get_value(int x, int y) {
     if (matrix != NULL) {
         return matrix[y * grid->dim_x + x];
@@ -907,14 +979,75 @@ Potential::~Potential() {
     }
 }
 
+SeparablePotential::SeparablePotential(Lattice *_grid): Potential(_grid, const_potential) {
+    static_potential = NULL;
+    static_potential_x = NULL;
+    static_potential_y = NULL;
+    evolving_potential_x = NULL;
+    evolving_potential_y = NULL;
+}
+
+SeparablePotential::SeparablePotential(Lattice *_grid, double (*potential_x)(double x), double (*potential_y)(double y)):
+    Potential(_grid, const_potential) {
+    static_potential = NULL;
+    static_potential_x = potential_x;
+    static_potential_y = potential_y;
+    evolving_potential_x = NULL;
+    evolving_potential_y = NULL;
+}
+
+SeparablePotential::SeparablePotential(Lattice *_grid, double (*potential_x)(double x, double t), double (*potential_y)(double y, double t), int _t):
+    Potential(_grid, const_potential) {
+    is_static = false;
+    static_potential = NULL;
+    static_potential_x = NULL;
+    static_potential_y = NULL;
+    evolving_potential_x = potential_x;
+    evolving_potential_y = potential_y;
+    current_evolution_time = _t;
+}
+
+double SeparablePotential::term_x(double x) {
+    return is_static ? static_potential_x(x) : evolving_potential_x(x, current_evolution_time);
+}
+
+double SeparablePotential::term_y(double y) {
+    return is_static ? static_potential_y(y) : evolving_potential_y(y, current_evolution_time);
+}
+
+double SeparablePotential::get_value(int x, int y) {
+    double x_r = 0, y_r = 0;
+    map_lattice_to_coordinate_space(grid, x, y, &x_r, &y_r);
+    return term_x(x_r) + term_y(y_r);
+}
+
+void SeparablePotential::get_row(int y, const double *coord_x, double coord_y, double *values) {
+    double value_y = term_y(coord_y);
+    for (int x = 0; x < grid->dim_x; x++) {
+        values[x] = term_x(coord_x[x]) + value_y;
+    }
+}
+
+bool SeparablePotential::is_zero() {
+    double (*null_term)(double x) = const_potential;
+    return is_static && static_potential_x == null_term && static_potential_y == null_term;
+}
+
+void SeparablePotential::get_factors(const double *coord_x, const double *coord_y, double *values_x, double *values_y) {
+    for (int x = 0; x < grid->dim_x; x++) {
+        values_x[x] = term_x(coord_x[x]);
+    }
+    for (int y = 0; y < grid->dim_y; y++) {
+        values_y[y] = term_y(coord_y[y]);
+    }
+}
+
+SeparablePotential::~SeparablePotential() {
+}
+
 HarmonicPotential::HarmonicPotential(Lattice2D *_grid, double _omegax, double _omegay, double _mass, double _mean_x, double _mean_y):
-    Potential(_grid, const_potential), omegax(_omegax), omegay(_omegay),
+    SeparablePotential(_grid), omegax(_omegax), omegay(_omegay),
     mass(_mass), mean_x(_mean_x), mean_y(_mean_y) {
-    is_static = true;
-    self_init = false;
-    evolving_potential = NULL;
-    static_potential = NULL;
-    matrix = NULL;
 }
 
 double HarmonicPotential::get_value(int x, int y) {
@@ -925,6 +1058,25 @@ double HarmonicPotential::get_value(int x, int y) {
     return 0.5 * mass * (omegax * omegax * x_r * x_r + omegay * omegay * y_r * y_r);
 }
 
+void HarmonicPotential::get_row(int y, const double *coord_x, double coord_y, double *values) {
+    double y_r = coord_y - mean_y;
+    for (int x = 0; x < grid->dim_x; x++) {
+        double x_r = coord_x[x] - mean_x;
+        values[x] = 0.5 * mass * (omegax * omegax * x_r * x_r + omegay * omegay * y_r * y_r);
+    }
+}
+
+void HarmonicPotential::get_factors(const double *coord_x, const double *coord_y, double *values_x, double *values_y) {
+    for (int x = 0; x < grid->dim_x; x++) {
+        double x_r = coord_x[x] - mean_x;
+        values_x[x] = 0.5 * mass * omegax * omegax * x_r * x_r;
+    }
+    for (int y = 0; y < grid->dim_y; y++) {
+        double y_r = coord_y[y] - mean_y;
+        values_y[y] = 0.5 * mass * omegay * omegay * y_r * y_r;
+    }
+}
+
 HarmonicPotential::~HarmonicPotential() {
 }
 
@@ -939,10 +1091,10 @@ Hamiltonian::Hamiltonian(Lattice *_grid, Potential *_potential,
             return;
         }
         if (grid->mpi_procs == 1) {
-            grid->halo_x = 8;
-            grid->halo_y = 8;
+            grid->halo_x = 8 * grid->exchange_interval;
+            grid->halo_y = 8 * grid->exchange_interval;
         }
-        if (grid->mpi_procs > 1 && (grid->halo_x == 4 || grid->halo_y == 4)) {
+        if (grid->mpi_procs > 1 && (grid->halo_x == 4 * grid->exchange_interval || grid->halo_y == 4 * grid->exchange_interval)) {
             cout << "Halos must be of 8 points width\n";
             return;
         }
@@ -985,7 +1137,7 @@ Hamiltonian2Component::Hamiltonian2Component(Lattice *_grid,
         double _omega_r, double _omega_i,
         double _angular_velocity,
         double _rot_coord_x, double _rot_coord_y):
-    Hamiltonian(_grid, _potential, _mass, _coupling_a, 0., _angular_velocity, _rot_coord_x, rot_coord_y), mass_b(_mass_b),
+    Hamiltonian(_grid, _potential, _mass, _coupling_a, 0., _angular_velocity, _rot_coord_x, _rot_coord_y), mass_b(_mass_b),
     coupling_ab( _coupling_ab), coupling_b(_coupling_b), /*LeeHuangYang_coupling_b(_LeeHuangYang_coupling_b),*/ omega_r(_omega_r), omega_i(_omega_i) {
 
     if (_potential_b == NULL) {
@@ -19,7 +19,195 @@
 #include "common.h"
 #include "kernel.h"
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <cstring>
+#include <ctime>
+#include <algorithm>
+
+#define TUNING_STEPS 5
+
+/*
+ * Values of the external potential on the tile, from which the evolution
+ * operators are built. The coordinates of the dots are computed once: x only
+ * depends on the column and y on the row, so the potential is evaluated a
+ * row at a time. The values are kept until the potential changes, so the
+ * operators of several time steps reuse one evaluation.
+ * A separable potential is kept as its terms along x and y, and the values on
+ * the whole tile are only summed if an operator on the whole tile is needed.
+ */
+class PotentialTable {
+public:
+    PotentialTable(Lattice *_grid, Potential *_potential, const double *_azimuthal):
+        grid(_grid), potential(_potential), azimuthal(_azimuthal), stale_values(true), stale_terms(true),
+        values(NULL), values_x(NULL), values_y(NULL), applied(NULL), applied_delta_t(0.), applied_imag_time(false) {
+        separable = dynamic_cast<SeparablePotential*>(potential);
+        coord_x = new double[grid->dim_x];
+        coord_y = new double[grid->dim_y];
+        if (separable != NULL) {
+            values_x = new double[grid->dim_x];
+            values_y = new double[grid->dim_y];
+        }
+        double tmp;
+        for (int x = 0; x < grid->dim_x; x++) {
+            map_lattice_to_coordinate_space(grid, x, 0, &coord_x[x], &tmp);
+        }
+        for (int y = 0; y < grid->dim_y; y++) {
+            map_lattice_to_coordinate_space(grid, 0, y, &tmp, &coord_y[y]);
+        }
+        zero = potential->is_zero();
+        for (int x = 0; azimuthal != NULL && x < grid->dim_x; x++) {
+            zero = zero && azimuthal[x] == 0.;
+        }
+    }
+
+    ~PotentialTable() {
+        delete [] coord_x;
+        delete [] coord_y;
+        delete [] values;
+        delete [] values_x;
+        delete [] values_y;
+        delete [] applied;
+        delete [] azimuthal;
+    }
+
+    bool is_separable() const {
+        return separable != NULL;
+    }
+
+    bool is_zero() const {
+        return zero;
+    }
+
+    // The potential changed: evaluate it again before the next operator
+    void invalidate() {
+        stale_values = true;
+        stale_terms = true;
+    }
+
+    // Operators of the terms along x and y of a separable potential, whose product is the operator of the potential
+    void exponentiate_terms(exp_potential_kernel kernel, bool imag_time, double delta_t, double *x_real, double *x_imag, double *y_real, double *y_imag) {
+        evaluate_terms();
+        kernel(imag_time, delta_t, grid->dim_x, values_x, x_real, x_imag);
+        kernel(imag_time, delta_t, grid->dim_y, values_y, y_real, y_imag);
+    }
+
+    void exponentiate(exp_potential_kernel kernel, bool imag_time, double delta_t, double *pot_real, double *pot_imag) {
+        evaluate();
+        #pragma omp parallel for
+        for (int y = 0; y < grid->dim_y; y++) {
+            size_t row = size_t(y) * grid->dim_x;
+            kernel(imag_time, delta_t, grid->dim_x, &values[row], &pot_real[row], pot_imag == NULL ? NULL : &pot_imag[row]);
+        }
+    }
+
+    // Record that pot_real and pot_imag hold the operators of the current values
+    void mark_applied(double delta_t, bool imag_time) {
+        if (applied == NULL) {
+            applied = new double[grid->dim_x * grid->dim_y];
+        }
+        memcpy(applied, values, grid->dim_x * grid->dim_y * sizeof(double));
+        applied_delta_t = delta_t;
+        applied_imag_time = imag_time;
+    }
+
+    // Build again the operators of the dots whose potential moved by more than threshold; false if none did
+    bool refresh(exp_potential_kernel kernel, bool imag_time, double delta_t, double threshold, double *pot_real, double *pot_imag) {
+        if (applied == NULL || delta_t != applied_delta_t || imag_time != applied_imag_time) {
+            exponentiate(kernel, imag_time, delta_t, pot_real, pot_imag);
+            mark_applied(delta_t, imag_time);
+            return true;
+        }
+        evaluate();
+        int changed = 0;
+        #pragma omp parallel reduction(+:changed)
+        {
+            double *row_real = new double[grid->dim_x];
+            double *row_imag = new double[grid->dim_x];
+            #pragma omp for
+            for (int y = 0; y < grid->dim_y; y++) {
+                size_t row = size_t(y) * grid->dim_x;
+                int x = 0;
+                while (x < grid->dim_x && fabs(values[row + x] - applied[row + x]) <= threshold) {
+                    x++;
+                }
+                if (x == grid->dim_x) {
+                    continue;
+                }
+                kernel(imag_time, delta_t, grid->dim_x, &values[row], row_real, row_imag);
+                for (; x < grid->dim_x; x++) {
+                    if (fabs(values[row + x] - applied[row + x]) > threshold) {
+                        pot_real[row + x] = row_real[x];
+                        if (pot_imag != NULL) {
+                            pot_imag[row + x] = row_imag[x];
+                        }
+                        applied[row + x] = values[row + x];
+                        changed++;
+                    }
+                }
+            }
+            delete [] row_real;
+            delete [] row_imag;
+        }
+        return changed > 0;
+    }
+
+private:
+    Lattice *grid;
+    Potential *potential;
+    SeparablePotential *separable;    // The potential if it is separable, NULL otherwise
+    bool zero;    // The potential and the centrifugal term vanish everywhere
+    const double *azimuthal;    // Centrifugal term of each column on cylindrical lattices, NULL otherwise; owned by the table
+    bool stale_values, stale_terms;
+    double *coord_x, *coord_y;
+    double *values;    // Values on the tile, allocated on first use
+    double *values_x, *values_y;    // Terms of a separable potential, the centrifugal term going with x
+    double *applied;    // Values the current operators were built from
+    double applied_delta_t;
+    bool applied_imag_time;
+
+    void evaluate_terms() {
+        if (!stale_terms) {
+            return;
+        }
+        separable->get_factors(coord_x, coord_y, values_x, values_y);
+        if (azimuthal != NULL) {
+            for (int x = 0; x < grid->dim_x; x++) {
+                values_x[x] += azimuthal[x];
+            }
+        }
+        stale_terms = false;
+    }
+
+    void evaluate() {
+        if (!stale_values) {
+            return;
+        }
+        if (values == NULL) {
+            values = new double[grid->dim_x * grid->dim_y];
+        }
+        if (separable != NULL) {
+            evaluate_terms();
+        }
+        #pragma omp parallel for
+        for (int y = 0; y < grid->dim_y; y++) {
+            double *row = &values[size_t(y) * grid->dim_x];
+            if (separable != NULL) {
+                for (int x = 0; x < grid->dim_x; x++) {
+                    row[x] = values_x[x] + values_y[y];
+                }
+                continue;
+            }
+            potential->get_row(y, coord_x, coord_y[y], row);
+            if (azimuthal != NULL) {
+                for (int x = 0; x < grid->dim_x; x++) {
+                    row[x] += azimuthal[x];
+                }
+            }
+        }
+        stale_values = false;
+    }
+};
 
 Solver::Solver(Lattice *_grid, State *_state, Hamiltonian *_hamiltonian,
                double _delta_t, string _kernel_type):
@@ -27,8 +215,8 @@ Solver::Solver(Lattice *_grid, State *_state, Hamiltonian *_hamiltonian,
     kernel_type(_kernel_type) {
     external_pot_real = new double* [2];
     external_pot_imag = new double* [2];
-    external_pot_real[0] = new double[grid->dim_x * grid->dim_y];
-    external_pot_imag[0] = new double[grid->dim_x * grid->dim_y];
+    external_pot_real[0] = NULL;
+    external_pot_imag[0] = NULL;
     external_pot_real[1] = NULL;
     external_pot_imag[1] = NULL;
     is_python = false;
@@ -38,6 +226,24 @@ Solver::Solver(Lattice *_grid, State *_state, Hamiltonian *_hamiltonian,
     single_component = true;
     energy_expected_values_updated = false;
     has_parameters_changed = false;
+    phase_accuracy = "full";
+    memory_layout = "split";
+    integrator = "strang";
+    block_width = BLOCK_WIDTH_CACHE;
+    block_height = BLOCK_HEIGHT_CACHE;
+    in_place = false;
+    halo_exchange = "phases";
+    halo_steps[0] = halo_steps[1] = 0;
+    potential_refresh_every = 1;
+    potential_refresh_threshold = 0.;
+    for (int i = 0; i < 2; i++) {
+        substep_pot_real[i] = NULL;
+        substep_pot_imag[i] = NULL;
+        potential_tables[i] = NULL;
+        steps_since_refresh[i] = 0;
+        separable_pot_real[i] = NULL;
+        separable_pot_imag[i] = NULL;
+    }
 }
 
 Solver::Solver(Lattice *_grid, State *state1, State *state2,
@@ -47,91 +253,494 @@ Solver::Solver(Lattice *_grid, State *state1, State *state2,
     kernel_type(_kernel_type) {
     external_pot_real = new double* [2];
     external_pot_imag = new double* [2];
-    external_pot_real[0] = new double[grid->dim_x * grid->dim_y];
-    external_pot_imag[0] = new double[grid->dim_x * grid->dim_y];
-    external_pot_real[1] = new double[grid->dim_x * grid->dim_y];
-    external_pot_imag[1] = new double[grid->dim_x * grid->dim_y];
+    external_pot_real[0] = NULL;
+    external_pot_imag[0] = NULL;
+    external_pot_real[1] = NULL;
+    external_pot_imag[1] = NULL;
     is_python = false;
     kernel = NULL;
     current_evolution_time = 0;
     single_component = false;
     energy_expected_values_updated = false;
     has_parameters_changed = false;
+    phase_accuracy = "full";
+    memory_layout = "split";
+    integrator = "strang";
+    block_width = BLOCK_WIDTH_CACHE;
+    block_height = BLOCK_HEIGHT_CACHE;
+    in_place = false;
+    halo_exchange = "phases";
+    halo_steps[0] = halo_steps[1] = 0;
+    potential_refresh_every = 1;
+    potential_refresh_threshold = 0.;
+    for (int i = 0; i < 2; i++) {
+        substep_pot_real[i] = NULL;
+        substep_pot_imag[i] = NULL;
+        potential_tables[i] = NULL;
+        steps_since_refresh[i] = 0;
+        separable_pot_real[i] = NULL;
+        separable_pot_imag[i] = NULL;
+    }
 }
 
 Solver::~Solver() {
-    delete [] external_pot_real[0];
-    delete [] external_pot_imag[0];
-    delete [] external_pot_real[1];
-    delete [] external_pot_imag[1];
+    free_grid(external_pot_real[0]);
+    free_grid(external_pot_imag[0]);
+    free_grid(external_pot_real[1]);
+    free_grid(external_pot_imag[1]);
     delete [] external_pot_real;
     delete [] external_pot_imag;
+    for (int i = 0; i < 2; i++) {
+        free_grid(substep_pot_real[i]);
+        free_grid(substep_pot_imag[i]);
+        delete potential_tables[i];
+        delete [] separable_pot_real[i];
+        delete [] separable_pot_imag[i];
+    }
     if (kernel != NULL) {
         delete kernel;
     }
 }
 
+// The tables of the operators are allocated on first use, so that a separable potential never needs the ones on the whole tile,
+// and a vanishing potential none at all
 void Solver::initialize_exp_potential(double delta_t, int which) {
-#ifndef HAVE_MPI
-    #pragma omp parallel default(shared)
-#endif
-    {
-        complex<double> tmp;
-        double ptmp;
-#ifndef HAVE_MPI
-        #pragma omp for
-#endif
-        for (int y = 0; y < grid->dim_y; ++y) {
-            for (int x = 0; x < grid->dim_x; ++x) {
-                if (which == 0) {
-                    ptmp = hamiltonian->potential->get_value(x, y);
-                    if (grid->coordinate_system == "cylindrical") {
-                        ptmp += hamiltonian->azimuthal_potential(x, state->angular_momentum);
-                    }
-                }
-                else {
-                    ptmp = static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b->get_value(x, y);
-                    if (grid->coordinate_system == "cylindrical") {
-                        ptmp += static_cast<Hamiltonian2Component*>(hamiltonian)->azimuthal_potential_b(x, state_b->angular_momentum);
-                    }
-                }
-                if (imag_time) {
-                    tmp = exp(complex<double> (-delta_t * ptmp, 0.));
-                }
-                else {
-                    tmp = exp(complex<double> (0., -delta_t * ptmp));
-                }
-                external_pot_real[which][y * grid->dim_x + x] = real(tmp);
-                external_pot_imag[which][y * grid->dim_x + x] = imag(tmp);
+    if (zero_exp_potential(which)) {
+        free_grid(external_pot_real[which]);
+        free_grid(external_pot_imag[which]);
+        external_pot_real[which] = NULL;
+        external_pot_imag[which] = NULL;
+        return;
+    }
+    if (separable_exp_potential(which)) {
+        if (separable_pot_real[which] == NULL) {
+            separable_pot_real[which] = new double[grid->dim_x + grid->dim_y];
+            separable_pot_imag[which] = new double[grid->dim_x + grid->dim_y];
+        }
+        potential_table(which)->exponentiate_terms(get_exp_potential_kernel(phase_accuracy), imag_time, delta_t,
+                separable_pot_real[which], separable_pot_imag[which],
+                &separable_pot_real[which][grid->dim_x], &separable_pot_imag[which][grid->dim_x]);
+        return;
+    }
+    if (external_pot_real[which] == NULL) {
+        external_pot_real[which] = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+    }
+    if (real_exp_potential()) {
+        free_grid(external_pot_imag[which]);
+        external_pot_imag[which] = NULL;
+    }
+    else if (external_pot_imag[which] == NULL) {
+        external_pot_imag[which] = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+    }
+    initialize_exp_potential(delta_t, which, external_pot_real[which], external_pot_imag[which]);
+    potential_table(which)->mark_applied(delta_t, imag_time);
+}
+
+void Solver::initialize_exp_potential(double delta_t, int which, double *pot_real, double *pot_imag) {
+    potential_table(which)->exponentiate(get_exp_potential_kernel(phase_accuracy), imag_time, delta_t, pot_real, pot_imag);
+}
+
+PotentialTable *Solver::potential_table(int which) {
+    if (potential_tables[which] == NULL) {
+        double *azimuthal = NULL;
+        if (grid->coordinate_system == "cylindrical") {
+            azimuthal = new double[grid->dim_x];
+            for (int x = 0; x < grid->dim_x; x++) {
+                azimuthal[x] = which == 0 ? hamiltonian->azimuthal_potential(x, state->angular_momentum) :
+                               static_cast<Hamiltonian2Component*>(hamiltonian)->azimuthal_potential_b(x, state_b->angular_momentum);
             }
         }
+        Potential *potential = which == 0 ? hamiltonian->potential : static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b;
+        potential_tables[which] = new PotentialTable(grid, potential, azimuthal);
     }
+    return potential_tables[which];
+}
+
+bool Solver::potential_changed(int which) {
+    Potential *potential = which == 0 ? hamiltonian->potential : static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b;
+    if (!potential->update(current_evolution_time)) {
+        return false;
+    }
+    if (potential_tables[which] != NULL) {
+        potential_tables[which]->invalidate();
+    }
+    if (++steps_since_refresh[which] < potential_refresh_every) {
+        return false;
+    }
+    steps_since_refresh[which] = 0;
+    return true;
+}
+
+bool Solver::separable_exp_potential(int which) {
+    return kernel_type != "gpu" && !is_python && potential_refresh_threshold == 0. && potential_table(which)->is_separable() && !potential_table(which)->is_zero();
+}
+
+bool Solver::zero_exp_potential(int which) {
+    return kernel_type != "gpu" && !is_python && potential_table(which)->is_zero();
+}
+
+bool Solver::real_exp_potential() {
+    return imag_time && kernel_type != "gpu" && !is_python;
+}
+
+void Solver::upload_exp_potential(int which) {
+    if (separable_exp_potential(which)) {
+        kernel->update_separable_potential(separable_pot_real[which], separable_pot_imag[which],
+                                           &separable_pot_real[which][grid->dim_x], &separable_pot_imag[which][grid->dim_x], which);
+    }
+    else {
+        kernel->update_potential(external_pot_real[which], external_pot_imag[which], which);
+    }
+}
+
+bool Solver::refresh_exp_potential(int which) {
+    if (potential_refresh_threshold == 0.) {
+        initialize_exp_potential(delta_t, which);
+        return true;
+    }
+    return potential_table(which)->refresh(get_exp_potential_kernel(phase_accuracy), imag_time, delta_t, potential_refresh_threshold,
+                                           external_pot_real[which], external_pot_imag[which]);
 }
 
 void Solver::set_exp_potential(double *real, int real_length, double *imag,
                                int imag_length, int which) {
     is_python = true;
+    if (external_pot_real[which] == NULL) {
+        external_pot_real[which] = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+    }
+    if (external_pot_imag[which] == NULL) {
+        external_pot_imag[which] = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+    }
     memcpy(external_pot_real[which], real, sizeof(double)*real_length);
     memcpy(external_pot_imag[which], imag, sizeof(double)*imag_length);
 }
 
+void Solver::set_phase_accuracy(string accuracy) {
+    if (accuracy != "full" && accuracy != "high" && accuracy != "fast") {
+        my_abort("Unknown phase accuracy: " + accuracy);
+    }
+    if (accuracy != phase_accuracy) {
+        phase_accuracy = accuracy;
+        has_parameters_changed = true;
+    }
+}
+
+void Solver::set_memory_layout(string layout) {
+    if (layout != "split" && layout != "interleaved" && layout != "tiled") {
+        my_abort("Unknown memory layout: " + layout);
+    }
+    if (layout != memory_layout) {
+        memory_layout = layout;
+        has_parameters_changed = true;
+    }
+}
+
+void Solver::set_integrator(string _integrator) {
+    if (_integrator != "strang" && _integrator != "yoshida") {
+        my_abort("Unknown integrator: " + _integrator);
+    }
+    if (_integrator == "yoshida" && !single_component) {
+        my_abort("The fourth-order integrator only evolves single-component systems.");
+    }
+    if (_integrator == "yoshida" && kernel_type == "gpu") {
+        my_abort("The GPU kernel only evolves with the Strang integrator.");
+    }
+    if (_integrator != integrator) {
+        integrator = _integrator;
+        has_parameters_changed = true;
+    }
+}
+
+void Solver::set_potential_refresh(int every, double threshold) {
+    if (every < 1) {
+        my_abort("The potential has to be refreshed at least every iteration (every >= 1).");
+    }
+    if (threshold < 0.) {
+        my_abort("The threshold of the potential refresh cannot be negative.");
+    }
+    potential_refresh_every = every;
+    if (threshold != potential_refresh_threshold) {
+        // A separable potential is only refreshed dot by dot in the operators on the whole tile
+        potential_refresh_threshold = threshold;
+        has_parameters_changed = true;
+    }
+    steps_since_refresh[0] = steps_since_refresh[1] = 0;
+}
+
+string Solver::memory_placement() {
+    stringstream placement;
+    size_t bytes = grid->dim_x * grid->dim_y * sizeof(double);
+    State *states[2] = {state, state_b};
+    for (int i = 0; i < (single_component ? 1 : 2); i++) {
+        placement << "state " << i + 1 << " real: " << numa_placement(states[i]->p_real, bytes) << endl;
+        placement << "state " << i + 1 << " imaginary: " << numa_placement(states[i]->p_imag, bytes) << endl;
+        if (external_pot_real[i] != NULL) {
+            placement << "potential " << i + 1 << " real: " << numa_placement(external_pot_real[i], bytes) << endl;
+        }
+        if (external_pot_imag[i] != NULL) {
+            placement << "potential " << i + 1 << " imaginary: " << numa_placement(external_pot_imag[i], bytes) << endl;
+        }
+    }
+    if (kernel != NULL) {
+        placement << kernel->memory_placement();
+    }
+    return placement.str();
+}
+
+void Solver::set_block_size(int width, int height) {
+    if (width < 1 || height < 1) {
+        my_abort("The blocks have to be at least one dot wide and one dot high.");
+    }
+    if (width != block_width || height != block_height) {
+        block_width = width;
+        block_height = height;
+        has_parameters_changed = true;
+    }
+}
+
+void Solver::set_in_place(bool _in_place) {
+    if (_in_place != in_place) {
+        in_place = _in_place;
+        has_parameters_changed = true;
+    }
+}
+
+void Solver::set_halo_exchange(string exchange) {
+    if (exchange != "phases" && exchange != "corners" && exchange != "shared") {
+        my_abort("Unknown halo exchange: " + exchange);
+    }
+    if (exchange != halo_exchange) {
+        halo_exchange = exchange;
+        has_parameters_changed = true;
+    }
+}
+
+static double wall_time() {
+#ifdef HAVE_MPI
+    return MPI_Wtime();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    return double(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Model of the CPU, as /proc/cpuinfo names it on Linux
+static string cpu_model() {
+    ifstream cpuinfo("/proc/cpuinfo");
+    string line;
+    while (getline(cpuinfo, line)) {
+        size_t colon = line.find(':');
+        if (line.compare(0, 10, "model name") == 0 && colon != string::npos) {
+            size_t start = line.find_first_not_of(" \t", colon + 1);
+            return start == string::npos ? "unknown CPU" : line.substr(start);
+        }
+    }
+    return "unknown CPU";
+}
+
+/*
+ * A tuning profile is a text file with a line per tuned configuration: the
+ * key, a tab, then the width and the height of the blocks.
+ */
+static bool read_tuning(string profile, string key, int *width, int *height) {
+    ifstream in(profile.c_str());
+    string line;
+    while (getline(in, line)) {
+        size_t tab = line.rfind('\t');
+        if (tab != string::npos && line.substr(0, tab) == key) {
+            stringstream sizes(line.substr(tab + 1));
+            sizes >> *width >> *height;
+            return !sizes.fail();
+        }
+    }
+    return false;
+}
+
+// Store the block size of key in a tuning profile, in place of the previous one
+static void write_tuning(string profile, string key, int width, int height) {
+    ifstream in(profile.c_str());
+    stringstream kept;
+    string line;
+    while (getline(in, line)) {
+        if (line.compare(0, key.size() + 1, key + "\t") != 0) {
+            kept << line << endl;
+        }
+    }
+    in.close();
+    ofstream out(profile.c_str());
+    out << kept.str() << key << "\t" << width << " " << height << endl;
+    if (!out) {
+        my_abort("Cannot write the tuning profile " + profile);
+    }
+}
+
+string Solver::tuning_key(bool imag_time) {
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    stringstream key;
+    key << cpu_model() << "; tile " << grid->end_x - grid->start_x << "x" << grid->end_y - grid->start_y
+        << ", halo " << grid->halo_x << "x" << grid->halo_y << "; " << kernel_type << " kernel, "
+        << memory_layout << " layout, " << (in_place ? "in place, " : "") << (halo_exchange == "corners" ? "corners exchanged, " : halo_exchange == "shared" ? "halos shared, " : "") << phase_accuracy << " phase, "
+        << (single_component ? "one component, " : "two components, ") << grid->coordinate_system << " coordinates, "
+        << (hamiltonian->angular_velocity != 0. ? "rotating, " : "") << (imag_time ? "imaginary" : "real") << " time; "
+        << grid->mpi_procs << " processes, " << threads << " threads";
+    return key.str();
+}
+
+/*
+ * Every candidate evolves the actual state for a step, which builds its
+ * kernel, then for TUNING_STEPS timed steps. The slowest process sets the
+ * time of a candidate. The state is restored after each candidate, so they
+ * are all timed on the same wave function and the evolution goes on as if
+ * the tuning never happened.
+ */
+void Solver::tune_block_size(bool _imag_time, string profile) {
+    if (kernel_type == "gpu") {
+        my_abort("The GPU kernel does not evolve the tile in blocks of a chosen size.");
+    }
+    string key = tuning_key(_imag_time);
+    // Whether the profile has the key, then the size of the blocks
+    int tuned[3] = {0, 0, 0};
+    if (profile != "" && grid->mpi_rank == 0) {
+        tuned[0] = read_tuning(profile, key, &tuned[1], &tuned[2]);
+    }
+#ifdef HAVE_MPI
+    MPI_Bcast(tuned, 3, MPI_INT, 0, grid->cartcomm);
+#endif
+    if (tuned[0]) {
+        set_block_size(tuned[1], tuned[2]);
+        return;
+    }
+
+    State *states[2] = {state, state_b};
+    int components = single_component ? 1 : 2;
+    size_t tile_size = grid->dim_x * grid->dim_y;
+    double *saved_real[2], *saved_imag[2];
+    for (int i = 0; i < components; i++) {
+        saved_real[i] = new double[tile_size];
+        saved_imag[i] = new double[tile_size];
+        memcpy(saved_real[i], states[i]->p_real, tile_size * sizeof(double));
+        memcpy(saved_imag[i], states[i]->p_imag, tile_size * sizeof(double));
+    }
+    double saved_time = current_evolution_time;
+    int saved_halo_steps[2] = {halo_steps[0], halo_steps[1]};
+
+    const int widths[] = {64, 128, 256};
+    const int heights[] = {32, 64, 128, 256};
+    int tile_width = grid->end_x - grid->start_x, tile_height = grid->end_y - grid->start_y;
+    int best_width = block_width, best_height = block_height;
+    double best_time = -1.;
+    for (int w = 0; w < 3; w++) {
+        // Blocks as wide as the tile all evolve it the same way
+        if (w > 0 && widths[w - 1] >= tile_width) {
+            break;
+        }
+        for (int h = 0; h < 4; h++) {
+            if (h > 0 && (grid->halo_y == 0 || heights[h - 1] >= tile_height)) {
+                break;
+            }
+            set_block_size(widths[w], heights[h]);
+            evolve(1, _imag_time);
+#ifdef HAVE_MPI
+            MPI_Barrier(grid->cartcomm);
+#endif
+            double start = wall_time();
+            evolve(TUNING_STEPS, _imag_time);
+            double elapsed = wall_time() - start;
+#ifdef HAVE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, grid->cartcomm);
+#endif
+            if (best_time < 0. || elapsed < best_time) {
+                best_time = elapsed;
+                best_width = widths[w];
+                best_height = heights[h];
+            }
+            for (int i = 0; i < components; i++) {
+                memcpy(states[i]->p_real, saved_real[i], tile_size * sizeof(double));
+                memcpy(states[i]->p_imag, saved_imag[i], tile_size * sizeof(double));
+                states[i]->expected_values_updated = false;
+            }
+            current_evolution_time = saved_time;
+            halo_steps[0] = saved_halo_steps[0];
+            halo_steps[1] = saved_halo_steps[1];
+            energy_expected_values_updated = false;
+            // The kernel may hold the evolved state
+            has_parameters_changed = true;
+        }
+    }
+    for (int i = 0; i < components; i++) {
+        delete [] saved_real[i];
+        delete [] saved_imag[i];
+    }
+    set_block_size(best_width, best_height);
+    if (profile != "" && grid->mpi_rank == 0) {
+        write_tuning(profile, key, best_width, best_height);
+    }
+}
+
+// Weights of the time step in the composition of Strang steps forming one iteration, returns their number
+static int substep_weights(bool fourth_order, double *weights) {
+    if (!fourth_order) {
+        weights[0] = 1.;
+        return 1;
+    }
+    // Yoshida's triple jump: the error terms of order three of the outer and middle steps cancel out
+    double cbrt2 = pow(2., 1. / 3.);
+    weights[0] = 1. / (2. - cbrt2);
+    weights[1] = -cbrt2 / (2. - cbrt2);
+    weights[2] = weights[0];
+    return 3;
+}
+
+// CPU kernel storing the wave function in real_t and accumulating the norms in accum_t
+template<typename real_t, typename accum_t>
+static ITrotterKernel *new_cpu_kernel(Lattice *grid, State *state, State *state_b, Hamiltonian *hamiltonian, bool single_component,
+                                      double **external_pot_real, double **external_pot_imag,
+                                      double delta_t, double *norm2, bool imag_time, string phase_accuracy, string memory_layout,
+                                      size_t block_width, size_t block_height, bool in_place, string halo_exchange) {
+    if (single_component) {
+        return new CPUBlock<real_t, accum_t>(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time, phase_accuracy, memory_layout, block_width, block_height, in_place, halo_exchange);
+    }
+    return new CPUBlock<real_t, accum_t>(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time, phase_accuracy, memory_layout, block_width, block_height, in_place, halo_exchange);
+}
+
 void Solver::init_kernel() {
     if (kernel != NULL) {
         delete kernel;
     }
     if (kernel_type == "cpu") {
-        if (single_component) {
-            kernel = new CPUBlock(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time);
-        }
-        else {
-            kernel = new CPUBlock(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time);
-        }
+        kernel = new_cpu_kernel<double, double>(grid, state, state_b, hamiltonian, single_component, external_pot_real, external_pot_imag, delta_t, norm2, imag_time, phase_accuracy, memory_layout, block_width, block_height, in_place, halo_exchange);
+    }
+    else if (kernel_type == "cpu-float") {
+        kernel = new_cpu_kernel<float, float>(grid, state, state_b, hamiltonian, single_component, external_pot_real, external_pot_imag, delta_t, norm2, imag_time, phase_accuracy, memory_layout, block_width, block_height, in_place, halo_exchange);
+    }
+    else if (kernel_type == "cpu-mixed") {
+        kernel = new_cpu_kernel<float, double>(grid, state, state_b, hamiltonian, single_component, external_pot_real, external_pot_imag, delta_t, norm2, imag_time, phase_accuracy, memory_layout, block_width, block_height, in_place, halo_exchange);
     }
     else if (kernel_type == "gpu") {
 #ifdef CUDA
         if (hamiltonian->angular_velocity != 0) {
             my_abort("The GPU kernel does not work with nonzero angular velocity.");
         }
+        if (phase_accuracy != "full") {
+            my_abort("The GPU kernel only computes the nonlinear phase at full accuracy.");
+        }
+        if (memory_layout != "split") {
+            my_abort("The GPU kernel only stores the wave function in the split layout.");
+        }
+        if (in_place) {
+            my_abort("The GPU kernel does not evolve the wave function in place.");
+        }
+        if (grid->exchange_interval != 1) {
+            my_abort("The GPU kernel exchanges the halos at every time step.");
+        }
+        if (halo_exchange != "phases") {
+            my_abort("The GPU kernel only exchanges the halos in two phases.");
+        }
         if (single_component) {
             kernel = new CC2Kernel(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time);
         }
@@ -147,9 +756,38 @@ void Solver::init_kernel() {
     }
 }
 
-void Solver::evolve(int iterations, bool _imag_time) {
+/*
+ * Evolve the wave function held by the kernel by one step. A step leaves
+ * wrong values in the outer halo of the tile, as deep as the halo of a
+ * lattice exchanging it at every step; the halos of the lattice are
+ * exchange_interval times deeper, so they are exchanged once every that many
+ * steps. The count goes on across evolutions, so that the halos of the state
+ * are always good for the steps left.
+ */
+void Solver::run_kernel_step(int component) {
+    bool exchange_halos = ++halo_steps[component] == grid->exchange_interval;
+    if (exchange_halos) {
+        halo_steps[component] = 0;
+    }
+    kernel->run_kernel_on_halo();
+    if (exchange_halos) {
+        kernel->start_halo_exchange();
+    }
+    kernel->run_kernel();
+    if (exchange_halos) {
+        kernel->finish_halo_exchange();
+    }
+    kernel->wait_for_completion();
+}
+
+void Solver::update_kernel(bool _imag_time) {
     if (_imag_time != imag_time || kernel == NULL || has_parameters_changed) {
         imag_time = _imag_time;
+        // The parameters of the Hamiltonian or the states may have changed
+        for (int i = 0; i < 2; i++) {
+            delete potential_tables[i];
+            potential_tables[i] = NULL;
+        }
         if (imag_time) {
             initialize_exp_potential(delta_t, 0);
             norm2[0] = state->get_squared_norm();
@@ -167,8 +805,35 @@ void Solver::evolve(int iterations, bool _imag_time) {
             }
         }
         init_kernel();
+        for (int i = 0; i < (single_component ? 1 : 2); i++) {
+            if (separable_exp_potential(i)) {
+                upload_exp_potential(i);
+            }
+        }
         has_parameters_changed = false;
     }
+}
+
+void Solver::evolve(int iterations, bool _imag_time) {
+    update_kernel(_imag_time);
+    double weights[3];
+    bool fourth_order = integrator == "yoshida" && !imag_time;
+    int substeps = substep_weights(fourth_order, weights);
+    if (fourth_order && is_python) {
+        my_abort("The fourth-order integrator computes the evolution operators of the potential itself.");
+    }
+    // A vanishing potential needs no operators, the kernel is passed NULL tables
+    if (fourth_order && !zero_exp_potential(0)) {
+        for (int w = 0; w < 2; w++) {
+            if (substep_pot_real[w] == NULL) {
+                substep_pot_real[w] = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+                substep_pot_imag[w] = new_grid<double>(grid->dim_x * grid->dim_y, grid->dim_y);
+            }
+            initialize_exp_potential(weights[w] * delta_t, 0, substep_pot_real[w], substep_pot_imag[w]);
+        }
+    }
+    // Weight of the time step the kernel is set to, zero when its potential has to be set again
+    double kernel_weight = fourth_order ? 0. : 1.;
     // Main loop
     double var = 0.5;
     if ((!is_python && !single_component) ||
@@ -184,41 +849,34 @@ void Solver::evolve(int iterations, bool _imag_time) {
 
     // Main loop
     for (int i = 0; i < iterations; ++i) {
-        if (i > 0 && hamiltonian->potential->update(current_evolution_time)) {
-            if (!is_python) {
-                initialize_exp_potential(delta_t, 0);
+        if (i > 0 && potential_changed(0)) {
+            if (fourth_order) {
+                for (int w = 0; w < 2; w++) {
+                    initialize_exp_potential(weights[w] * delta_t, 0, substep_pot_real[w], substep_pot_imag[w]);
+                }
+                kernel_weight = 0.;
+            }
+            else if (is_python || refresh_exp_potential(0)) {
+                upload_exp_potential(0);
             }
-            kernel->update_potential(external_pot_real[0], external_pot_imag[0], 0);
         }
-        if (!single_component && i > 0) {
-            if (static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b->update(current_evolution_time)) {
-                if (!is_python) {
-                    initialize_exp_potential(delta_t, 1);
-                }
-                kernel->update_potential(external_pot_real[1], external_pot_imag[1], 1);
+        if (!single_component && i > 0 && potential_changed(1)) {
+            if (is_python || refresh_exp_potential(1)) {
+                upload_exp_potential(1);
             }
         }
         //first wave function
-        kernel->run_kernel_on_halo();
-        if (i != iterations - 1) {
-            kernel->start_halo_exchange();
-        }
-        kernel->run_kernel();
-        if (i != iterations - 1) {
-            kernel->finish_halo_exchange();
+        for (int j = 0; j < substeps; j++) {
+            if (weights[j] != kernel_weight) {
+                kernel_weight = weights[j];
+                kernel->set_time_step(kernel_weight * delta_t);
+                kernel->update_potential(substep_pot_real[j == 1], substep_pot_imag[j == 1], 0);
+            }
+            run_kernel_step(0);
         }
-        kernel->wait_for_completion();
         if (!single_component) {
             //second wave function
-            kernel->run_kernel_on_halo();
-            if (i != iterations - 1) {
-                kernel->start_halo_exchange();
-            }
-            kernel->run_kernel();
-            if (i != iterations - 1) {
-                kernel->finish_halo_exchange();
-            }
-            kernel->wait_for_completion();
+            run_kernel_step(1);
             if (i == iterations - 1) {
                 var = 0.5;
             }
@@ -228,7 +886,8 @@ void Solver::evolve(int iterations, bool _imag_time) {
         kernel->cpy_first_positive_to_first_negative(); //only for cylindrical coordinates
         current_evolution_time += delta_t;
     }
-    if (!soft_update) {
+    // A kernel evolving the arrays of the state leaves nothing to copy
+    if (!soft_update && !kernel->runs_in_place()) {
         if (single_component) {
             kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, state->p_real, state->p_imag);
         }
@@ -241,6 +900,171 @@ void Solver::evolve(int iterations, bool _imag_time) {
     energy_expected_values_updated = false;
 }
 
+// Square the evolution operators of a potential, giving the operators of a step twice as long
+static void square_operator(size_t size, const double *real, const double *imag, double *dest_real, double *dest_imag) {
+    #pragma omp parallel for
+    for (int i = 0; i < int(size); i++) {
+        dest_real[i] = real[i] * real[i] - imag[i] * imag[i];
+        dest_imag[i] = 2. * real[i] * imag[i];
+    }
+}
+
+// Distance between two samples of the tiles relative to the norm of the second one, over the inner dots of all the tiles
+static double relative_distance(Lattice *grid, const double *real, const double *imag, const double *ref_real, const double *ref_imag) {
+    double distance = 0., norm = 0.;
+    #pragma omp parallel for reduction(+:distance, norm)
+    for (int y = grid->inner_start_y - grid->start_y; y < grid->inner_end_y - grid->start_y; y++) {
+        for (int x = grid->inner_start_x - grid->start_x; x < grid->inner_end_x - grid->start_x; x++) {
+            size_t i = y * grid->dim_x + x;
+            distance += (real[i] - ref_real[i]) * (real[i] - ref_real[i]) + (imag[i] - ref_imag[i]) * (imag[i] - ref_imag[i]);
+            norm += ref_real[i] * ref_real[i] + ref_imag[i] * ref_imag[i];
+        }
+    }
+#ifdef HAVE_MPI
+    double sums[2] = {distance, norm};
+    MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+    distance = sums[0];
+    norm = sums[1];
+#endif
+    return sqrt(distance / norm);
+}
+
+// One iteration of the integrator with a step of h; pot_real[w] and pot_imag[w] are the potential operators of the outer (w = 0) and middle (w = 1) substeps
+void Solver::integrator_step(int substeps, const double *weights, double h, double **pot_real, double **pot_imag, double &kernel_step) {
+    for (int j = 0; j < substeps; j++) {
+        if (weights[j] * h != kernel_step) {
+            kernel_step = weights[j] * h;
+            kernel->set_time_step(kernel_step);
+            kernel->update_potential(pot_real[j == 1], pot_imag[j == 1], 0);
+        }
+        run_kernel_step(0);
+    }
+    kernel->cpy_first_positive_to_first_negative(); //only for cylindrical coordinates
+}
+
+/*
+ * Adaptive time step by step doubling.
+ *
+ * Every step of h is taken twice from the same state: whole, and as two
+ * steps of h / 2. Their difference divided by 2^order - 1 estimates the
+ * error of the finer result, which is kept if the estimate is within the
+ * tolerance. The step is halved when it is rejected and doubled when the
+ * doubled step is still expected to meet the tolerance, so the potential
+ * operators of a step are the squares of the ones of the half step, and new
+ * exponentials are only needed when the step shrinks.
+ */
+int Solver::evolve_until(double t_final, double tolerance) {
+    if (!single_component) {
+        my_abort("The adaptive time step only evolves single-component systems.");
+    }
+    if (kernel_type == "gpu") {
+        my_abort("The GPU kernel does not change the time step during the evolution.");
+    }
+    if (is_python) {
+        my_abort("The adaptive time step computes the evolution operators of the potential itself.");
+    }
+    update_kernel(false);
+    double weights[3];
+    int substeps = substep_weights(integrator == "yoshida", weights);
+    int order = integrator == "yoshida" ? 4 : 2;
+    int operators = substeps == 1 ? 1 : 2;
+    size_t tile_size = grid->dim_x * grid->dim_y;
+    // Potential operators of the outer and middle substeps, for a step (level 0) and for a half step (level 1)
+    // They are NULL for a vanishing potential
+    bool zero = zero_exp_potential(0);
+    double *pot_real[2][2], *pot_imag[2][2];
+    for (int level = 0; level < 2; level++) {
+        for (int w = 0; w < operators; w++) {
+            pot_real[level][w] = zero ? NULL : new_grid<double>(tile_size, grid->dim_y);
+            pot_imag[level][w] = zero ? NULL : new_grid<double>(tile_size, grid->dim_y);
+        }
+    }
+    // Wave function at the beginning of a step, after the whole step and after the two half steps
+    double *start_real = new double[tile_size];
+    double *start_imag = new double[tile_size];
+    double *coarse_real = new double[tile_size];
+    double *coarse_imag = new double[tile_size];
+    double *fine_real = new double[tile_size];
+    double *fine_imag = new double[tile_size];
+
+    double step = delta_t, h = 0., kernel_step = 0.;
+    int accepted = 0;
+    while (current_evolution_time < t_final) {
+        if (potential_changed(0)) {
+            h = 0.;
+        }
+        bool last = step >= t_final - current_evolution_time;
+        double next = last ? t_final - current_evolution_time : step;
+        if (next != h) {
+            if (next == 2. * h || next == 0.5 * h) {
+                for (int w = 0; w < operators; w++) {
+                    std::swap(pot_real[0][w], pot_real[1][w]);
+                    std::swap(pot_imag[0][w], pot_imag[1][w]);
+                }
+            }
+            for (int w = 0; w < operators && !zero; w++) {
+                if (next != 2. * h) {
+                    initialize_exp_potential(weights[w] * 0.5 * next, 0, pot_real[1][w], pot_imag[1][w]);
+                }
+                if (next != 0.5 * h) {
+                    square_operator(tile_size, pot_real[1][w], pot_imag[1][w], pot_real[0][w], pot_imag[0][w]);
+                }
+            }
+            h = next;
+            kernel_step = 0.;
+        }
+        // The halos of the saved tile are as old as when it was saved
+        int start_halo_steps = halo_steps[0];
+        kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, start_real, start_imag);
+        integrator_step(substeps, weights, h, pot_real[0], pot_imag[0], kernel_step);
+        kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, coarse_real, coarse_imag);
+        kernel->set_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, start_real, start_imag);
+        halo_steps[0] = start_halo_steps;
+        integrator_step(substeps, weights, 0.5 * h, pot_real[1], pot_imag[1], kernel_step);
+        integrator_step(substeps, weights, 0.5 * h, pot_real[1], pot_imag[1], kernel_step);
+        kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, fine_real, fine_imag);
+        double error = relative_distance(grid, coarse_real, coarse_imag, fine_real, fine_imag) / (pow(2., order) - 1.);
+        if (error > tolerance) {
+            kernel->set_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, start_real, start_imag);
+            halo_steps[0] = start_halo_steps;
+            step = 0.5 * h;
+            if (step < t_final * std::numeric_limits<double>::epsilon()) {
+                my_abort("The adaptive time step cannot meet the tolerance.");
+            }
+            continue;
+        }
+        current_evolution_time = last ? t_final : current_evolution_time + h;
+        accepted++;
+        if (!last && error * pow(2., order + 1) < tolerance) {
+            step = 2. * h;
+        }
+    }
+    // Later evolutions go on with the last step
+    delta_t = step;
+    initialize_exp_potential(delta_t, 0);
+    kernel->set_time_step(delta_t);
+    upload_exp_potential(0);
+    if (!kernel->runs_in_place()) {
+        kernel->get_sample(grid->dim_x, 0, 0, grid->dim_x, grid->dim_y, state->p_real, state->p_imag);
+    }
+    state->expected_values_updated = false;
+    energy_expected_values_updated = false;
+
+    for (int level = 0; level < 2; level++) {
+        for (int w = 0; w < operators; w++) {
+            free_grid(pot_real[level][w]);
+            free_grid(pot_imag[level][w]);
+        }
+    }
+    delete [] start_real;
+    delete [] start_imag;
+    delete [] coarse_real;
+    delete [] coarse_imag;
+    delete [] fine_real;
+    delete [] fine_imag;
+    return accepted;
+}
+
 void Solver::calculate_energy_expected_values(void) {
 
     double delta_x = grid->delta_x;
@@ -300,7 +1124,6 @@ void Solver::calculate_energy_expected_values(void) {
     complex<double> derivate1_1 = 1. / 6., derivate1_2 = - 1., derivate1_3 = 0.5, derivate1_4 = 1. / 3.;
     int xlim = (grid->coordinate_system == "cylindrical" ? 3 : 0);
 
-#ifndef HAVE_MPI
     #pragma omp parallel for reduction(+:sum_norm2_0,\
     sum_norm2_kin0,\
     sum_potential_energy_0,\
@@ -316,7 +1139,6 @@ void Solver::calculate_energy_expected_values(void) {
     sum_intra_species_energy_1,\
     sum_kinetic_energy_1,\
     sum_rotational_energy_1) private(x,y)
-#endif
     for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
     complex<double> psi_up, psi_down, psi_center, psi_left, psi_right;
     complex<double> psi_up_b, psi_down_b, psi_center_b, psi_left_b, psi_right_b;
@@ -440,93 +1262,29 @@ void Solver::calculate_energy_expected_values(void) {
     }
 
 #ifdef HAVE_MPI
-    double *norm2_kin_mpi = new double[grid->mpi_procs];
-    double *norm2_mpi = new double[grid->mpi_procs];
-    double *kinetic_energy_mpi = new double[grid->mpi_procs];
-    double *potential_energy_mpi = new double[grid->mpi_procs];
-    double *rotational_energy_mpi = new double[grid->mpi_procs];
-    double *intra_species_energy_mpi = new double[grid->mpi_procs];
-    double *LeeHuangYang_energy_mpi = new double[grid->mpi_procs];
-
-    MPI_Allgather(&norm2_kin[0], 1, MPI_DOUBLE, norm2_kin_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&norm2[0], 1, MPI_DOUBLE, norm2_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&kinetic_energy[0], 1, MPI_DOUBLE, kinetic_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&potential_energy[0], 1, MPI_DOUBLE, potential_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&rotational_energy[0], 1, MPI_DOUBLE, rotational_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&intra_species_energy[0], 1, MPI_DOUBLE, intra_species_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-    MPI_Allgather(&LeeHuangYang_energy, 1, MPI_DOUBLE, LeeHuangYang_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-
-    norm2_kin[0] = 0;
-    norm2[0] = 0;
-    kinetic_energy[0] = 0;
-    potential_energy[0] = 0;
-    rotational_energy[0] = 0;
-    intra_species_energy[0] = 0;
-    LeeHuangYang_energy = 0;
-
-    for(int i = 0; i < grid->mpi_procs; i++) {
-    norm2_kin[0] += norm2_kin_mpi[i];
-        norm2[0] += norm2_mpi[i];
-        kinetic_energy[0] += kinetic_energy_mpi[i];
-        potential_energy[0] += potential_energy_mpi[i];
-        rotational_energy[0] += rotational_energy_mpi[i];
-        intra_species_energy[0] += intra_species_energy_mpi[i];
-        LeeHuangYang_energy += LeeHuangYang_energy_mpi[i];
-    }
-    delete [] norm2_kin_mpi;
-    delete [] norm2_mpi;
-    delete [] kinetic_energy_mpi;
-    delete [] potential_energy_mpi;
-    delete [] rotational_energy_mpi;
-    delete [] intra_species_energy_mpi;
-    delete [] LeeHuangYang_energy_mpi;
-
+    // The terms of both components are added up over the tiles in a single message
+    double sums[15] = {norm2_kin[0], norm2[0], kinetic_energy[0], potential_energy[0], rotational_energy[0], intra_species_energy[0], LeeHuangYang_energy};
+    if (!single_component) {
+        double sums_b[8] = {norm2_kin[1], norm2[1], kinetic_energy[1], potential_energy[1], rotational_energy[1], intra_species_energy[1], inter_species_energy, rabi_energy};
+        std::copy(sums_b, sums_b + 8, sums + 7);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, sums, single_component ? 7 : 15, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+    norm2_kin[0] = sums[0];
+    norm2[0] = sums[1];
+    kinetic_energy[0] = sums[2];
+    potential_energy[0] = sums[3];
+    rotational_energy[0] = sums[4];
+    intra_species_energy[0] = sums[5];
+    LeeHuangYang_energy = sums[6];
     if (!single_component) {
-    double *norm2_kin_mpi = new double[grid->mpi_procs];
-        double *norm2_mpi = new double[grid->mpi_procs];
-        double *kinetic_energy_mpi = new double[grid->mpi_procs];
-        double *potential_energy_mpi = new double[grid->mpi_procs];
-        double *rotational_energy_mpi = new double[grid->mpi_procs];
-        double *intra_species_energy_mpi = new double[grid->mpi_procs];
-        double *inter_species_energy_mpi = new double[grid->mpi_procs];
-        double *rabi_energy_mpi = new double[grid->mpi_procs];
-
-        MPI_Allgather(&norm2_kin[1], 1, MPI_DOUBLE, norm2_kin_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&norm2[1], 1, MPI_DOUBLE, norm2_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&kinetic_energy[1], 1, MPI_DOUBLE, kinetic_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&potential_energy[1], 1, MPI_DOUBLE, potential_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&rotational_energy[1], 1, MPI_DOUBLE, rotational_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&intra_species_energy[1], 1, MPI_DOUBLE, intra_species_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&inter_species_energy, 1, MPI_DOUBLE, inter_species_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-        MPI_Allgather(&rabi_energy, 1, MPI_DOUBLE, rabi_energy_mpi, 1, MPI_DOUBLE, grid->cartcomm);
-
-        norm2_kin[1] = 0;
-        norm2[1] = 0;
-        kinetic_energy[1] = 0;
-        potential_energy[1] = 0;
-        rotational_energy[1] = 0;
-        intra_species_energy[1] = 0;
-        inter_species_energy = 0;
-        rabi_energy = 0;
-
-        for(int i = 0; i < grid->mpi_procs; i++) {
-            norm2_kin[1] += norm2_kin_mpi[i];
-            norm2[1] += norm2_mpi[i];
-            kinetic_energy[1] += kinetic_energy_mpi[i];
-            potential_energy[1] += potential_energy_mpi[i];
-            rotational_energy[1] += rotational_energy_mpi[i];
-            intra_species_energy[1] += intra_species_energy_mpi[i];
-            inter_species_energy += inter_species_energy_mpi[i];
-            rabi_energy += rabi_energy_mpi[i];
-        }
-        delete [] norm2_kin_mpi;
-        delete [] norm2_mpi;
-        delete [] kinetic_energy_mpi;
-        delete [] potential_energy_mpi;
-        delete [] rotational_energy_mpi;
-        delete [] intra_species_energy_mpi;
-        delete [] inter_species_energy_mpi;
-        delete [] rabi_energy_mpi;
+        norm2_kin[1] = sums[7];
+        norm2[1] = sums[8];
+        kinetic_energy[1] = sums[9];
+        potential_energy[1] = sums[10];
+        rotational_energy[1] = sums[11];
+        intra_species_energy[1] = sums[12];
+        inter_species_energy = sums[13];
+        rabi_energy = sums[14];
     }
 #endif
     kinetic_energy[0] = kinetic_energy[0] / norm2_kin[0];
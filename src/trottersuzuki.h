@@ -45,14 +45,27 @@ public:
 
     // Computational topology
     int halo_x, halo_y;    ///< Halo length along the x and y halos.
+    int exchange_interval;    ///< Number of time steps between two exchanges of the halos, which are as many times deeper as a single step needs.
     int start_x, start_y;    ///< Spatial coordinates (not physical) of the first element of the tile.
     int end_x, end_y;    ///< Spatial coordinates (not physical) of the last element of the tile.
     int inner_start_x, inner_start_y;    ///< Spatial coordinates (not physical) of the first element of the tile, excluding the eventual surrounding halo.
     int inner_end_x, inner_end_y;    ///< Spatial coordinates (not physical) of the last element of the tile, excluding the eventual surrounding halo.
     int mpi_coords[2], mpi_dims[2];    ///< Coordinate of the process in the MPI topology and structure of the MPI topology.
+    int mpi_node, mpi_nodes;    ///< Index of the node of the process and number of nodes, when the tiles of each node make a block (otherwise 0 and 1).
 #ifdef HAVE_MPI
     MPI_Comm cartcomm;    ///< MPI communitaros chart.
 #endif
+
+    /**
+        Describe how the lattice is split among the processes: the process grid, the predicted halo volume and, for every process, its tile.
+        All the processes have to call it, and all of them get the whole description.
+
+        @return                       One line for the grid and one per process.
+     */
+    string decomposition();
+protected:
+    /// Arrange the processes in a grid of procs_y x procs_x tiles of a lattice of dim_x x dim_y dots (0 picks the number with the least halo volume), optionally grouping the processes of each node in a block.
+    void create_topology(int dim_x, int dim_y, int procs_x, int procs_y, bool group_nodes);
 };
 
 /**
@@ -70,8 +83,11 @@ public:
         @param [in] length            Physical length of the lattice.
         @param [in] periodic_x_axis   Boundary condition along the x axis (false=closed, true=periodic).
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] exchange_interval Number of time steps between two exchanges of the halos between the tiles (default 1). The halos are as many times deeper, and the dots in them are evolved redundantly.
+        @param [in] group_nodes       Whether to give the processes of each node consecutive tiles, so that fewer halos cross the network (default false).
      */
-    Lattice1D(int dim, double length, bool periodic_x_axis = false, string coordinate_system = "cartesian");
+    Lattice1D(int dim, double length, bool periodic_x_axis = false, string coordinate_system = "cartesian", int exchange_interval = 1,
+              bool group_nodes = false);
 };
 
 /**
@@ -91,10 +107,15 @@ public:
         @param [in] periodic_y_axis   Boundary condition along the y axis (false=closed, true=periodic).
         @param [in] angular_velocity  Angular velocity of the frame of reference.
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] exchange_interval Number of time steps between two exchanges of the halos between the tiles (default 1). The halos are as many times deeper, and the dots in them are evolved redundantly.
+        @param [in] procs_x           Number of MPI processes along the x axis (default 0: the number with the least halo volume for the shape of the lattice).
+        @param [in] procs_y           Number of MPI processes along the y axis (default 0: as for procs_x).
+        @param [in] group_nodes       Whether the processes of each node hold a block of neighbouring tiles, so that fewer halos cross the network (default false).
      */
     Lattice2D(int dim, double length,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian", int exchange_interval = 1,
+              int procs_x = 0, int procs_y = 0, bool group_nodes = false);
     /**
         Lattice constructor.
 
@@ -106,14 +127,20 @@ public:
         @param [in] periodic_y_axis   Boundary condition along the y axis (false=closed, true=periodic).
         @param [in] angular_velocity  Angular velocity of the frame of reference.
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] exchange_interval Number of time steps between two exchanges of the halos between the tiles (default 1). The halos are as many times deeper, and the dots in them are evolved redundantly.
+        @param [in] procs_x           Number of MPI processes along the x axis (default 0: the number with the least halo volume for the shape of the lattice).
+        @param [in] procs_y           Number of MPI processes along the y axis (default 0: as for procs_x).
+        @param [in] group_nodes       Whether the processes of each node hold a block of neighbouring tiles, so that fewer halos cross the network (default false).
      */
     Lattice2D(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian", int exchange_interval = 1,
+              int procs_x = 0, int procs_y = 0, bool group_nodes = false);
 private:
     void init(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian", int exchange_interval = 1,
+              int procs_x = 0, int procs_y = 0, bool group_nodes = false);
 };
 
 /**
@@ -380,6 +407,17 @@ public:
     virtual ~Potential();
     virtual double get_value(int x); ///< Get the value at the coordinate x in a 1D model.
     virtual double get_value(int x, int y);    ///< Get the value at the coordinate (x,y) in a 2D model.
+    /**
+    	Get the values along the row y of the lattice, whose dots lie at the physical coordinates (coord_x[x], coord_y).
+    	Subclasses that override get_value(x, y) should override this method as well.
+
+    	@param [in] y                Row of the lattice.
+    	@param [in] coord_x          Physical x coordinate of each dot of the row, as given by map_lattice_to_coordinate_space.
+    	@param [in] coord_y          Physical y coordinate of the row.
+    	@param [out] values          Values of the potential at the grid->dim_x dots of the row.
+     */
+    virtual void get_row(int y, const double *coord_x, double coord_y, double *values);
+    virtual bool is_zero();    ///< Whether the potential is known to vanish everywhere, as the null potential function does; the CPU kernels then skip it.
     bool update(double t);    ///< Update the potential matrix at time t.
     bool updated_potential_matrix;
 protected:
@@ -391,11 +429,61 @@ protected:
 };
 
 /**
- * \brief This class defines the external potential that is used for Hamiltonian class.
+ * \brief This class defines an external potential that is the sum of a function of x and a function of y.
+ *
+ * The CPU kernels keep the evolution operator of a separable potential as one factor per column and one per row of the tile,
+ * and multiply them while evolving a block, so updating a time-dependent separable potential costs O(dim_x + dim_y).
  *
  * This class is a child of Potential class.
  */
-class HarmonicPotential: public Potential {
+class SeparablePotential: public Potential {
+public:
+    /**
+    	Construct the static separable external potential.
+
+    	@param [in] grid                   Lattice object.
+    	@param [in] potential_x            Pointer to the function of x.
+    	@param [in] potential_y            Pointer to the function of y.
+     */
+    SeparablePotential(Lattice *grid, double (*potential_x)(double x), double (*potential_y)(double y));
+    /**
+    	Construct the time-evolving separable external potential.
+
+    	@param [in] grid                   Lattice object.
+    	@param [in] potential_x            Pointer to the time-dependent function of x.
+    	@param [in] potential_y            Pointer to the time-dependent function of y.
+     */
+    SeparablePotential(Lattice *grid, double (*potential_x)(double x, double t), double (*potential_y)(double y, double t), int t = 0);
+    virtual ~SeparablePotential();
+    virtual double get_value(int x, int y);    ///< Return the value of the external potential at coordinate (x,y)
+    virtual void get_row(int y, const double *coord_x, double coord_y, double *values);    ///< Return the values of the external potential along the row y.
+    virtual bool is_zero();    ///< Whether both terms are the null potential function.
+    /**
+    	Get the two terms of the potential at the current time.
+
+    	@param [in] coord_x          Physical x coordinate of each column of the lattice, as given by map_lattice_to_coordinate_space.
+    	@param [in] coord_y          Physical y coordinate of each row of the lattice.
+    	@param [out] values_x        Term depending on x, at the grid->dim_x columns.
+    	@param [out] values_y        Term depending on y, at the grid->dim_y rows.
+     */
+    virtual void get_factors(const double *coord_x, const double *coord_y, double *values_x, double *values_y);
+
+protected:
+    SeparablePotential(Lattice *grid);    ///< Construct a separable potential whose terms are computed by a subclass.
+    double (*static_potential_x)(double x);    ///< Static term depending on x.
+    double (*static_potential_y)(double y);    ///< Static term depending on y.
+    double (*evolving_potential_x)(double x, double t);    ///< Time-dependent term depending on x.
+    double (*evolving_potential_y)(double y, double t);    ///< Time-dependent term depending on y.
+    double term_x(double x);    ///< Term depending on x at the current time.
+    double term_y(double y);    ///< Term depending on y at the current time.
+};
+
+/**
+ * \brief This class defines the external potential that is used for Hamiltonian class.
+ *
+ * This class is a child of SeparablePotential class.
+ */
+class HarmonicPotential: public SeparablePotential {
 public:
     /**
     	Construct the harmonic external potential.
@@ -410,6 +498,8 @@ public:
     HarmonicPotential(Lattice2D *grid, double omegax, double omegay, double mass = 1., double mean_x = 0., double mean_y = 0.);
     ~HarmonicPotential();
     double get_value(int x, int y);    ///< Return the value of the external potential at coordinate (x,y)
+    void get_row(int y, const double *coord_x, double coord_y, double *values);    ///< Return the values of the external potential along the row y.
+    void get_factors(const double *coord_x, const double *coord_y, double *values_x, double *values_y);    ///< Return the terms of the external potential along x and y.
 
 private:
     double omegax, omegay;    ///< Frequencies along x and y axis.
@@ -506,19 +596,25 @@ public:
     virtual void run_kernel_on_halo() = 0;    ///< Evolve blocks of wave function at the edge of the tile. This comprises the halos.
     virtual void wait_for_completion() = 0;    ///< Sincronize all the processes at the end of halos communication. Perform normalization for imaginary time evolution.
     virtual void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const = 0; ///< Get the evolved wave function.
+    virtual void set_sample(size_t src_stride, size_t x, size_t y, size_t width, size_t height, const double * src_real, const double * src_imag, const double * src_real2 = 0, const double * src_imag2 = 0) = 0; ///< Overwrite the evolved wave function, as given by get_sample.
     virtual void normalization() = 0;    ///< Normalization of the two components wave function.
     virtual void rabi_coupling(double var, double delta_t) = 0;    ///< Perform the evolution regarding the Rabi coupling.
     virtual double calculate_squared_norm(bool global = true) const = 0;  ///< Calculate the squared norm of the wave function.
-    virtual bool runs_in_place() const = 0;
+    virtual bool runs_in_place() const = 0;    ///< Whether the kernel evolves the arrays of the states, which get_sample then leaves as they are.
     virtual string get_name() const = 0;				///< Get kernel name.
     virtual void update_potential(double *_external_pot_real, double *_external_pot_imag, int which) = 0;    ///< Update the evolution matrix, regarding the external potential, at time t.
+    virtual void update_separable_potential(const double *pot_x_real, const double *pot_x_imag, const double *pot_y_real, const double *pot_y_imag, int which) = 0;    ///< Replace the evolution operator of the external potential by the product of a factor per column and a factor per row of the tile.
+    virtual void set_time_step(double delta_t) = 0;    ///< Change the time step of the evolution; the potentials of the new step are then passed to update_potential.
     virtual void cpy_first_positive_to_first_negative() = 0;    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
 
     virtual void start_halo_exchange() = 0;					///< Exchange halos between processes.
     virtual void finish_halo_exchange() = 0;				///< Exchange halos between processes.
+    virtual string memory_placement() const = 0;    ///< Describe on which NUMA nodes the buffers of the kernel are placed.
 
 };
 
+class PotentialTable;
+
 /**
  * \brief This class defines the evolution tasks.
  */
@@ -536,7 +632,7 @@ public:
     	@param [in] state               State of the system.
     	@param [in] hamiltonian         Hamiltonian of the system.
     	@param [in] delta_t             A single evolution iteration, evolves the state for this time.
-    	@param [in] kernel_type         Which kernel to use (either cpu or gpu).
+    	@param [in] kernel_type         Which kernel to use: cpu, cpu-float (single precision), cpu-mixed (single precision with double precision norms) or gpu.
      */
     Solver(Lattice *grid, State *state, Hamiltonian *hamiltonian, double delta_t,
            string kernel_type = "cpu");
@@ -548,13 +644,23 @@ public:
     	@param [in] state2              Second component's state of the system.
     	@param [in] hamiltonian         Hamiltonian of the two-component system.
     	@param [in] delta_t             A single evolution iteration, evolves the state for this time.
-    	@param [in] kernel_type         Which kernel to use (either cpu or gpu).
+    	@param [in] kernel_type         Which kernel to use: cpu, cpu-float (single precision), cpu-mixed (single precision with double precision norms) or gpu.
      */
     Solver(Lattice *grid, State *state1, State *state2,
            Hamiltonian2Component *hamiltonian,
            double delta_t, string kernel_type = "cpu");
     ~Solver();
     void evolve(int iterations, bool imag_time = false);  ///< Evolve the state of the system.
+    /**
+    	Evolve the state of a single-component system in real time up to t_final, adapting the time step to the error.
+
+    	Each step is checked against two steps of half its length. The step is halved when the estimated error, relative to the norm of the state, exceeds the tolerance, and doubled when the doubled step is expected to stay within it. The time step of the solver starts from the current one and is left to the last adapted value. The tolerance should stay above the precision of the kernel, around 1e-7 for the single-precision kernels.
+
+    	@param [in] t_final             Evolution time at which the evolution stops.
+    	@param [in] tolerance           Largest error of a single step, relative to the norm of the state.
+    	@return                         Number of steps taken.
+     */
+    int evolve_until(double t_final, double tolerance);
     void update_parameters();  ///< Notify the solver if any parameter changed in the Hamiltonian.
     double get_total_energy(void);    ///< Get the total energy of the system.
     double get_squared_norm(size_t which = 3 /** [in] Which = 1(first component); 2 (second component); 3(total state) */);  ///< Get the squared norm of the state (default: total wave-function).
@@ -567,6 +673,63 @@ public:
     double get_rabi_energy(void);    ///< Get the Rabi energy of the system.
     void set_exp_potential(double *real, int real_length, double *imag,
                            int imag_length, int which); ///< Set exponential potential directly from Python
+    /**
+    	Set the accuracy of sin, cos and exp in the nonlinear and potential phase step of the CPU kernel.
+
+    	@param [in] accuracy            "full" (libm, default), "high" (error around 1e-12) or "fast" (error around 1e-8).
+     */
+    void set_phase_accuracy(string accuracy);
+    /**
+    	Set the memory layout of the wave function inside the CPU kernel. The state is converted when the kernel is built and at the end of each evolution.
+
+    	@param [in] layout              "split" (real and imaginary parts in two arrays, default), "interleaved" (pairs of real and imaginary parts) or "tiled" (pairs in 16x16 tiles).
+     */
+    void set_memory_layout(string layout);
+    /**
+    	Set the splitting scheme of each iteration of the evolution.
+
+    	@param [in] integrator          "strang" (second order, default) or "yoshida" (fourth order, three Strang steps of delta_t / (2 - 2^(1/3)), -2^(1/3) delta_t / (2 - 2^(1/3)) and delta_t / (2 - 2^(1/3))). The fourth order applies to the real time evolution of single-component systems with the CPU kernels; imaginary time evolutions keep the Strang step.
+     */
+    void set_integrator(string integrator);
+    /**
+    	Set how often the evolution operator of a time-dependent external potential is built again during the evolution.
+
+    	@param [in] every               Build the operator every this many iterations (default 1). The potential in between is the last one built.
+    	@param [in] threshold           When positive, only the dots whose potential moved by more than this amount since their operator was last built are updated (default 0, every dot). Applies to the second-order integrator.
+     */
+    void set_potential_refresh(int every, double threshold = 0.);
+    /**
+    	Describe on which NUMA nodes the wave functions, the evolution operators of the potential and the buffers of the kernel of this process are placed.
+
+    	@return                         One line per buffer, with the number of pages on each node ("unknown" where the system does not tell).
+     */
+    string memory_placement();
+    /**
+    	Set the size of the blocks of the tile that the CPU kernel evolves in cache.
+
+    	@param [in] width               Width of the blocks (default 128), even, larger than twice the halo and at most 512.
+    	@param [in] height              Height of the blocks (default 128), even and larger than twice the halo; blocks are single rows on one-dimensional lattices.
+     */
+    void set_block_size(int width, int height);
+    /**
+    	Pick the size of the blocks of the CPU kernel by timing a few steps of the evolution with each candidate size, on the tile of this solver. The state and the evolution time are restored afterwards.
+
+    	@param [in] imag_time           Whether to time steps in imaginary time (default false).
+    	@param [in] profile             File keeping the chosen sizes, keyed by the CPU model, the size of the tile and the options of the kernel. Sizes found there are used without timing; empty (the default) always times and keeps nothing.
+     */
+    void tune_block_size(bool imag_time = false, string profile = "");
+    /**
+    	Evolve the wave function in place in the CPU kernel, instead of in a second buffer for the next time step. The blocks read their edges from copies of the strips of dots they share with their neighbours, a few percent of the tile. With two components only the second one is evolved in place.
+
+    	@param [in] in_place            Whether to evolve in place (default false).
+     */
+    void set_in_place(bool in_place);
+    /**
+    	Set how the CPU kernel exchanges the halos between MPI processes. "phases" (the default) exchanges the columns with the left and right neighbours, then full rows with the upper and lower ones, which pass on the corners. "corners" exchanges the inner rows and columns and the corners with all eight neighbours at once, so that a single round of messages runs while the inner part of the tile is evolved. "shared" does the same with the processes on other nodes, while the processes on the same node keep their tiles in a shared memory window and copy the halos straight from each other's tiles, with no message (MPI 3).
+
+    	@param [in] exchange            "phases", "corners" or "shared".
+     */
+    void set_halo_exchange(string exchange);
 private:
     bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
     double **external_pot_real;    ///< Real part of the evolution operator regarding the external potential.
@@ -575,9 +738,37 @@ private:
     double norm2[2];    ///< Squared norms of the two wave function.
     bool single_component;    ///< Whether the system is single-component(true) or two-components(false).
     string kernel_type;    ///< Which kernel are being used (cpu or gpu).
+    string phase_accuracy;    ///< Accuracy of the nonlinear phase in the CPU kernel (full, high or fast).
+    string memory_layout;    ///< Memory layout of the wave function in the CPU kernel (split, interleaved or tiled).
+    string integrator;    ///< Splitting scheme of the iterations (strang or yoshida).
+    int block_width;    ///< Width of the blocks of the CPU kernel.
+    int block_height;    ///< Height of the blocks of the CPU kernel.
+    bool in_place;    ///< Whether the CPU kernel evolves the wave function in place.
+    string halo_exchange;    ///< How the CPU kernel exchanges the halos (phases, corners or shared).
+    int halo_steps[2];    ///< Steps each wave function was evolved since its halos were last exchanged, at most the exchange interval of the lattice.
+    double *substep_pot_real[2];    ///< Real part of the evolution operator regarding the external potential, for the outer and the middle steps of the fourth-order scheme.
+    double *substep_pot_imag[2];    ///< Imaginary part of the evolution operator regarding the external potential, for the outer and the middle steps of the fourth-order scheme.
+    PotentialTable *potential_tables[2];    ///< Coordinates and values of the external potential of the two components, built on first use.
+    int potential_refresh_every;    ///< Number of iterations between two builds of the evolution operator of a time-dependent potential.
+    double potential_refresh_threshold;    ///< Change of the potential at a dot below which its evolution operator is kept (zero builds every dot).
+    int steps_since_refresh[2];    ///< Iterations since the evolution operator of each component was last built.
+    double *separable_pot_real[2];    ///< Real part of the evolution operators of the terms along x (dim_x values) then along y (dim_y values) of a separable potential.
+    double *separable_pot_imag[2];    ///< Imaginary part of the evolution operators of the terms along x then along y of a separable potential.
     ITrotterKernel * kernel;    ///< Pointer to the kernel object.
     void initialize_exp_potential(double time_single_it, int which);    ///< Initialize the evolution operator regarding the external potential.
+    void initialize_exp_potential(double time_single_it, int which, double *pot_real, double *pot_imag);    ///< Compute the evolution operator regarding the external potential into pot_real and pot_imag.
     void init_kernel();    ///< Initialize the kernel (cpu or gpu).
+    string tuning_key(bool imag_time);    ///< Key of the block sizes of this solver in a tuning profile.
+    void update_kernel(bool imag_time);    ///< Build the kernel again if it does not exist or if the parameters or the kind of time changed.
+    void run_kernel_step(int component);    ///< Evolve the wave function held by the kernel by one step, and exchange its halos once the steps since the last exchange have used them up.
+    PotentialTable *potential_table(int which);    ///< Table of the external potential of a component, created if needed.
+    bool potential_changed(int which);    ///< Whether the evolution operator of a component has to be built again at the current time.
+    bool refresh_exp_potential(int which);    ///< Build again the evolution operator of a component; false if it did not change.
+    bool separable_exp_potential(int which);    ///< Whether the kernel keeps the evolution operator of a component as the factors of a separable potential.
+    bool zero_exp_potential(int which);    ///< Whether the kernel evolves a component without external potential, which vanishes.
+    bool real_exp_potential();    ///< Whether only the real part of the evolution operators is kept, as in imaginary time.
+    void upload_exp_potential(int which);    ///< Pass the evolution operator of a component to the kernel.
+    void integrator_step(int substeps, const double *weights, double h, double **pot_real, double **pot_imag, double &kernel_step);    ///< Evolve the single-component state by one iteration of the integrator with a step of h.
     double total_energy;    ///< Total energy of the system.
     double kinetic_energy[2];    ///< Kinetic energy for the single components.
     double tot_kinetic_energy;    ///< Total kinetic energy of the system.
@@ -0,0 +1,970 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <new>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <stdint.h>
+#include "blockkerneltest.h"
+#include "trottersuzuki.h"
+#include "common.h"
+
+#define BLOCK_STRIDE 80
+#define BLOCK_WIDTH 75
+#define BLOCK_HEIGHT 13
+
+// Allocations through operator new, counted so that a test can check that the evolution does not allocate
+static long heap_allocations = 0;
+
+void *operator new(size_t size) {
+    #pragma omp atomic
+    heap_allocations++;
+    void *pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == NULL) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+template<typename real_t>
+static void fill_block(real_t *p_real, real_t *p_imag, size_t size) {
+    srand(1);
+    for (size_t i = 0; i < size; i++) {
+        p_real[i] = double(rand()) / RAND_MAX - 0.5;
+        p_imag[i] = double(rand()) / RAND_MAX - 0.5;
+    }
+}
+
+template<typename real_t>
+static double max_difference(const real_t *a, const real_t *b, size_t size) {
+    double diff = 0.;
+    for (size_t i = 0; i < size; i++) {
+        diff = std::max(diff, std::abs(double(a[i]) - double(b[i])));
+    }
+    return diff;
+}
+
+// Compares the vectorised kinetic kernels with the scalar ones on a block
+// whose width is not a multiple of the vector length, for both offsets.
+template<typename real_t>
+static void compare_kinetic_kernels(const char *precision, double tolerance) {
+    const size_t size = BLOCK_STRIDE * BLOCK_HEIGHT;
+    const char *instruction_sets[] = {"avx2", "avx512"};
+    KineticKernels<real_t> scalar = get_kinetic_kernels<real_t>("scalar");
+    real_t *ref_real = new real_t[size], *ref_imag = new real_t[size];
+    real_t *p_real = new real_t[size], *p_imag = new real_t[size];
+    for (int set = 0; set < 2; set++) {
+        if (!is_instruction_set_supported(instruction_sets[set])) {
+            continue;
+        }
+        KineticKernels<real_t> simd = get_kinetic_kernels<real_t>(instruction_sets[set]);
+        kinetic_kernel<real_t> reference[] = {scalar.vertical, scalar.vertical_imaginary, scalar.horizontal, scalar.horizontal_imaginary};
+        kinetic_kernel<real_t> vectorised[] = {simd.vertical, simd.vertical_imaginary, simd.horizontal, simd.horizontal_imaginary};
+        for (int k = 0; k < 4; k++) {
+            for (size_t offset = 0; offset < 2; offset++) {
+                fill_block(ref_real, ref_imag, size);
+                fill_block(p_real, p_imag, size);
+                reference[k](offset, BLOCK_STRIDE, BLOCK_WIDTH, BLOCK_HEIGHT, 0.8, 0.6, ref_real, ref_imag);
+                vectorised[k](offset, BLOCK_STRIDE, BLOCK_WIDTH, BLOCK_HEIGHT, 0.8, 0.6, p_real, p_imag);
+                CPPUNIT_ASSERT( max_difference(ref_real, p_real, size) < tolerance );
+                CPPUNIT_ASSERT( max_difference(ref_imag, p_imag, size) < tolerance );
+            }
+        }
+        std::cout << "TEST FUNCTION: vectorised_kinetic_kernels_test with " << simd.name << " " << precision <<
+                  " kernels -> PASSED! " << std::endl;
+    }
+    delete [] ref_real;
+    delete [] ref_imag;
+    delete [] p_real;
+    delete [] p_imag;
+}
+
+void BlockKernelTest::vectorised_kinetic_kernels_test() {
+    compare_kinetic_kernels<double>("double", BLOCK_TOLERANCE);
+    compare_kinetic_kernels<float>("float", BLOCK_FLOAT_TOLERANCE);
+}
+
+// Compares the wavefront step with the sweep-by-sweep step for every
+// combination of terms, on a block whose height is not a multiple of the
+// wavefront step, and on a single row for the one-dimensional instances.
+void BlockKernelTest::fused_step_test() {
+    const size_t size = BLOCK_STRIDE * BLOCK_HEIGHT;
+    KineticKernels<double> kinetic = select_kinetic_kernels<double>();
+    PotentialKernels<double> potential = get_potential_kernels<double>("full");
+    double *ref_real = new double[size], *ref_imag = new double[size];
+    double *p_real = new double[size], *p_imag = new double[size];
+    double *pot_real = new double[size], *pot_imag = new double[size];
+    double *pb_real = new double[size], *pb_imag = new double[size];
+    double *radial = new double[3 * BLOCK_STRIDE];
+    double *rotation_x = new double[2 * BLOCK_STRIDE], *rotation_y = new double[2 * BLOCK_HEIGHT];
+    fill_block(pot_real, pot_imag, size);
+    fill_block(pb_real, pb_imag, size);
+    for (int flags = 0; flags < 32; flags++) {
+        bool imag_time = flags & 1, cylindrical = flags & 2, two_wavefunctions = flags & 4, rotation = flags & 8, two_dimensional = flags & 16;
+        size_t height = two_dimensional ? BLOCK_HEIGHT : 1;
+        double alpha = rotation ? 0.01 : 0.;
+        double a = imag_time ? 1.1 : 0.8, b = imag_time ? 0.4 : 0.6;
+        radial_coefficients(imag_time, 0.01, 3., BLOCK_STRIDE, radial);
+        rotation_coefficients(imag_time, alpha, 3., BLOCK_STRIDE, rotation_x);
+        rotation_coefficients(imag_time, -0.5 * alpha, 5., BLOCK_HEIGHT, rotation_y);
+        block_step<double> reference = get_block_step<double>(imag_time, cylindrical, two_wavefunctions, rotation, two_dimensional, false);
+        block_step<double> fused = get_block_step<double>(imag_time, cylindrical, two_wavefunctions, rotation, two_dimensional, true);
+        fill_block(ref_real, ref_imag, size);
+        fill_block(p_real, p_imag, size);
+        reference(BLOCK_STRIDE, BLOCK_WIDTH, height, radial, rotation_x, rotation_y, NULL, NULL, a, b, a, b, 0.9, 0.1, 0.05,
+                  BLOCK_STRIDE, pot_real, pot_imag, pb_real, pb_imag, ref_real, ref_imag, kinetic, potential);
+        fused(BLOCK_STRIDE, BLOCK_WIDTH, height, radial, rotation_x, rotation_y, NULL, NULL, a, b, a, b, 0.9, 0.1, 0.05,
+              BLOCK_STRIDE, pot_real, pot_imag, pb_real, pb_imag, p_real, p_imag, kinetic, potential);
+        CPPUNIT_ASSERT( max_difference(ref_real, p_real, size) < BLOCK_TOLERANCE );
+        CPPUNIT_ASSERT( max_difference(ref_imag, p_imag, size) < BLOCK_TOLERANCE );
+    }
+    std::cout << "TEST FUNCTION: fused_step_test -> PASSED! " << std::endl;
+    delete [] ref_real;
+    delete [] ref_imag;
+    delete [] p_real;
+    delete [] p_imag;
+    delete [] pot_real;
+    delete [] pot_imag;
+    delete [] pb_real;
+    delete [] pb_imag;
+    delete [] radial;
+    delete [] rotation_x;
+    delete [] rotation_y;
+}
+
+// Compares the polynomial phase factors with libm, through the potential
+// kernels, on phases spanning several periods and on a range of decays.
+template<typename real_t>
+static void compare_phase_accuracy(const char *precision, const double *tolerances) {
+    const size_t size = BLOCK_STRIDE * BLOCK_HEIGHT;
+    const char *accuracies[] = {"high", "fast"};
+    PotentialKernels<real_t> full = get_potential_kernels<real_t>("full");
+    real_t *ref_real = new real_t[size], *ref_imag = new real_t[size];
+    real_t *p_real = new real_t[size], *p_imag = new real_t[size];
+    real_t *pot_real = new real_t[size], *pot_imag = new real_t[size];
+    real_t *pb_real = new real_t[size], *pb_imag = new real_t[size];
+    fill_block(pot_real, pot_imag, size);
+    fill_block(pb_real, pb_imag, size);
+    for (int a = 0; a < 2; a++) {
+        PotentialKernels<real_t> kernels = get_potential_kernels<real_t>(accuracies[a]);
+        potential_kernel<real_t> reference[] = {full.real_time, full.imaginary_time};
+        potential_kernel<real_t> polynomial[] = {kernels.real_time, kernels.imaginary_time};
+        for (int k = 0; k < 2; k++) {
+            for (int two_wavefunctions = 0; two_wavefunctions < 2; two_wavefunctions++) {
+                // |psi|^2 is at most 0.5, so the phase reaches about 100 in absolute value
+                double coupling = k == 0 ? 200. : 40.;
+                fill_block(ref_real, ref_imag, size);
+                fill_block(p_real, p_imag, size);
+                reference[k](two_wavefunctions, BLOCK_STRIDE, BLOCK_WIDTH, BLOCK_HEIGHT, coupling, -coupling, 0.5, BLOCK_STRIDE,
+                             pot_real, pot_imag, pb_real, pb_imag, ref_real, ref_imag);
+                polynomial[k](two_wavefunctions, BLOCK_STRIDE, BLOCK_WIDTH, BLOCK_HEIGHT, coupling, -coupling, 0.5, BLOCK_STRIDE,
+                              pot_real, pot_imag, pb_real, pb_imag, p_real, p_imag);
+                for (size_t i = 0; i < size; i++) {
+                    double scale = std::max(std::abs(double(ref_real[i])) + std::abs(double(ref_imag[i])), 1e-300);
+                    CPPUNIT_ASSERT( std::abs(double(ref_real[i]) - double(p_real[i])) <= tolerances[a] * scale );
+                    CPPUNIT_ASSERT( std::abs(double(ref_imag[i]) - double(p_imag[i])) <= tolerances[a] * scale );
+                }
+            }
+        }
+        std::cout << "TEST FUNCTION: phase_accuracy_test with " << kernels.accuracy << " accuracy in " << precision <<
+                  " -> PASSED! " << std::endl;
+    }
+    delete [] ref_real;
+    delete [] ref_imag;
+    delete [] p_real;
+    delete [] p_imag;
+    delete [] pot_real;
+    delete [] pot_imag;
+    delete [] pb_real;
+    delete [] pb_imag;
+}
+
+void BlockKernelTest::phase_accuracy_test() {
+    const double tolerances[] = {PHASE_HIGH_TOLERANCE, PHASE_FAST_TOLERANCE};
+    const double float_tolerances[] = {PHASE_FLOAT_TOLERANCE, PHASE_FLOAT_TOLERANCE};
+    compare_phase_accuracy<double>("double", tolerances);
+    compare_phase_accuracy<float>("float", float_tolerances);
+}
+
+// Real time evolution of an interacting gas with the polynomial phase
+// factors: the norm is conserved and the state stays close to the libm one.
+void BlockKernelTest::phase_accuracy_norm_test() {
+    const char *accuracies[] = {"full", "high", "fast"};
+    const double tolerances[] = {0., PHASE_HIGH_TOLERANCE, PHASE_FAST_TOLERANCE};
+    double energies[3], norms[3], ini_norm = 0.;
+    for (int a = 0; a < 3; a++) {
+        Lattice2D *grid = new Lattice2D(PHASE_DIM, 20.);
+        State *state = new GaussianState(grid, 1);
+        Potential *potential = new HarmonicPotential(grid, 1., 1.);
+        Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10);
+        Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3);
+        solver->set_phase_accuracy(accuracies[a]);
+        ini_norm = solver->get_squared_norm();
+        solver->evolve(PHASE_ITERATIONS);
+        energies[a] = solver->get_total_energy();
+        norms[a] = solver->get_squared_norm();
+        delete solver;
+        delete hamiltonian;
+        delete potential;
+        delete state;
+        delete grid;
+    }
+    for (int a = 0; a < 3; a++) {
+        CPPUNIT_ASSERT( std::abs(norms[a] - ini_norm) < PHASE_NORM_TOLERANCE );
+        CPPUNIT_ASSERT( std::abs(energies[a] - energies[0]) <= PHASE_ITERATIONS * tolerances[a] * std::abs(energies[0]) );
+    }
+    std::cout << "TEST FUNCTION: phase_accuracy_norm_test -> PASSED! " << std::endl;
+}
+
+// Copy of the size values of a tile
+static double *copy_tile(const double *values, size_t size) {
+    double *copy = new double[size];
+    std::copy(values, values + size, copy);
+    return copy;
+}
+
+// Evolves an interacting gas on a periodic lattice, in real and then in imaginary time,
+// and a (rotating, on a single process) two-component gas with Rabi coupling
+// on a closed lattice. The tiles of the periodic lattice include the halos.
+static void evolve_in_layout(const char *layout, double **values, size_t *sizes) {
+    Lattice2D *grid = new Lattice2D(LAYOUT_DIM_X, 20., LAYOUT_DIM_Y, 15., true, true);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    Potential *potential = new HarmonicPotential(grid, 1., 1.);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+    Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3);
+    solver->set_memory_layout(layout);
+    solver->evolve(LAYOUT_ITERATIONS);
+    solver->evolve(LAYOUT_ITERATIONS, true);
+    sizes[0] = sizes[1] = grid->dim_x * grid->dim_y;
+    values[0] = copy_tile(state->p_real, sizes[0]);
+    values[1] = copy_tile(state->p_imag, sizes[1]);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+
+    grid = new Lattice2D(LAYOUT_DIM_X, 20., LAYOUT_DIM_Y, 15.);
+    potential = new HarmonicPotential(grid, 1., 1.);
+    State *state1 = new GaussianState(grid, 1., 1., 0.5);
+    State *state2 = new GaussianState(grid, 1., 1., -0.5);
+    // The rotating frame of reference needs halos of 8 points across processes
+    double angular_velocity = grid->mpi_procs > 1 ? 0. : 0.5;
+    Hamiltonian2Component *hamiltonian2 = new Hamiltonian2Component(grid, potential, potential, 1., 1., 5., 2., 5., 0.5, 0.2, angular_velocity);
+    solver = new Solver(grid, state1, state2, hamiltonian2, 1.e-3);
+    solver->set_memory_layout(layout);
+    solver->evolve(LAYOUT_ITERATIONS);
+    sizes[2] = sizes[3] = sizes[4] = sizes[5] = grid->dim_x * grid->dim_y;
+    values[2] = copy_tile(state1->p_real, sizes[2]);
+    values[3] = copy_tile(state1->p_imag, sizes[3]);
+    values[4] = copy_tile(state2->p_real, sizes[4]);
+    values[5] = copy_tile(state2->p_imag, sizes[5]);
+    delete solver;
+    delete hamiltonian2;
+    delete state1;
+    delete state2;
+    delete potential;
+    delete grid;
+}
+
+// The blocks are evolved in split scratch buffers whatever the layout of the
+// tile, so every layout must give the same states as the split one.
+void BlockKernelTest::memory_layout_test() {
+    const char *layouts[] = {"interleaved", "tiled"};
+    double *reference[6], *values[6];
+    size_t sizes[6];
+    evolve_in_layout("split", reference, sizes);
+    for (int l = 0; l < 2; l++) {
+        evolve_in_layout(layouts[l], values, sizes);
+        for (int i = 0; i < 6; i++) {
+            CPPUNIT_ASSERT( max_difference(reference[i], values[i], sizes[i]) < LAYOUT_TOLERANCE );
+            delete [] values[i];
+        }
+        std::cout << "TEST FUNCTION: memory_layout_test with " << layouts[l] << " layout -> PASSED! " << std::endl;
+    }
+    for (int i = 0; i < 6; i++) {
+        delete [] reference[i];
+    }
+}
+
+// Copies the real parts then the imaginary parts of the inner dots of the tile:
+// the halos of the tile are not exchanged on closed boundaries
+static double *copy_inner_state(Lattice *grid, State *state, size_t *size) {
+    size_t width = grid->inner_end_x - grid->inner_start_x, height = grid->inner_end_y - grid->inner_start_y;
+    size_t offset = (grid->inner_start_y - grid->start_y) * grid->dim_x + grid->inner_start_x - grid->start_x;
+    *size = width * height;
+    double *values = new double[2 * *size];
+    for (size_t y = 0; y < height; y++) {
+        std::copy(&state->p_real[offset + y * grid->dim_x], &state->p_real[offset + y * grid->dim_x + width], &values[y * width]);
+        std::copy(&state->p_imag[offset + y * grid->dim_x], &state->p_imag[offset + y * grid->dim_x + width], &values[*size + y * width]);
+    }
+    return values;
+}
+
+// Evolves an interacting gas in a harmonic trap up to ORDER_TIME in the given number of steps,
+// or starting from that step with the adaptive time step if a tolerance is given
+static double *evolve_with_integrator(const char *integrator, int steps, size_t *size, double tolerance = 0., int *adaptive_steps = NULL) {
+    Lattice2D *grid = new Lattice2D(ORDER_DIM, 20.);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    Potential *potential = new HarmonicPotential(grid, 1., 1.);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+    Solver *solver = new Solver(grid, state, hamiltonian, ORDER_TIME / steps);
+    solver->set_integrator(integrator);
+    if (tolerance > 0.) {
+        *adaptive_steps = solver->evolve_until(ORDER_TIME, tolerance);
+        CPPUNIT_ASSERT( solver->current_evolution_time == ORDER_TIME );
+    }
+    else {
+        solver->evolve(steps);
+    }
+    double *values = copy_inner_state(grid, state, size);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return values;
+}
+
+// Halving the time step divides the error by 2^order, the reference being a
+// fourth-order evolution with much shorter steps.
+void BlockKernelTest::integrator_order_test() {
+    const char *integrators[] = {"strang", "yoshida"};
+    const double ratios[] = {4., 16.};
+    size_t size;
+    double *reference = evolve_with_integrator("yoshida", ORDER_REFERENCE_STEPS, &size);
+    for (int i = 0; i < 2; i++) {
+        double *coarse = evolve_with_integrator(integrators[i], ORDER_STEPS, &size);
+        double *fine = evolve_with_integrator(integrators[i], 2 * ORDER_STEPS, &size);
+        double ratio = max_difference(coarse, reference, 2 * size) / max_difference(fine, reference, 2 * size);
+        CPPUNIT_ASSERT( std::abs(ratio - ratios[i]) < 0.15 * ratios[i] );
+        delete [] coarse;
+        delete [] fine;
+        std::cout << "TEST FUNCTION: integrator_order_test with " << integrators[i] << " integrator -> PASSED! " << std::endl;
+    }
+    delete [] reference;
+}
+
+// Relative distance between two wave functions stored as by evolve_with_integrator
+static double relative_distance(const double *values, const double *reference, size_t size) {
+    double distance = 0., norm = 0.;
+    for (size_t i = 0; i < size; i++) {
+        distance += (values[i] - reference[i]) * (values[i] - reference[i]);
+        norm += reference[i] * reference[i];
+    }
+    return sqrt(distance / norm);
+}
+
+// The error of every step stays within the tolerance, so the global error is
+// bounded by the number of steps times the tolerance, and a tighter
+// tolerance takes more steps.
+void BlockKernelTest::adaptive_time_step_test() {
+    const char *integrators[] = {"strang", "yoshida"};
+    const double tolerances[] = {ADAPTIVE_TOLERANCE, 1.e-2 * ADAPTIVE_TOLERANCE};
+    size_t size;
+    double *reference = evolve_with_integrator("yoshida", ORDER_REFERENCE_STEPS, &size);
+    for (int i = 0; i < 2; i++) {
+        int steps[2];
+        for (int t = 0; t < 2; t++) {
+            double *values = evolve_with_integrator(integrators[i], ORDER_STEPS, &size, tolerances[t], &steps[t]);
+            CPPUNIT_ASSERT( relative_distance(values, reference, 2 * size) < steps[t] * tolerances[t] );
+            delete [] values;
+        }
+        CPPUNIT_ASSERT( steps[1] > steps[0] );
+        std::cout << "TEST FUNCTION: adaptive_time_step_test with " << integrators[i] << " integrator -> PASSED! " << std::endl;
+    }
+    delete [] reference;
+}
+
+// Harmonic trap whose frequency oscillates in time
+static double breathing_trap(double x, double y, double t) {
+    return 0.5 * (1. + 0.5 * sin(10. * t)) * (x * x + y * y);
+}
+
+static double *evolve_with_refresh(int every, double threshold, size_t *size) {
+    Lattice2D *grid = new Lattice2D(ORDER_DIM, 20.);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    Potential *potential = new Potential(grid, breathing_trap);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+    Solver *solver = new Solver(grid, state, hamiltonian, ORDER_TIME / ORDER_STEPS);
+    solver->set_potential_refresh(every, threshold);
+    solver->evolve(ORDER_STEPS);
+    double *values = copy_inner_state(grid, state, size);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return values;
+}
+
+// A threshold below any change of the potential rebuilds every dot, as the
+// default refresh does; a threshold above every change keeps the first
+// operator, as refreshing less often than the number of iterations does.
+// Refreshing every few iterations stays close to the reference.
+void BlockKernelTest::potential_refresh_test() {
+    Lattice2D *grid = new Lattice2D(ORDER_DIM, 20.);
+    HarmonicPotential *harmonic = new HarmonicPotential(grid, 1., 2., 1.5, 0.5, -0.5);
+    double *coord_x = new double[grid->dim_x], *row = new double[grid->dim_x];
+    double coord_y, tmp;
+    for (int x = 0; x < grid->dim_x; x++) {
+        map_lattice_to_coordinate_space(grid, x, 0, &coord_x[x], &tmp);
+    }
+    for (int y = 0; y < grid->dim_y; y++) {
+        map_lattice_to_coordinate_space(grid, 0, y, &tmp, &coord_y);
+        harmonic->get_row(y, coord_x, coord_y, row);
+        for (int x = 0; x < grid->dim_x; x++) {
+            CPPUNIT_ASSERT( std::abs(row[x] - harmonic->get_value(x, y)) < BLOCK_TOLERANCE );
+        }
+    }
+    delete [] coord_x;
+    delete [] row;
+    delete harmonic;
+    delete grid;
+
+    size_t size;
+    double *reference = evolve_with_refresh(1, 0., &size);
+    double *values = evolve_with_refresh(1, 1.e-300, &size);
+    CPPUNIT_ASSERT( max_difference(values, reference, 2 * size) == 0. );
+    delete [] values;
+    double *frozen = evolve_with_refresh(ORDER_STEPS + 1, 0., &size);
+    values = evolve_with_refresh(1, 1.e300, &size);
+    CPPUNIT_ASSERT( max_difference(values, frozen, 2 * size) == 0. );
+    delete [] values;
+    values = evolve_with_refresh(2, 0., &size);
+    double distance = relative_distance(values, reference, 2 * size);
+    CPPUNIT_ASSERT( distance > 0. && distance < 0.1 * relative_distance(frozen, reference, 2 * size) );
+    delete [] values;
+    delete [] frozen;
+    delete [] reference;
+    std::cout << "TEST FUNCTION: potential_refresh_test -> PASSED! " << std::endl;
+}
+
+// Trap moving along x, as a separable potential and as a function of x and y
+static double moving_trap_x(double x, double t) {
+    return 0.5 * (x - sin(10. * t)) * (x - sin(10. * t));
+}
+
+static double moving_trap_y(double y, double t) {
+    return 0.5 * y * y;
+}
+
+static double moving_trap(double x, double y, double t) {
+    return moving_trap_x(x, t) + moving_trap_y(y, t);
+}
+
+static double *evolve_in_trap(bool separable, const char *kernel_type, bool imag_time, const char *coordinate_system, size_t *size) {
+    Lattice2D *grid = new Lattice2D(ORDER_DIM, 20., ORDER_DIM, 20., false, false, 0., coordinate_system);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    Potential *potential = separable ? new SeparablePotential(grid, moving_trap_x, moving_trap_y) : new Potential(grid, moving_trap);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+    Solver *solver = new Solver(grid, state, hamiltonian, ORDER_TIME / ORDER_STEPS, kernel_type);
+    solver->evolve(ORDER_STEPS, imag_time);
+    double *values = copy_inner_state(grid, state, size);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return values;
+}
+
+// The product of the operators of the two terms, built inside the kernel,
+// gives the same evolution as the operator of the potential on the tile.
+void BlockKernelTest::separable_potential_test() {
+    const char *kernel_types[] = {"cpu", "cpu-float"};
+    const double tolerances[] = {BLOCK_TOLERANCE, BLOCK_FLOAT_TOLERANCE};
+    const char *coordinate_systems[] = {"cartesian", "cylindrical"};
+    size_t size;
+    for (int k = 0; k < 2; k++) {
+        for (int c = 0; c < 2; c++) {
+            for (int imag_time = 0; imag_time < 2; imag_time++) {
+                double *reference = evolve_in_trap(false, kernel_types[k], imag_time, coordinate_systems[c], &size);
+                double *values = evolve_in_trap(true, kernel_types[k], imag_time, coordinate_systems[c], &size);
+                CPPUNIT_ASSERT( max_difference(values, reference, 2 * size) < tolerances[k] );
+                delete [] reference;
+                delete [] values;
+            }
+            std::cout << "TEST FUNCTION: separable_potential_test with " << kernel_types[k] << " kernel in " << coordinate_systems[c] << " coordinates -> PASSED! " << std::endl;
+        }
+    }
+}
+
+// Free evolution with a potential given as a matrix of zeros (0), without potential (1) or with null separable terms (2)
+static double *evolve_free(int zero_potential, const char *kernel_type, bool imag_time, const char *coordinate_system, size_t *size) {
+    Lattice2D *grid = new Lattice2D(ORDER_DIM, 20., ORDER_DIM, 20., false, false, 0., coordinate_system);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    double *matrix = new double[grid->dim_x * grid->dim_y]();
+    double (*null_term)(double x) = const_potential;
+    Potential *potential = NULL;
+    if (zero_potential == 0) {
+        potential = new Potential(grid, matrix);
+    }
+    else if (zero_potential == 2) {
+        potential = new SeparablePotential(grid, null_term, null_term);
+    }
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+    Solver *solver = new Solver(grid, state, hamiltonian, ORDER_TIME / ORDER_STEPS, kernel_type);
+    solver->evolve(ORDER_STEPS, imag_time);
+    double *values = copy_inner_state(grid, state, size);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete [] matrix;
+    delete state;
+    delete grid;
+    return values;
+}
+
+// Without a potential the kernels skip the multiplication by the operator,
+// which is exactly one everywhere: the evolution is the same as with a
+// potential given as a matrix of zeros. In imaginary time the norms are
+// summed by the threads in any order, so the states only agree to rounding.
+void BlockKernelTest::zero_potential_test() {
+    Lattice2D *grid = new Lattice2D(ORDER_DIM, 20.);
+    Potential *null_potential = new Potential(grid, const_potential);
+    double (*null_term)(double x) = const_potential;
+    SeparablePotential *null_separable = new SeparablePotential(grid, null_term, null_term);
+    HarmonicPotential *harmonic = new HarmonicPotential(grid, 1., 1.);
+    CPPUNIT_ASSERT( null_potential->is_zero() );
+    CPPUNIT_ASSERT( null_separable->is_zero() );
+    CPPUNIT_ASSERT( !harmonic->is_zero() );
+    delete null_potential;
+    delete null_separable;
+    delete harmonic;
+    delete grid;
+
+    const char *kernel_types[] = {"cpu", "cpu-float"};
+    const double tolerances[] = {BLOCK_TOLERANCE, BLOCK_FLOAT_TOLERANCE};
+    const char *coordinate_systems[] = {"cartesian", "cylindrical"};
+    size_t size;
+    for (int k = 0; k < 2; k++) {
+        for (int c = 0; c < 2; c++) {
+            for (int imag_time = 0; imag_time < 2; imag_time++) {
+                double *reference = evolve_free(0, kernel_types[k], imag_time, coordinate_systems[c], &size);
+                for (int zero_potential = 1; zero_potential < 3; zero_potential++) {
+                    double *values = evolve_free(zero_potential, kernel_types[k], imag_time, coordinate_systems[c], &size);
+                    CPPUNIT_ASSERT( max_difference(values, reference, 2 * size) <= (imag_time ? tolerances[k] : 0.) );
+                    delete [] values;
+                }
+                delete [] reference;
+            }
+            std::cout << "TEST FUNCTION: zero_potential_test with " << kernel_types[k] << " kernel in " << coordinate_systems[c] << " coordinates -> PASSED! " << std::endl;
+        }
+    }
+}
+
+// Once the kernel is built, the steps go through the scratch blocks of the
+// threads and never through the heap allocator.
+void BlockKernelTest::scratch_allocation_test() {
+    const char *layouts[] = {"split", "interleaved"};
+    for (int l = 0; l < 2; l++) {
+        for (int components = 1; components < 3; components++) {
+            Lattice2D *grid = new Lattice2D(SCRATCH_DIM, 20.);
+            State *state = new GaussianState(grid, 1.);
+            State *state_b = new GaussianState(grid, 1., 1., 0.5);
+            Potential *potential = new HarmonicPotential(grid, 1., 1.);
+            Hamiltonian *hamiltonian;
+            Solver *solver;
+            if (components == 2) {
+                hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 1., 0.5, 1., 0.1);
+                solver = new Solver(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), 1.e-3);
+            }
+            else {
+                hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+                solver = new Solver(grid, state, hamiltonian, 1.e-3);
+            }
+            solver->set_memory_layout(layouts[l]);
+            solver->evolve(1, false);
+            long allocations = heap_allocations;
+            solver->evolve(ORDER_STEPS, false);
+            CPPUNIT_ASSERT_EQUAL( allocations, heap_allocations );
+            delete solver;
+            delete hamiltonian;
+            delete potential;
+            delete state_b;
+            delete state;
+            delete grid;
+        }
+        std::cout << "TEST FUNCTION: scratch_allocation_test with " << layouts[l] << " layout -> PASSED! " << std::endl;
+    }
+}
+
+// A potential that is not separable, so that the solver builds its operators on the whole tile
+static double coupled_potential(double x, double y) {
+    return 0.1 * x * y;
+}
+
+// Count the lines of a placement report that start with name, and check that each of them tells where its pages are
+static int placement_lines(const string &placement, const string &name) {
+    stringstream lines(placement);
+    string line;
+    int count = 0;
+    while (getline(lines, line)) {
+        CPPUNIT_ASSERT( line.find("node ") != string::npos || line.find("unknown") != string::npos );
+        // Every page of the buffers was touched when they were allocated
+        CPPUNIT_ASSERT( line.find("not resident") == string::npos );
+        if (line.compare(0, name.size(), name) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void BlockKernelTest::grid_allocation_test() {
+    // Grids are zeroed and aligned to cache lines; two grids from a huge page up start at different offsets in their huge pages
+    size_t sizes[] = {1, 1000, GRID_DIM * GRID_DIM};
+    for (int i = 0; i < 3; i++) {
+        double *grid = new_grid<double>(sizes[i], GRID_DIM);
+        double *other = new_grid<double>(sizes[i], GRID_DIM);
+        CPPUNIT_ASSERT_EQUAL( size_t(0), size_t(reinterpret_cast<uintptr_t>(grid) % GRID_ALIGNMENT) );
+        for (size_t j = 0; j < sizes[i]; j++) {
+            CPPUNIT_ASSERT_EQUAL( 0., grid[j] );
+        }
+        if (sizes[i] * sizeof(double) >= HUGE_PAGE_SIZE) {
+            CPPUNIT_ASSERT( reinterpret_cast<uintptr_t>(grid) % HUGE_PAGE_SIZE != reinterpret_cast<uintptr_t>(other) % HUGE_PAGE_SIZE );
+        }
+        free_grid(other);
+        free_grid(grid);
+    }
+
+    Lattice2D *grid = new Lattice2D(GRID_DIM, 20.);
+    State *state = new GaussianState(grid, 1.);
+    State *state_b = new GaussianState(grid, 1., 1., 0.5);
+    Potential *potential = new Potential(grid, coupled_potential);
+    Hamiltonian2Component *hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 1., 0.5, 1., 0.1);
+    Solver *solver = new Solver(grid, state, state_b, hamiltonian, 1.e-3, "cpu-float");
+    solver->set_memory_layout("interleaved");
+    solver->evolve(1, false);
+    string placement = solver->memory_placement();
+    CPPUNIT_ASSERT_EQUAL( 4, placement_lines(placement, "state ") );
+    CPPUNIT_ASSERT_EQUAL( 4, placement_lines(placement, "potential ") );
+    CPPUNIT_ASSERT_EQUAL( 4, placement_lines(placement, "kernel wave function ") );
+    CPPUNIT_ASSERT_EQUAL( 4, placement_lines(placement, "kernel potential ") );
+    CPPUNIT_ASSERT_EQUAL( 2, placement_lines(placement, "kernel copy ") );
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state_b;
+    delete state;
+    delete grid;
+    std::cout << "TEST FUNCTION: grid_allocation_test -> PASSED! " << std::endl;
+}
+
+// Evolves an interacting gas in a rotating trap in blocks of the given size, the default one if width is 0,
+// or of the size tuned with the given profile
+static double *evolve_in_blocks(int width, int height, size_t *size, const char *profile = NULL) {
+    Lattice2D *grid = new Lattice2D(LAYOUT_DIM_X, 20., LAYOUT_DIM_Y, 15., false, false, 0.5);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    Potential *potential = new HarmonicPotential(grid, 1., 2.);
+    Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10., 0., 0.5);
+    Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3);
+    if (width > 0) {
+        solver->set_block_size(width, height);
+    }
+    if (profile != NULL) {
+        size_t tile_size;
+        double *initial = copy_inner_state(grid, state, &tile_size);
+        solver->tune_block_size(false, profile);
+        double *tuned = copy_inner_state(grid, state, &tile_size);
+        // The candidates are timed on the state, which is given back untouched
+        CPPUNIT_ASSERT_EQUAL( 0., max_difference(initial, tuned, 2 * tile_size) );
+        delete [] tuned;
+        delete [] initial;
+    }
+    solver->evolve(LAYOUT_ITERATIONS);
+    double *values = copy_inner_state(grid, state, size);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state;
+    delete grid;
+    return values;
+}
+
+static int profile_lines(const char *profile) {
+    ifstream file(profile);
+    string line;
+    int count = 0;
+    while (getline(file, line)) {
+        count++;
+    }
+    return count;
+}
+
+void BlockKernelTest::block_size_test() {
+    // The size of the blocks changes the order the dots are evolved in, not the evolution
+    // Blocks of 30 dots are narrower than the halos of the rotating frame of reference on both sides
+    const int sizes[][2] = {{64, 32}, {128, 24}, {BLOCK_WIDTH_MAX, 256}, {30, 30}};
+    size_t size;
+    double *reference = evolve_in_blocks(0, 0, &size);
+    for (int i = 0; i < 4; i++) {
+        double *values = evolve_in_blocks(sizes[i][0], sizes[i][1], &size);
+        CPPUNIT_ASSERT( max_difference(reference, values, 2 * size) < LAYOUT_TOLERANCE );
+        delete [] values;
+    }
+
+    // The first tuning saves its size in the profile, the second one reads it back
+    int rank = 0;
+#ifdef HAVE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+    remove(TUNING_PROFILE);
+    for (int i = 0; i < 2; i++) {
+        double *values = evolve_in_blocks(0, 0, &size, TUNING_PROFILE);
+        CPPUNIT_ASSERT( max_difference(reference, values, 2 * size) < LAYOUT_TOLERANCE );
+        delete [] values;
+        if (rank == 0) {
+            CPPUNIT_ASSERT_EQUAL( 1, profile_lines(TUNING_PROFILE) );
+        }
+    }
+    if (rank == 0) {
+        remove(TUNING_PROFILE);
+    }
+    delete [] reference;
+    std::cout << "TEST FUNCTION: block_size_test -> PASSED! " << std::endl;
+}
+
+// Evolves an interacting gas on a periodic lattice in blocks small enough to cut the tile in bands, in real and then in imaginary time,
+// or a two-component gas on a closed lattice, and reports where the buffers of the kernel are
+static double *evolve_in_place(const char *layout, bool two_components, bool in_place, size_t *size, string &placement) {
+    Lattice2D *grid = new Lattice2D(LAYOUT_DIM_X, 20., LAYOUT_DIM_Y, 15., !two_components, !two_components);
+    State *state = new GaussianState(grid, 1., 1., 0.5, -0.5);
+    State *state_b = new GaussianState(grid, 1., 1., -0.5);
+    Potential *potential = new HarmonicPotential(grid, 1., 2.);
+    Hamiltonian *hamiltonian;
+    Solver *solver;
+    if (two_components) {
+        hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 5., 2., 5., 0.5, 0.2);
+        solver = new Solver(grid, state, state_b, static_cast<Hamiltonian2Component *>(hamiltonian), 1.e-3);
+    }
+    else {
+        hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+        solver = new Solver(grid, state, hamiltonian, 1.e-3);
+    }
+    solver->set_memory_layout(layout);
+    solver->set_block_size(64, 32);
+    solver->set_in_place(in_place);
+    solver->evolve(LAYOUT_ITERATIONS);
+    if (!two_components) {
+        solver->evolve(LAYOUT_ITERATIONS, true);
+    }
+    placement = solver->memory_placement();
+    *size = 4 * grid->dim_x * grid->dim_y;
+    double *values = new double[*size];
+    std::copy(state->p_real, state->p_real + *size / 4, values);
+    std::copy(state->p_imag, state->p_imag + *size / 4, values + *size / 4);
+    std::copy(state_b->p_real, state_b->p_real + *size / 4, values + *size / 2);
+    std::copy(state_b->p_imag, state_b->p_imag + *size / 4, values + 3 * *size / 4);
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state_b;
+    delete state;
+    delete grid;
+    return values;
+}
+
+void BlockKernelTest::in_place_test() {
+    // Evolving a single buffer with the strips of the previous step gives the same states as the two buffers,
+    // and only the strips are left of the second buffer
+    const char *layouts[] = {"split", "interleaved", "tiled"};
+    for (int l = 0; l < 3; l++) {
+        for (int two_components = 0; two_components < 2; two_components++) {
+            size_t size;
+            string ping_pong, in_place;
+            double *reference = evolve_in_place(layouts[l], two_components, false, &size, ping_pong);
+            double *values = evolve_in_place(layouts[l], two_components, true, &size, in_place);
+            CPPUNIT_ASSERT( max_difference(reference, values, size) < LAYOUT_TOLERANCE );
+            int buffer_lines = layouts[l] == string("split") ? 2 : 1;
+            CPPUNIT_ASSERT_EQUAL( placement_lines(ping_pong, "kernel wave function ") - buffer_lines, placement_lines(in_place, "kernel wave function ") );
+            CPPUNIT_ASSERT_EQUAL( 0, placement_lines(ping_pong, "kernel strips ") );
+            CPPUNIT_ASSERT_EQUAL( 4, placement_lines(in_place, "kernel strips ") );
+            delete [] values;
+            delete [] reference;
+        }
+        std::cout << "TEST FUNCTION: in_place_test with " << layouts[l] << " layout -> PASSED! " << std::endl;
+    }
+}
+
+void BlockKernelTest::row_copies_test() {
+    // Rows of any width copied between any offsets, with the bytes around the rectangle left alone
+    const size_t widths[] = {1, 15, 16, 17, 120 * sizeof(double) + 3};
+    const size_t offsets[] = {0, 1, 8, 15};
+    const size_t stride = COPY_STRIDE, height = 5;
+    unsigned char *src = new unsigned char[stride * height], *plain = new unsigned char[stride * height], *streamed = new unsigned char[stride * height];
+    for (size_t i = 0; i < stride * height; i++) {
+        src[i] = static_cast<unsigned char>(i * 7 + 1);
+    }
+    for (int w = 0; w < 5; w++) {
+        for (int d = 0; d < 4; d++) {
+            for (int o = 0; o < 4; o++) {
+                std::fill(plain, plain + stride * height, 0);
+                std::fill(streamed, streamed + stride * height, 0);
+                memcpy2D(plain + offsets[d], stride, src + offsets[o], stride, widths[w], height - 1);
+                stream2D(streamed + offsets[d], stride, src + offsets[o], stride, widths[w], height - 1);
+                for (size_t y = 0; y < height; y++) {
+                    for (size_t x = 0; x < stride; x++) {
+                        bool inside = y < height - 1 && x >= offsets[d] && x < offsets[d] + widths[w];
+                        unsigned char expected = inside ? src[y * stride + x - offsets[d] + offsets[o]] : 0;
+                        CPPUNIT_ASSERT_EQUAL( int(expected), int(plain[y * stride + x]) );
+                        CPPUNIT_ASSERT_EQUAL( int(expected), int(streamed[y * stride + x]) );
+                    }
+                }
+            }
+        }
+    }
+    delete [] streamed;
+    delete [] plain;
+    delete [] src;
+    std::cout << "TEST FUNCTION: row_copies_test -> PASSED! " << std::endl;
+}
+
+static double parabolic_potential(double x, double y) {
+    return 0.5 * x * x;
+}
+
+// Evolves a gas on a periodic line, on a periodic plane, on a rotating closed plane or a two-component gas on a closed plane,
+// in two calls that stop between two exchanges of the halos, and returns the inner dots of the tile. The halos are exchanged
+// as set by halo_exchange, in blocks of block_size (the default size if 0).
+static double *evolve_exchanging(int lattice, int exchange_interval, size_t *size, string halo_exchange = "phases", int block_size = 0) {
+    Lattice *grid;
+    if (lattice == 0) {
+        grid = new Lattice1D(2 * LAYOUT_DIM_X, 20., true, "cartesian", exchange_interval);
+    }
+    else {
+        grid = new Lattice2D(LAYOUT_DIM_X, 20., LAYOUT_DIM_Y, 15., lattice == 1, lattice == 1, lattice == 2 ? 0.5 : 0., "cartesian", exchange_interval);
+    }
+    State *state, *state_b;
+    Potential *potential;
+    if (lattice == 0) {
+        state = new GaussianState(static_cast<Lattice1D *>(grid), 1., 0.5);
+        state_b = new GaussianState(static_cast<Lattice1D *>(grid), 1., -0.5);
+        potential = new Potential(grid, parabolic_potential);
+    }
+    else {
+        state = new GaussianState(static_cast<Lattice2D *>(grid), 1., 1., 0.5, -0.5);
+        state_b = new GaussianState(static_cast<Lattice2D *>(grid), 1., 1., -0.5);
+        potential = new HarmonicPotential(static_cast<Lattice2D *>(grid), 1., 2.);
+    }
+    Hamiltonian *hamiltonian;
+    Solver *solver;
+    if (lattice == 3) {
+        hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 5., 2., 5., 0.5, 0.2);
+        solver = new Solver(grid, state, state_b, static_cast<Hamiltonian2Component *>(hamiltonian), 1.e-3);
+    }
+    else {
+        hamiltonian = new Hamiltonian(grid, potential, 1., 10., 0., lattice == 2 ? 0.5 : 0.);
+        solver = new Solver(grid, state, hamiltonian, 1.e-3);
+    }
+    solver->set_halo_exchange(halo_exchange);
+    if (block_size > 0) {
+        solver->set_block_size(block_size, block_size);
+    }
+    solver->evolve(EXCHANGE_SPLIT);
+    solver->evolve(LAYOUT_ITERATIONS - EXCHANGE_SPLIT);
+    size_t inner_size;
+    double *inner = copy_inner_state(grid, state, &inner_size), *inner_b = copy_inner_state(grid, state_b, &inner_size);
+    *size = 4 * inner_size;
+    double *values = new double[*size];
+    std::copy(inner, inner + 2 * inner_size, values);
+    std::copy(inner_b, inner_b + 2 * inner_size, values + 2 * inner_size);
+    delete [] inner_b;
+    delete [] inner;
+    delete solver;
+    delete hamiltonian;
+    delete potential;
+    delete state_b;
+    delete state;
+    delete grid;
+    return values;
+}
+
+void BlockKernelTest::deep_halo_test() {
+    // Halos as deep as several time steps evolve redundantly between two exchanges and leave the same inner dots
+    // as exchanging thin halos at every step
+    const char *lattices[] = {"periodic line", "periodic plane", "rotating closed plane", "two-component closed plane"};
+    for (int l = 0; l < 4; l++) {
+        size_t size;
+        double *reference = evolve_exchanging(l, 1, &size);
+        for (int exchange_interval = 2; exchange_interval <= 4; exchange_interval *= 2) {
+            double *values = evolve_exchanging(l, exchange_interval, &size);
+            CPPUNIT_ASSERT( max_difference(reference, values, size) < LAYOUT_TOLERANCE );
+            delete [] values;
+        }
+        delete [] reference;
+        std::cout << "TEST FUNCTION: deep_halo_test on a " << lattices[l] << " -> PASSED! " << std::endl;
+    }
+}
+
+void BlockKernelTest::corner_exchange_test() {
+    // Exchanging the corners with the diagonal neighbours, with the bands next to the halos evolved before the
+    // exchange, leaves the same dots as exchanging them in two phases; small blocks make bands of every kind
+    const char *lattices[] = {"periodic line", "periodic plane", "rotating closed plane", "two-component closed plane"};
+    for (int l = 0; l < 4; l++) {
+        for (int exchange_interval = 1; exchange_interval <= 2; exchange_interval++) {
+            size_t size;
+            double *reference = evolve_exchanging(l, exchange_interval, &size, "phases", 40);
+            double *values = evolve_exchanging(l, exchange_interval, &size, "corners", 40);
+            CPPUNIT_ASSERT( max_difference(reference, values, size) == 0. );
+            delete [] values;
+            delete [] reference;
+        }
+        std::cout << "TEST FUNCTION: corner_exchange_test on a " << lattices[l] << " -> PASSED! " << std::endl;
+    }
+}
+
+void BlockKernelTest::shared_halo_test() {
+    // Copying the halos from the tiles in the shared window of the node, a tile of its own on a single process, leaves
+    // the same dots as receiving them in messages
+    const char *lattices[] = {"periodic line", "periodic plane", "rotating closed plane", "two-component closed plane"};
+    for (int l = 0; l < 4; l++) {
+        for (int exchange_interval = 1; exchange_interval <= 2; exchange_interval++) {
+            size_t size;
+            double *reference = evolve_exchanging(l, exchange_interval, &size, "phases", 40);
+            double *values = evolve_exchanging(l, exchange_interval, &size, "shared", 40);
+            CPPUNIT_ASSERT( max_difference(reference, values, size) == 0. );
+            delete [] values;
+            delete [] reference;
+        }
+        std::cout << "TEST FUNCTION: shared_halo_test on a " << lattices[l] << " -> PASSED! " << std::endl;
+    }
+}
+
+void BlockKernelTest::decomposition_test() {
+    // The processes split the long side of a channel, and a square lattice as MPI_Dims_create would
+    const int closed[2] = {0, 0}, halo[2] = {4, 4};
+    const int channel[2] = {512, 8192}, square[2] = {1024, 1024};
+    int dims[2] = {0, 0};
+    process_grid(16, channel, halo, closed, dims);
+    CPPUNIT_ASSERT( dims[0] == 1 && dims[1] == 16 );
+    dims[0] = dims[1] = 0;
+    process_grid(16, square, halo, closed, dims);
+    CPPUNIT_ASSERT( dims[0] == 4 && dims[1] == 4 );
+    dims[0] = dims[1] = 0;
+    process_grid(8, square, halo, closed, dims);
+    CPPUNIT_ASSERT( dims[0] == 4 && dims[1] == 2 );
+    // A number of processes set along one axis is kept
+    dims[0] = 0;
+    dims[1] = 4;
+    process_grid(16, channel, halo, closed, dims);
+    CPPUNIT_ASSERT( dims[0] == 4 && dims[1] == 4 );
+    // The nodes take the blocks of tiles with the fewest halos in between, if they tile the grid
+    int node_dims[2], grid_dims[2] = {4, 4};
+    CPPUNIT_ASSERT( node_grid(4, grid_dims, channel, halo, closed, node_dims) );
+    CPPUNIT_ASSERT( node_dims[0] == 1 && node_dims[1] == 4 );
+    CPPUNIT_ASSERT( !node_grid(3, grid_dims, channel, halo, closed, node_dims) );
+
+    Lattice2D *grid = new Lattice2D(LAYOUT_DIM_X, 20., LAYOUT_DIM_Y, 15., true, false);
+    std::string description = grid->decomposition();
+    CPPUNIT_ASSERT( description.find("1x1 processes") == 0 );
+    CPPUNIT_ASSERT( description.find("tile 158x100, inner 150x100") != std::string::npos );
+    delete grid;
+    std::cout << "TEST FUNCTION: decomposition_test -> PASSED! " << std::endl;
+}
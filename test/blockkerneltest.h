@@ -0,0 +1,77 @@
+#ifndef __BLOCKKERNELTEST_H
+#define __BLOCKKERNELTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include "kernel.h"
+
+#define BLOCK_TOLERANCE 1.e-12
+#define BLOCK_FLOAT_TOLERANCE 1.e-6
+#define PHASE_HIGH_TOLERANCE 1.e-12
+#define PHASE_FAST_TOLERANCE 1.e-8
+#define PHASE_FLOAT_TOLERANCE 1.e-5
+#define PHASE_NORM_TOLERANCE 1.e-9
+#define PHASE_DIM 64
+#define PHASE_ITERATIONS 200
+#define LAYOUT_DIM_X 150
+#define LAYOUT_DIM_Y 100
+#define LAYOUT_ITERATIONS 20
+#define LAYOUT_TOLERANCE 1.e-13
+#define ORDER_DIM 64
+#define ORDER_TIME 0.32
+#define ORDER_STEPS 16
+#define ORDER_REFERENCE_STEPS 256
+#define ADAPTIVE_TOLERANCE 1.e-5
+#define SCRATCH_DIM 300
+#define GRID_DIM 600
+#define TUNING_PROFILE "block_size_test.profile"
+#define COPY_STRIDE 1000
+#define EXCHANGE_SPLIT 13
+
+class BlockKernelTest: public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(BlockKernelTest);
+    CPPUNIT_TEST( vectorised_kinetic_kernels_test );
+    CPPUNIT_TEST( fused_step_test );
+    CPPUNIT_TEST( phase_accuracy_test );
+    CPPUNIT_TEST( phase_accuracy_norm_test );
+    CPPUNIT_TEST( memory_layout_test );
+    CPPUNIT_TEST( integrator_order_test );
+    CPPUNIT_TEST( adaptive_time_step_test );
+    CPPUNIT_TEST( potential_refresh_test );
+    CPPUNIT_TEST( separable_potential_test );
+    CPPUNIT_TEST( zero_potential_test );
+    CPPUNIT_TEST( scratch_allocation_test );
+    CPPUNIT_TEST( grid_allocation_test );
+    CPPUNIT_TEST( block_size_test );
+    CPPUNIT_TEST( in_place_test );
+    CPPUNIT_TEST( row_copies_test );
+    CPPUNIT_TEST( deep_halo_test );
+    CPPUNIT_TEST( corner_exchange_test );
+    CPPUNIT_TEST( shared_halo_test );
+    CPPUNIT_TEST( decomposition_test );
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void vectorised_kinetic_kernels_test();
+    void fused_step_test();
+    void phase_accuracy_test();
+    void phase_accuracy_norm_test();
+    void memory_layout_test();
+    void integrator_order_test();
+    void adaptive_time_step_test();
+    void potential_refresh_test();
+    void separable_potential_test();
+    void zero_potential_test();
+    void scratch_allocation_test();
+    void grid_allocation_test();
+    void block_size_test();
+    void in_place_test();
+    void row_copies_test();
+    void deep_halo_test();
+    void corner_exchange_test();
+    void shared_halo_test();
+    void decomposition_test();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BlockKernelTest);
+
+#endif
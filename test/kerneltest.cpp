@@ -6,7 +6,7 @@
 
 template<class F>
 void my_test<F>::free_particle_test() {
-	Lattice *grid = new Lattice2D(DIM, LENGTH, true, true);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, true, true);
 	State *state = new ExponentialState(grid);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, NULL);
 	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, this->kernel_type);
@@ -20,15 +20,15 @@ void my_test<F>::free_particle_test() {
   delete state;
   delete grid;
   //Check
-  CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE );
-  CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+  CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < this->tolerance );
+  CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
   std::cout << "TEST FUNCTION: free_particle_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 }
 
 template<class F>
 void my_test<F>::harmonic_oscillator_test() {
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
 	State *state = new GaussianState(grid, 1.);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
@@ -43,8 +43,8 @@ void my_test<F>::harmonic_oscillator_test() {
   delete state;
   delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
     std::cout << "TEST FUNCTION: harmonic_oscillator_test with " << this->kernel_type <<
               " kernel -> PASSED! " << std::endl;
 }
@@ -52,7 +52,7 @@ void my_test<F>::harmonic_oscillator_test() {
 template<class F>
 void my_test<F>::imaginary_harmonic_oscillator_test() {
 	double std_energy = 1.00001;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
 	State *state = new GaussianState(grid, 0.5);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
@@ -66,8 +66,8 @@ void my_test<F>::imaginary_harmonic_oscillator_test() {
   delete state;
   delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
     std::cout << "TEST FUNCTION: imaginary_harmonic_oscillator_test with " << this->kernel_type <<
               " kernel -> PASSED! " << std::endl;
 }
@@ -75,7 +75,7 @@ void my_test<F>::imaginary_harmonic_oscillator_test() {
 template<class F>
 void my_test<F>::intra_particle_interaction_test() {
 	double std_mean_XX = 1.02321; //1.05368;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10);
@@ -91,9 +91,9 @@ void my_test<F>::intra_particle_interaction_test() {
 	delete state;
 	delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
 	std::cout << "TEST FUNCTION: intra_particle_interaction_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 }
@@ -102,7 +102,7 @@ template<class F>
 void my_test<F>::imaginary_intra_particle_interaction_test() {
 	double std_energy = 1.59273;
 	double std_mean_XX = 0.768148; // 0.780077;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10);
@@ -117,9 +117,9 @@ void my_test<F>::imaginary_intra_particle_interaction_test() {
 	delete state;
 	delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
 	std::cout << "TEST FUNCTION: imaginary_intra_particle_interaction_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 }
@@ -127,7 +127,7 @@ void my_test<F>::imaginary_intra_particle_interaction_test() {
 template<class F>
 void my_test<F>::rotating_frame_of_reference_test() {
 	double angular_velocity = 0.7;
-	Lattice *grid = new Lattice2D(300, 20, false, false, angular_velocity);
+	Lattice2D *grid = new Lattice2D(300, 20, false, false, angular_velocity);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 100., angular_velocity);
@@ -142,8 +142,8 @@ void my_test<F>::rotating_frame_of_reference_test() {
 	delete state;
 	delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE*10. );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < this->tolerance*10. );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
 	std::cout << "TEST FUNCTION: rotating_frame_of_reference_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 
@@ -153,7 +153,7 @@ template<class F>
 void my_test<F>::imaginary_rotating_frame_of_reference_test() {
 	double fin_energy = 4.89895;
 	double angular_velocity = 0.7;
-	Lattice *grid = new Lattice2D(300, 20, false, false, angular_velocity);
+	Lattice2D *grid = new Lattice2D(300, 20, false, false, angular_velocity);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 100., angular_velocity);
@@ -167,8 +167,8 @@ void my_test<F>::imaginary_rotating_frame_of_reference_test() {
 	delete state;
 	delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(fin_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(fin_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
 	std::cout << "TEST FUNCTION: imaginary_rotating_frame_of_reference_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 
@@ -176,7 +176,7 @@ void my_test<F>::imaginary_rotating_frame_of_reference_test() {
 
 template<class F>
 void my_test<F>::mixed_BEC_test() {
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
 	State *state1 = new GaussianState(grid, 1);
 	State *state2 = new State(grid);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
@@ -197,10 +197,10 @@ void my_test<F>::mixed_BEC_test() {
 	delete state2;
 	delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm1 - norm2) < NORM_TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm2 - norm1) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm1 - norm2) < this->norm_tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm2 - norm1) < this->norm_tolerance );
 	std::cout << "TEST FUNCTION: mixed_BEC_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 }
@@ -209,7 +209,7 @@ template<class F>
 void my_test<F>::imaginary_mixed_BEC_test() {
 	double std_norm1 = 0.915292;
 	double std_norm2 = 0.084708;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH);
 	State *state1 = new GaussianState(grid, 1);
 	State *state2 = new State(grid);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
@@ -228,20 +228,36 @@ void my_test<F>::imaginary_mixed_BEC_test() {
 	delete state2;
 	delete grid;
 	//Check
-	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(std_norm1 - norm1) < NORM_TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(std_norm2 - norm2) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < this->tolerance );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < this->norm_tolerance );
+	CPPUNIT_ASSERT( std::abs(std_norm1 - norm1) < this->norm_tolerance );
+	CPPUNIT_ASSERT( std::abs(std_norm2 - norm2) < this->norm_tolerance );
 	std::cout << "TEST FUNCTION: imaginary_mixed_BEC_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
 }
 
 void CpuKernelTest::setUp() {
     this->kernel_type = "cpu";
+    this->tolerance = TOLERANCE;
+    this->norm_tolerance = NORM_TOLERANCE;
+}
+
+void CpuFloatKernelTest::setUp() {
+    this->kernel_type = "cpu-float";
+    this->tolerance = FLOAT_TOLERANCE;
+    this->norm_tolerance = FLOAT_NORM_TOLERANCE;
+}
+
+void CpuMixedKernelTest::setUp() {
+    this->kernel_type = "cpu-mixed";
+    this->tolerance = FLOAT_TOLERANCE;
+    this->norm_tolerance = FLOAT_NORM_TOLERANCE;
 }
 
 #ifdef CUDA
 void GpuKernelTest::setUp() {
     this->kernel_type = "gpu";
+    this->tolerance = TOLERANCE;
+    this->norm_tolerance = NORM_TOLERANCE;
 }
 #endif
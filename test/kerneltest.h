@@ -7,10 +7,15 @@
 
 #define TOLERANCE 1.e-3
 #define NORM_TOLERANCE 1.e-5
+// Single precision: the residual norm drift is about 1e-8 per step in real time
+#define FLOAT_TOLERANCE 1.e-3
+#define FLOAT_NORM_TOLERANCE 5.e-4
 
 class KernelTest: public CppUnit::TestFixture {
 public:
     std::string kernel_type;
+    double tolerance;         ///< Tolerance on the energies.
+    double norm_tolerance;    ///< Tolerance on the norms.
 };
 
 class CpuKernelTest: public KernelTest {
@@ -18,6 +23,16 @@ public:
     void setUp();
 };
 
+class CpuFloatKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
+class CpuMixedKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
 
 template<class F>
 class my_test: public F {
@@ -45,6 +60,8 @@ class my_test: public F {
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuKernelTest>);
+CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuFloatKernelTest>);
+CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuMixedKernelTest>);
 #ifdef CUDA
 class GpuKernelTest: public KernelTest {
 public: